@@ -0,0 +1,80 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <vector>
+#include <mutex>
+#include <new>
+#include "AlignedBufferPool.hpp"
+using namespace std;
+
+AlignedBufferPool::AlignedBufferPool(size_t align, size_t maxIdle) throw()
+  : alignment(align), maxIdleBytes(maxIdle), idleBytes(0),
+    idle(sizeof(size_t) * 8) {}
+AlignedBufferPool::~AlignedBufferPool() throw()
+{
+  for (vector<vector<void *> >::iterator it = idle.begin(); it != idle.end();
+       ++it) {
+    for (vector<void *>::iterator buf = it->begin(); buf != it->end(); ++buf) {
+      free(*buf);
+    }
+  }
+}
+uint32_t AlignedBufferPool::sizeClass(size_t len) throw()
+{
+  uint32_t cls = 0;
+
+  while (((size_t) 1 << cls) < len) {
+    ++cls;
+  }
+
+  return cls;
+}
+/*
+ * Return a buffer of at least len bytes; its real size is stored in cap
+ * and must be passed back to release().
+ */
+void *AlignedBufferPool::acquire(size_t len, size_t &cap) throw(bad_alloc)
+{
+  uint32_t cls = sizeClass(len < alignment ? alignment : len);
+  cap = (size_t) 1 << cls;
+  {
+    lock_guard<mutex> guard(lock);
+
+    if (!idle[cls].empty()) {
+      void *buf = idle[cls].back();
+      idle[cls].pop_back();
+      idleBytes -= cap;
+      return buf;
+    }
+  }
+  void *buf;
+
+  if (0 != posix_memalign(&buf, alignment, cap)) {
+    throw bad_alloc();
+  }
+
+  return buf;
+}
+void AlignedBufferPool::release(void *buf, size_t cap) throw()
+{
+  if (NULL == buf) {
+    return;
+  }
+
+  {
+    lock_guard<mutex> guard(lock);
+
+    if (idleBytes + cap <= maxIdleBytes) {
+      try {
+        idle[sizeClass(cap)].push_back(buf);
+        idleBytes += cap;
+        return;
+      } catch (bad_alloc &e) {
+      }
+    }
+  }
+  free(buf);
+}
+size_t AlignedBufferPool::getAlignment() throw()
+{
+  return alignment;
+}
@@ -0,0 +1,34 @@
+#ifndef ALIGNEDBUFFERPOOL_HPP
+#define ALIGNEDBUFFERPOOL_HPP
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <mutex>
+#include <new>
+using namespace std;
+/*
+ * Reusable buffers aligned for O_DIRECT.
+ * Buffers come in power-of-two sizes of at least the alignment. A
+ * released buffer is kept for the next acquire() of the same size, up
+ * to maxIdleBytes in total; beyond that it is freed.
+ * All members may be called from several threads at once.
+ */
+class AlignedBufferPool
+{
+private:
+  size_t alignment;
+  size_t maxIdleBytes;
+  size_t idleBytes;
+  vector<vector<void *> > idle; //Indexed by log2 of the buffer size
+  mutex lock;
+
+  static uint32_t sizeClass(size_t len) throw();
+
+public:
+  AlignedBufferPool(size_t align, size_t maxIdle) throw();
+  ~AlignedBufferPool() throw();
+  void *acquire(size_t len, size_t &cap) throw(bad_alloc);
+  void release(void *buf, size_t cap) throw();
+  size_t getAlignment() throw();
+};
+#endif //ALIGNEDBUFFERPOOL_HPP
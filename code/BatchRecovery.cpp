@@ -0,0 +1,317 @@
+#include <string>
+#include <vector>
+#include <list>
+#include <set>
+#include <map>
+#include <unordered_map>
+#include <utility>
+#include <iostream>
+#include <fstream>
+#include <memory>
+#include <cctype>
+#include <cerrno>
+#include "Fat32Action.hpp"
+#include "Fat32DataAccess.hpp"
+#include "Digest.hpp"
+#include "FileDigester.hpp"
+#include "BatchRecovery.hpp"
+using namespace std;
+
+BatchRecovery::BatchRecovery(const string &devName, const DeviceOptions &opts,
+                             const string &manifest,
+                             const string &alg) throw(FileIOError)
+  : Fat32Action(devName, opts), manifestName(manifest), digester(fat32DA, alg)
+{
+  unique_ptr<Digest> d(Digest::create(alg));
+  digestLen = 2 * d->getSize();
+}
+BatchRecovery::~BatchRecovery() throw() {}
+/*
+ * Whether name could be an 8.3 name as getShortName() prints it.
+ */
+bool BatchRecovery::isShortName(const string &name) throw()
+{
+  size_t dot = name.find('.');
+  size_t baseLen = string::npos == dot ? name.length() : dot;
+  size_t extLen = string::npos == dot ? 0 : name.length() - dot - 1;
+
+  if (0 == baseLen || baseLen > 8 || extLen > 3 ||
+      (string::npos != dot && string::npos != name.find('.', dot + 1))) {
+    return false;
+  }
+
+  for (string::const_iterator it = name.begin(); it != name.end(); ++it) {
+    if (islower((unsigned char) *it) || isspace((unsigned char) *it)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+static bool isHexString(const string &s, size_t len)
+{
+  if (len != s.length()) {
+    return false;
+  }
+
+  for (string::const_iterator it = s.begin(); it != s.end(); ++it) {
+    if (!isxdigit((unsigned char) *it)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+void BatchRecovery::readManifest() throw(FileIOError, Fat32ActionError)
+{
+  ifstream in(manifestName.c_str());
+
+  if (!in) {
+    throw FileIOError(errno, manifestName);
+  }
+
+  string line;
+
+  while (getline(in, line)) {
+    size_t end = line.find_last_not_of(" \t\r");
+
+    if (string::npos == end || '#' == line[0]) {
+      continue;
+    }
+
+    line.erase(end + 1);
+    Target t;
+    size_t sep = line.find_last_of(" \t");
+
+    //A trailing hex word of the digest's length is the digest; names may
+    //contain spaces
+    if (string::npos != sep && isHexString(line.substr(sep + 1), digestLen)) {
+      t.digest = line.substr(sep + 1);
+
+      for (string::iterator it = t.digest.begin(); it != t.digest.end();
+           ++it) {
+        *it = tolower((unsigned char) *it);
+      }
+
+      line.erase(line.find_last_not_of(" \t", sep) + 1);
+    }
+
+    t.name = line;
+
+    if (!t.name.empty()) {
+      targets.push_back(t);
+    }
+  }
+
+  if (in.bad()) {
+    throw FileIOError(EIO, manifestName);
+  }
+}
+/*
+ * Hash every readable candidate of the entries with a digest, so they
+ * can be read and hashed in batches.
+ */
+void BatchRecovery::hashCandidates() throw(FileIOError)
+{
+  vector<FileHandler *> pending;
+  set<pair<uint32_t, uint32_t> > seen;
+
+  for (vector<Target>::iterator t = targets.begin(); t != targets.end(); ++t) {
+    if (t->digest.empty()) {
+      continue;
+    }
+
+    for (list<FileHandler>::iterator it = t->matches.begin();
+         it != t->matches.end(); ++it) {
+      pair<uint32_t, uint32_t> entry(it->getDirClus(), it->getDirOffset());
+
+      if (seen.insert(entry).second &&
+          Fat32DataAccess::ReadOK == fat32DA.getReadStatus(*it)) {
+        pending.push_back(&*it);
+      }
+    }
+  }
+
+  vector<string> out;
+
+  try {
+    digester.digestAll(pending, out);
+  } catch (ClusterOccupied &e) {
+    return; //Left to digestMatches(), one at a time
+  } catch (BrokenFATChain &e) {
+    return;
+  }
+
+  for (size_t i = 0; i < pending.size(); ++i) {
+    digests[make_pair(pending[i]->getDirClus(), pending[i]->getDirOffset())] =
+      out[i];
+  }
+}
+bool BatchRecovery::digestMatches(FileHandler &fh,
+                                  const string &digest) throw(FileIOError)
+{
+  map<pair<uint32_t, uint32_t>, string>::iterator it =
+    digests.find(make_pair(fh.getDirClus(), fh.getDirOffset()));
+
+  if (it != digests.end()) {
+    return 0 == digest.compare(it->second);
+  }
+
+  try {
+    return 0 == digest.compare(digester.digest(fh));
+  } catch (ClusterOccupied &e) {
+    return false;
+  } catch (BrokenFATChain &e) {
+    return false;
+  }
+}
+/*
+ * Pick the entry to recover for t and recover it.
+ * Returns the result as -r and -R would print it.
+ */
+string BatchRecovery::resolve(Target &t) throw(FileIOError)
+{
+  if (t.matches.empty()) {
+    return t.name + ": error - file not found";
+  }
+
+  list<FileHandler>::iterator chosen = t.matches.end();
+  list<bool>::iterator chosenByLong = t.byLongName.end();
+
+  if (t.digest.empty()) {
+    if (t.matches.size() > 1) {
+      return t.name + ": error - ambiguous";
+    }
+
+    chosen = t.matches.begin();
+    chosenByLong = t.byLongName.begin();
+  } else {
+    list<bool>::iterator byLong = t.byLongName.begin();
+
+    for (list<FileHandler>::iterator it = t.matches.begin();
+         it != t.matches.end(); ++it, ++byLong) {
+      if (Fat32DataAccess::ReadOK == fat32DA.getReadStatus(*it) &&
+          digestMatches(*it, t.digest)) {
+        chosen = it;
+        chosenByLong = byLong;
+        break;
+      }
+    }
+
+    if (chosen == t.matches.end()) {
+      return t.name + ": error - file not found";
+    }
+  }
+
+  //Another manifest entry may have claimed the entry; recover() checks
+  //the clusters
+  pair<uint32_t, uint32_t> entry(chosen->getDirClus(), chosen->getDirOffset());
+
+  if (0 != claimed.count(entry) || !isalnum((unsigned char) t.name[0])) {
+    return t.name + ": error - fail to recover";
+  }
+
+  try {
+    fat32DA.recover(*chosen, t.name[0], *chosenByLong);
+  } catch (ClusterOccupied &e) {
+    return t.name + ": error - fail to recover";
+  } catch (BrokenFATChain &e) {
+    return t.name + ": error - fail to recover";
+  }
+
+  claimed.insert(entry);
+  return t.name + (t.digest.empty() ? ": recovered" :
+                   ": recovered with " + digester.getName());
+}
+void BatchRecovery::run() throw(FileIOError, Fat32ActionError)
+{
+  readManifest();
+  //Targets by the part of the name a deleted entry still has
+  unordered_map<string, vector<size_t> > byShortTail;
+  unordered_map<string, vector<size_t> > byLongName;
+
+  for (size_t i = 0; i < targets.size(); ++i) {
+    if (isShortName(targets[i].name)) {
+      byShortTail[targets[i].name.substr(1)].push_back(i);
+    }
+
+    byLongName[targets[i].name].push_back(i);
+  }
+
+  forEachEntry([&](FileHandler &fh) {
+    if (!fh.isDeleted()) {
+      return;
+    }
+
+    set<size_t> matched;
+
+    if (fh.hasLongName()) {
+      unordered_map<string, vector<size_t> >::iterator it =
+        byLongName.find(fh.getLongName());
+
+      if (it != byLongName.end()) {
+        for (vector<size_t>::iterator i = it->second.begin();
+             i != it->second.end(); ++i) {
+          targets[*i].matches.push_back(fh);
+          targets[*i].byLongName.push_back(true);
+          matched.insert(*i);
+        }
+      }
+    }
+
+    string shortName = fh.getShortName();
+    unordered_map<string, vector<size_t> >::iterator it =
+      byShortTail.find(shortName.empty() ? shortName : shortName.substr(1));
+
+    if (it != byShortTail.end()) {
+      for (vector<size_t>::iterator i = it->second.begin();
+           i != it->second.end(); ++i) {
+        if (0 == matched.count(*i)) {
+          targets[*i].matches.push_back(fh);
+          targets[*i].byLongName.push_back(false);
+        }
+      }
+    }
+  });
+#ifdef DEBUG
+  cout << "\x1b[7m";
+  cout << targets.size() << " manifest entries resolved in one scan" << endl;
+  cout << "\x1b[0m";
+#endif //DEBUG
+  hashCandidates();
+  vector<string> results;
+  size_t recovered = 0;
+  fat32DA.beginFATBatch();
+
+  try {
+    for (vector<Target>::iterator it = targets.begin(); it != targets.end();
+         ++it) {
+      results.push_back(resolve(*it));
+
+      if (results.back().find(": error") == string::npos) {
+        ++recovered;
+      }
+    }
+
+  } catch (...) {
+    //The directory entries of the targets resolved so far are restored
+    //already; their chains must land as well
+    fat32DA.commitFATBatch();
+
+    for (vector<string>::iterator it = results.begin(); it != results.end();
+         ++it) {
+      cout << *it << endl;
+    }
+
+    throw;
+  }
+
+  fat32DA.commitFATBatch();
+
+  for (vector<string>::iterator it = results.begin(); it != results.end();
+       ++it) {
+    cout << *it << endl;
+  }
+
+  cout << recovered << " of " << targets.size() << " files recovered" << endl;
+}
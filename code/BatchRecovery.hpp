@@ -0,0 +1,55 @@
+#ifndef BATCHRECOVERY_HPP
+#define BATCHRECOVERY_HPP
+#include <string>
+#include <vector>
+#include <list>
+#include <set>
+#include <map>
+#include <utility>
+#include "Fat32Action.hpp"
+#include "FileDigester.hpp"
+using namespace std;
+/*
+ * Recovers every file named in a manifest with one directory scan.
+ * Each line holds a name, optionally followed by the digest of its
+ * content, MD5 unless another algorithm is picked with -H;
+ * blank lines and lines starting with # are skipped. A name shaped like
+ * an 8.3 name matches deleted entries as -r does, and any name matches
+ * deleted entries with that long name as -R does. All FAT changes are
+ * committed together at the end, and one result line is printed per
+ * manifest entry, in manifest order. Candidates of entries with a digest
+ * are hashed in batches before anything is recovered.
+ */
+class BatchRecovery : public Fat32Action
+{
+private:
+  struct Target {
+    string name;
+    string digest;              //Empty if not given
+    list<FileHandler> matches;
+    list<bool> byLongName;      //Parallel to matches
+  };
+
+  string manifestName;
+  vector<Target> targets;
+  set<pair<uint32_t, uint32_t> > claimed; //Directory entries recovered
+  FileDigester digester;
+  size_t digestLen;       //Hex digits in a digest
+  map<pair<uint32_t, uint32_t>, string> digests; //By directory entry
+
+  void readManifest() throw(FileIOError, Fat32ActionError);
+  void hashCandidates() throw(FileIOError);
+  string resolve(Target &t) throw(FileIOError);
+  bool digestMatches(FileHandler &fh, const string &digest)
+  throw(FileIOError);
+
+public:
+  static bool isShortName(const string &name) throw();
+
+  BatchRecovery(const string &devName, const DeviceOptions &opts,
+                const string &manifest, const string &alg = "md5")
+  throw (FileIOError);
+  ~BatchRecovery() throw();
+  void run() throw(FileIOError, Fat32ActionError);
+};
+#endif //BATCHRECOVERY_HPP
@@ -0,0 +1,198 @@
+#include <stdint.h>
+#include <string.h>
+#include <endian.h>
+#include "Digest.hpp"
+#include "Blake3Digest.hpp"
+using namespace std;
+
+static const uint32_t IV[8] = {
+  0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+  0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+static const uint8_t Permutation[16] = {
+  2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8
+};
+static const uint32_t ChunkStart = 1;
+static const uint32_t ChunkEnd = 2;
+static const uint32_t Parent = 4;
+static const uint32_t Root = 8;
+
+static uint32_t rotr32(uint32_t v, int r)
+{
+  return (v >> r) | (v << (32 - r));
+}
+static void g(uint32_t *s, int a, int b, int c, int d, uint32_t x, uint32_t y)
+{
+  s[a] = s[a] + s[b] + x;
+  s[d] = rotr32(s[d] ^ s[a], 16);
+  s[c] = s[c] + s[d];
+  s[b] = rotr32(s[b] ^ s[c], 12);
+  s[a] = s[a] + s[b] + y;
+  s[d] = rotr32(s[d] ^ s[a], 8);
+  s[c] = s[c] + s[d];
+  s[b] = rotr32(s[b] ^ s[c], 7);
+}
+/*
+ * Compress one block into out, 8 words: the chaining value, or for the
+ * root, the first 32 bytes of output.
+ */
+static void compress(const uint32_t *cv, const uint8_t *block,
+                     uint64_t counter, uint32_t blockLen, uint32_t flags,
+                     uint32_t *out)
+{
+  uint32_t m[16];
+  uint32_t s[16] = {
+    cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+    IV[0], IV[1], IV[2], IV[3], (uint32_t) counter,
+    (uint32_t)(counter >> 32), blockLen, flags
+  };
+
+  for (int i = 0; i < 16; ++i) {
+    memcpy(&m[i], block + 4 * i, 4);
+    m[i] = le32toh(m[i]);
+  }
+
+  for (int r = 0; r < 7; ++r) {
+    g(s, 0, 4, 8, 12, m[0], m[1]);
+    g(s, 1, 5, 9, 13, m[2], m[3]);
+    g(s, 2, 6, 10, 14, m[4], m[5]);
+    g(s, 3, 7, 11, 15, m[6], m[7]);
+    g(s, 0, 5, 10, 15, m[8], m[9]);
+    g(s, 1, 6, 11, 12, m[10], m[11]);
+    g(s, 2, 7, 8, 13, m[12], m[13]);
+    g(s, 3, 4, 9, 14, m[14], m[15]);
+    uint32_t p[16];
+
+    for (int i = 0; i < 16; ++i) {
+      p[i] = m[Permutation[i]];
+    }
+
+    memcpy(m, p, sizeof(m));
+  }
+
+  for (int i = 0; i < 8; ++i) {
+    out[i] = s[i] ^ s[i + 8];
+  }
+}
+static void parentCV(const uint32_t *left, const uint32_t *right,
+                     uint32_t flags, uint32_t *out)
+{
+  uint8_t block[64];
+
+  for (int i = 0; i < 8; ++i) {
+    uint32_t l = htole32(left[i]);
+    uint32_t r = htole32(right[i]);
+    memcpy(block + 4 * i, &l, 4);
+    memcpy(block + 32 + 4 * i, &r, 4);
+  }
+
+  compress(IV, block, 0, 64, Parent | flags, out);
+}
+
+Blake3Digest::Blake3Digest() throw()
+  : chunkCounter(0), blockLen(0), blocksCompressed(0), stackLen(0)
+{
+  memcpy(cv, IV, sizeof(cv));
+  memset(block, 0, sizeof(block));
+}
+uint32_t Blake3Digest::startFlag() const throw()
+{
+  return 0 == blocksCompressed ? ChunkStart : 0;
+}
+/*
+ * Add a finished chunk's chaining value, merging each completed subtree
+ * into its parent: as many merges as totalChunks has trailing zero bits.
+ */
+void Blake3Digest::pushChunk(const uint32_t *chunkCV,
+                             uint64_t totalChunks) throw()
+{
+  uint32_t node[8];
+  memcpy(node, chunkCV, sizeof(node));
+
+  while (0 == (totalChunks & 1)) {
+    parentCV(stack[--stackLen], node, 0, node);
+    totalChunks >>= 1;
+  }
+
+  memcpy(stack[stackLen++], node, sizeof(node));
+}
+/*
+ * The last block of a chunk is only compressed once more input shows up,
+ * since the final one is compressed with other flags.
+ */
+void Blake3Digest::update(const void *data, size_t len) throw()
+{
+  const uint8_t *in = (const uint8_t *) data;
+
+  while (len > 0) {
+    if (BlockLen == blockLen) {
+      if (ChunkLen == (blocksCompressed + 1) * BlockLen) {
+        uint32_t chunkCV[8];
+        compress(cv, block, chunkCounter, BlockLen,
+                 startFlag() | ChunkEnd, chunkCV);
+        pushChunk(chunkCV, ++chunkCounter);
+        memcpy(cv, IV, sizeof(cv));
+        blocksCompressed = 0;
+      } else {
+        compress(cv, block, chunkCounter, BlockLen, startFlag(), cv);
+        blocksCompressed++;
+      }
+
+      memset(block, 0, sizeof(block));
+      blockLen = 0;
+    }
+
+    size_t take = BlockLen - blockLen < len ? BlockLen - blockLen : len;
+    memcpy(block + blockLen, in, take);
+    blockLen += take;
+    in += take;
+    len -= take;
+  }
+}
+void Blake3Digest::final(uint8_t *out) throw()
+{
+  //The last chunk's final block, then its parents up to the root
+  const uint32_t *nodeCV = cv;
+  uint8_t nodeBlock[BlockLen];
+  uint64_t counter = chunkCounter;
+  uint32_t nodeLen = blockLen;
+  uint32_t flags = startFlag() | ChunkEnd;
+  memcpy(nodeBlock, block, BlockLen);
+  uint32_t words[8];
+
+  for (uint32_t i = stackLen; i > 0; --i) {
+    uint32_t child[8];
+    compress(nodeCV, nodeBlock, counter, nodeLen, flags, child);
+
+    for (int j = 0; j < 8; ++j) {
+      uint32_t l = htole32(stack[i - 1][j]);
+      uint32_t r = htole32(child[j]);
+      memcpy(nodeBlock + 4 * j, &l, 4);
+      memcpy(nodeBlock + 32 + 4 * j, &r, 4);
+    }
+
+    nodeCV = IV;
+    counter = 0;
+    nodeLen = BlockLen;
+    flags = Parent;
+  }
+
+  compress(nodeCV, nodeBlock, counter, nodeLen, flags | Root, words);
+
+  for (int i = 0; i < 8; ++i) {
+    uint32_t w = htole32(words[i]);
+    memcpy(out + 4 * i, &w, 4);
+  }
+}
+Digest *Blake3Digest::clone() const
+{
+  return new Blake3Digest(*this);
+}
+size_t Blake3Digest::getSize() const throw()
+{
+  return 32;
+}
+const char *Blake3Digest::getName() const throw()
+{
+  return "BLAKE3";
+}
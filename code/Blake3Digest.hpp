@@ -0,0 +1,37 @@
+#ifndef BLAKE3DIGEST_HPP
+#define BLAKE3DIGEST_HPP
+#include <stdint.h>
+#include "Digest.hpp"
+using namespace std;
+/*
+ * BLAKE3 in its default hashing mode, 256-bit output. Portable code, one
+ * compression at a time: input is split in 1KiB chunks whose chaining
+ * values are merged into the tree on a stack as chunks complete.
+ */
+class Blake3Digest : public Digest
+{
+private:
+  static const size_t ChunkLen = 1024;
+  static const size_t BlockLen = 64;
+  static const uint32_t MaxDepth = 54;
+
+  uint32_t cv[8];          //Of the chunk being hashed
+  uint64_t chunkCounter;
+  uint8_t block[BlockLen];
+  size_t blockLen;
+  uint32_t blocksCompressed;
+  uint32_t stack[MaxDepth][8];
+  uint32_t stackLen;
+
+  uint32_t startFlag() const throw();
+  void pushChunk(const uint32_t *chunkCV, uint64_t totalChunks) throw();
+
+public:
+  Blake3Digest() throw();
+  void update(const void *data, size_t len) throw();
+  void final(uint8_t *out) throw();
+  Digest *clone() const;
+  size_t getSize() const throw();
+  const char *getName() const throw();
+};
+#endif //BLAKE3DIGEST_HPP
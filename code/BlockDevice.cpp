@@ -0,0 +1,174 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <errno.h>
+#include <string>
+#include <vector>
+#ifdef DEBUG
+#include <iostream>
+#endif
+#include "LowLevelIO.hpp"
+#include "BlockDevice.hpp"
+#include "PreadBlockDevice.hpp"
+#include "MmapBlockDevice.hpp"
+#include "MemoryBlockDevice.hpp"
+#include "UringBlockDevice.hpp"
+#include "DirectBlockDevice.hpp"
+using namespace std;
+
+const string BlockDevice::DefaultBackend = "pread";
+
+BlockDevice::BlockDevice(int _fd) throw() : fd(_fd) {}
+BlockDevice::~BlockDevice() throw()
+{
+  if (-1 != fd) {
+    close(fd);
+  }
+}
+void BlockDevice::xpreadBatch(vector<IORequest> &reqs) throw(LLIOError,
+    LLIOEOF)
+{
+  for (vector<IORequest>::iterator it = reqs.begin(); it != reqs.end(); ++it) {
+    xpread(it->buf, it->count, it->offset);
+  }
+}
+void BlockDevice::xpreadv(const struct iovec *iov, int iovcnt,
+                          off_t offset) throw(LLIOError, LLIOEOF)
+{
+  for (int i = 0; i < iovcnt; ++i) {
+    xpread(iov[i].iov_base, iov[i].iov_len, offset);
+    offset += iov[i].iov_len;
+  }
+}
+/*
+ * By default a range is mapped straight from the descriptor; the mapping
+ * is shared, so it sees later writes through the page cache.
+ */
+const void *BlockDevice::map(off_t offset, size_t len) throw()
+{
+  long pageSize = sysconf(_SC_PAGESIZE);
+  off_t mapOffset = offset - offset % pageSize;
+  void *mapping = mmap(NULL, len + (offset - mapOffset), PROT_READ,
+                       MAP_SHARED, fd, mapOffset);
+
+  if (MAP_FAILED == mapping) {
+    return NULL;
+  }
+
+  return (unsigned char *) mapping + (offset - mapOffset);
+}
+void BlockDevice::unmap(const void *addr, size_t len) throw()
+{
+  long pageSize = sysconf(_SC_PAGESIZE);
+  uintptr_t start = (uintptr_t) addr - (uintptr_t) addr % pageSize;
+  munmap((void *) start, len + ((uintptr_t) addr - start));
+}
+void BlockDevice::sync() throw(LLIOError)
+{
+  if (-1 == fsync(fd)) {
+    throw LLIOError(errno);
+  }
+}
+int BlockDevice::getFd() throw()
+{
+  return fd;
+}
+off_t BlockDevice::getSize() throw(LLIOError)
+{
+  off_t end = lseek(fd, 0, SEEK_END);
+
+  if (-1 == end) {
+    throw LLIOError(errno);
+  }
+
+  return end;
+}
+bool BlockDevice::isBackend(const string &backend) throw()
+{
+  return backend == "pread" || backend == "mmap" || backend == "memory" ||
+         backend == "uring";
+}
+/*
+ * Open devName with the named backend:
+ *   pread   pread/pwrite on the descriptor
+ *   mmap    the whole device mapped shared
+ *   memory  the whole image held in memory, writes go through to disk
+ *   uring   io_uring, or pread if the kernel does not offer it
+ * With readOnly the device is opened O_RDONLY. With direct it is opened
+ * O_DIRECT and wrapped in a DirectBlockDevice; only the pread and uring
+ * backends support this.
+ */
+BlockDevice *BlockDevice::open(const string &devName, const string &backend,
+                               bool readOnly, bool direct) throw(LLIOError)
+{
+  if (!isBackend(backend)) {
+    throw logic_error("Unknown device backend " + backend);
+  }
+
+  if (direct && !supportsDirect(backend)) {
+    throw logic_error("O_DIRECT is not supported by backend " + backend);
+  }
+
+  int devFd = ::open(devName.c_str(), (readOnly ? O_RDONLY : O_RDWR) |
+                     (direct ? O_DIRECT : 0));
+
+  if (-1 == devFd) {
+    throw LLIOError(errno);
+  }
+
+  if (direct) {
+    BlockDevice *dev = open(devFd, backend, readOnly);
+
+    try {
+      return new DirectBlockDevice(dev);
+    } catch (...) {
+      delete dev;
+      throw;
+    }
+  }
+
+  return open(devFd, backend, readOnly);
+}
+bool BlockDevice::supportsDirect(const string &backend) throw()
+{
+  return backend == "pread" || backend == "uring";
+}
+/*
+ * Whether reading through a mapping of the whole device stands in for
+ * the backend: memory keeps its own copy and uring batches reads, and
+ * both would go unused.
+ */
+bool BlockDevice::supportsView(const string &backend) throw()
+{
+  return backend == "pread" || backend == "mmap";
+}
+BlockDevice *BlockDevice::open(int devFd, const string &backend,
+                               bool readOnly) throw(LLIOError)
+{
+  try {
+    if (backend == "mmap") {
+      return new MmapBlockDevice(devFd, readOnly);
+    } else if (backend == "memory") {
+      return new MemoryBlockDevice(devFd);
+    } else if (backend == "uring") {
+      try {
+        return new UringBlockDevice(devFd);
+      } catch (LLIOError &e) {
+#ifdef DEBUG
+        cout << "\x1b[7m";
+        cout << "io_uring unavailable, using pread: " << e.what() << endl;
+        cout << "\x1b[0m";
+#endif //DEBUG
+      }
+    }
+
+    return new PreadBlockDevice(devFd);
+  } catch (...) {
+    close(devFd);
+    throw;
+  }
+}
@@ -0,0 +1,59 @@
+#ifndef BLOCKDEVICE_HPP
+#define BLOCKDEVICE_HPP
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "LowLevelIO.hpp"
+using namespace std;
+/*
+ * Storage a volume is accessed through.
+ * xpread/xpwrite transfer exactly count bytes or throw, like the
+ * LowLevelIO functions. map() hands out a pointer to a byte range when
+ * the backend can do so without copying, NULL otherwise.
+ * xpreadBatch() completes every request or throws; backends that can
+ * keep several requests in flight override it. xpreadv() scatters one
+ * contiguous range into several buffers.
+ * A BlockDevice owns its descriptor and closes it when destroyed.
+ * A device opened read-only refuses writes with EBADF.
+ */
+class BlockDevice
+{
+protected:
+  int fd;
+
+  static BlockDevice *open(int devFd, const string &backend,
+                           bool readOnly) throw(LLIOError);
+
+public:
+  struct IORequest {
+    void *buf;
+    size_t count;
+    off_t offset;
+  };
+
+  static const string DefaultBackend;
+
+  explicit BlockDevice(int _fd) throw();
+  virtual ~BlockDevice() throw();
+  virtual void xpread(void *buf, size_t count,
+                      off_t offset) throw(LLIOError, LLIOEOF) = 0;
+  virtual void xpwrite(void *buf, size_t count,
+                       off_t offset) throw(LLIOError) = 0;
+  virtual void xpreadBatch(vector<IORequest> &reqs) throw(LLIOError, LLIOEOF);
+  virtual void xpreadv(const struct iovec *iov, int iovcnt,
+                       off_t offset) throw(LLIOError, LLIOEOF);
+  virtual const void *map(off_t offset, size_t len) throw();
+  virtual void unmap(const void *addr, size_t len) throw();
+  virtual void sync() throw(LLIOError);
+  int getFd() throw();
+  off_t getSize() throw(LLIOError);
+
+  static bool isBackend(const string &backend) throw();
+  static BlockDevice *open(const string &devName, const string &backend,
+                           bool readOnly = false,
+                           bool direct = false) throw(LLIOError);
+  static bool supportsDirect(const string &backend) throw();
+  static bool supportsView(const string &backend) throw();
+};
+#endif //BLOCKDEVICE_HPP
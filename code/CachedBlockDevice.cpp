@@ -0,0 +1,324 @@
+#include <sys/types.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include "LowLevelIO.hpp"
+#include "BlockDevice.hpp"
+#include "CachedBlockDevice.hpp"
+using namespace std;
+
+const size_t CachedBlockDevice::BypassBytes = 256 * 1024;
+
+CachedBlockDevice::CachedBlockDevice(BlockDevice *dev, uint32_t blockCnt,
+                                     uint32_t _blockSize, uintmax_t _origin,
+                                     bool _writeBack) throw(LLIOError)
+  : BlockDevice(dev->getFd()),
+    inner(dev),
+    blockSize(_blockSize),
+    origin(_origin),
+    devSize(0),
+    writeBack(_writeBack),
+    bypassBytes(BypassBytes > _blockSize ? BypassBytes : _blockSize),
+    slots(blockCnt > 0 ? blockCnt : 1),
+    clockHand(0),
+    hits(0),
+    misses(0)
+{
+  //The descriptor belongs to the wrapped device
+  try {
+    devSize = inner->getSize();
+    data.reset(new unsigned char[(size_t) slots.size() * blockSize]);
+  } catch (bad_alloc &e) {
+    fd = -1;
+    throw LLIOError(ENOMEM);
+  } catch (...) {
+    fd = -1;
+    throw;
+  }
+
+  for (vector<Slot>::iterator it = slots.begin(); it != slots.end(); ++it) {
+    it->blockNo = 0;
+    it->used = false;
+    it->dirty = false;
+    it->referenced = false;
+  }
+}
+CachedBlockDevice::~CachedBlockDevice() throw()
+{
+  try {
+    for (uint32_t i = 0; i < slots.size(); ++i) {
+      flushSlot(i);
+    }
+  } catch (...) {
+  }
+
+  fd = -1;
+}
+unsigned char *CachedBlockDevice::slotData(uint32_t slot) throw()
+{
+  return data.get() + (size_t) slot * blockSize;
+}
+/*
+ * Bytes of block blockNo that lie on the device; the last block of the
+ * data area may be short.
+ */
+size_t CachedBlockDevice::blockBytes(uint64_t blockNo) throw()
+{
+  uintmax_t start = origin + blockNo * blockSize;
+
+  if (start >= devSize) {
+    return 0;
+  }
+
+  return devSize - start < blockSize ? devSize - start : blockSize;
+}
+bool CachedBlockDevice::isCached(uintmax_t offset, size_t count) throw()
+{
+  return offset >= origin && count <= bypassBytes;
+}
+void CachedBlockDevice::flushSlot(uint32_t slot) throw(LLIOError)
+{
+  Slot &s = slots[slot];
+
+  if (s.used && s.dirty) {
+    inner->xpwrite(slotData(slot), blockBytes(s.blockNo),
+                   origin + s.blockNo * blockSize);
+    s.dirty = false;
+  }
+}
+/*
+ * Write back dirty blocks overlapping a range the caller is about to
+ * access on the device directly.
+ */
+void CachedBlockDevice::flushRange(uintmax_t offset,
+                                   size_t count) throw(LLIOError)
+{
+  if (!writeBack) {
+    return;
+  }
+
+  for (uint32_t i = 0; i < slots.size(); ++i) {
+    uintmax_t start = origin + slots[i].blockNo * blockSize;
+
+    if (slots[i].used && slots[i].dirty && start < offset + count &&
+        offset < start + blockSize) {
+      flushSlot(i);
+    }
+  }
+}
+void CachedBlockDevice::dropRange(uintmax_t offset, size_t count) throw()
+{
+  for (uint32_t i = 0; i < slots.size(); ++i) {
+    uintmax_t start = origin + slots[i].blockNo * blockSize;
+
+    if (slots[i].used && start < offset + count &&
+        offset < start + blockSize) {
+      index.erase(slots[i].blockNo);
+      slots[i].used = false;
+      slots[i].dirty = false;
+    }
+  }
+}
+/*
+ * Second-chance eviction, as in FatTable.
+ */
+uint32_t CachedBlockDevice::evictSlot() throw(LLIOError)
+{
+  while (true) {
+    if (clockHand >= slots.size()) {
+      clockHand = 0;
+    }
+
+    Slot &s = slots[clockHand];
+
+    if (!s.used) {
+      return clockHand++;
+    }
+
+    if (s.referenced) {
+      s.referenced = false;
+      ++clockHand;
+    } else {
+      flushSlot(clockHand);
+      index.erase(s.blockNo);
+      s.used = false;
+      return clockHand++;
+    }
+  }
+}
+/*
+ * Find block blockNo, making it resident if needed. load is false when
+ * the caller is about to overwrite the whole block.
+ */
+uint32_t CachedBlockDevice::getSlot(uint64_t blockNo,
+                                    bool load) throw(LLIOError, LLIOEOF)
+{
+  unordered_map<uint64_t, uint32_t>::iterator it = index.find(blockNo);
+
+  if (it != index.end()) {
+    ++hits;
+    slots[it->second].referenced = true;
+    return it->second;
+  }
+
+  ++misses;
+  uint32_t slot = evictSlot();
+
+  if (load) {
+    inner->xpread(slotData(slot), blockBytes(blockNo),
+                  origin + blockNo * blockSize);
+  }
+
+  Slot &s = slots[slot];
+  s.blockNo = blockNo;
+  s.used = true;
+  s.dirty = false;
+  s.referenced = true;
+  index[blockNo] = slot;
+  return slot;
+}
+void CachedBlockDevice::xpread(void *buf, size_t count,
+                               off_t offset) throw(LLIOError, LLIOEOF)
+{
+  lock_guard<mutex> guard(lock);
+
+  if (offset < 0 || !isCached(offset, count)) {
+    flushRange(offset, count);
+    inner->xpread(buf, count, offset);
+    return;
+  }
+
+  while (count != 0) {
+    uint64_t blockNo = (offset - origin) / blockSize;
+    size_t inBlock = (offset - origin) % blockSize;
+    size_t n = blockSize - inBlock < count ? blockSize - inBlock : count;
+
+    if (inBlock + n > blockBytes(blockNo)) {
+      throw LLIOEOF();
+    }
+
+    uint32_t slot = getSlot(blockNo, true);
+    memcpy(buf, slotData(slot) + inBlock, n);
+    buf = (unsigned char *) buf + n;
+    count -= n;
+    offset += n;
+  }
+}
+void CachedBlockDevice::xpwrite(void *buf, size_t count,
+                                off_t offset) throw(LLIOError)
+{
+  lock_guard<mutex> guard(lock);
+
+  if (offset < 0 || !isCached(offset, count)) {
+    flushRange(offset, count);
+    inner->xpwrite(buf, count, offset);
+    dropRange(offset, count);
+    return;
+  }
+
+  while (count != 0) {
+    uint64_t blockNo = (offset - origin) / blockSize;
+    size_t inBlock = (offset - origin) % blockSize;
+    size_t n = blockSize - inBlock < count ? blockSize - inBlock : count;
+
+    if (inBlock + n > blockBytes(blockNo)) {
+      throw LLIOError(ENOSPC);
+    }
+
+    uint32_t slot;
+
+    try {
+      slot = getSlot(blockNo, 0 != inBlock || n != blockBytes(blockNo));
+    } catch (LLIOEOF &e) {
+      throw LLIOError(EIO);
+    }
+
+    memcpy(slotData(slot) + inBlock, buf, n);
+
+    if (writeBack) {
+      slots[slot].dirty = true;
+    } else {
+      try {
+        inner->xpwrite(buf, n, offset);
+      } catch (LLIOError &e) {
+        //The device did not take it; do not serve the new bytes
+        index.erase(blockNo);
+        slots[slot].used = false;
+        throw;
+      }
+    }
+
+    buf = (unsigned char *) buf + n;
+    count -= n;
+    offset += n;
+  }
+}
+/*
+ * Small requests are served from the cache one by one; the rest are
+ * handed to the wrapped device as one batch.
+ */
+void CachedBlockDevice::xpreadBatch(vector<IORequest> &reqs) throw(LLIOError,
+    LLIOEOF)
+{
+  vector<IORequest> direct;
+
+  for (vector<IORequest>::iterator it = reqs.begin(); it != reqs.end(); ++it) {
+    if (it->offset >= 0 && isCached(it->offset, it->count)) {
+      xpread(it->buf, it->count, it->offset);
+    } else {
+      direct.push_back(*it);
+    }
+  }
+
+  if (!direct.empty()) {
+    {
+      lock_guard<mutex> guard(lock);
+
+      for (vector<IORequest>::iterator it = direct.begin(); it != direct.end();
+           ++it) {
+        flushRange(it->offset, it->count);
+      }
+    }
+    inner->xpreadBatch(direct);
+  }
+}
+const void *CachedBlockDevice::map(off_t offset, size_t len) throw()
+{
+  lock_guard<mutex> guard(lock);
+
+  try {
+    flushRange(offset, len);
+  } catch (LLIOError &e) {
+    return NULL;
+  }
+
+  return inner->map(offset, len);
+}
+void CachedBlockDevice::unmap(const void *addr, size_t len) throw()
+{
+  inner->unmap(addr, len);
+}
+void CachedBlockDevice::sync() throw(LLIOError)
+{
+  lock_guard<mutex> guard(lock);
+
+  for (uint32_t i = 0; i < slots.size(); ++i) {
+    flushSlot(i);
+  }
+
+  inner->sync();
+}
+uint64_t CachedBlockDevice::getHits() throw()
+{
+  lock_guard<mutex> guard(lock);
+  return hits;
+}
+uint64_t CachedBlockDevice::getMisses() throw()
+{
+  lock_guard<mutex> guard(lock);
+  return misses;
+}
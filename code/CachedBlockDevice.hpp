@@ -0,0 +1,69 @@
+#ifndef CACHEDBLOCKDEVICE_HPP
+#define CACHEDBLOCKDEVICE_HPP
+#include <stdint.h>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include "BlockDevice.hpp"
+using namespace std;
+/*
+ * A fixed number of cluster-sized blocks of another device, kept in
+ * memory. Only the data area (from origin on) is cached, in blocks
+ * aligned to origin; the boot sector and FATs pass straight through.
+ * The least recently referenced block is dropped, CLOCK style.
+ * Requests larger than bypassBytes go to the device directly, after any
+ * dirty blocks they overlap have been written.
+ * With writeBack, writes stay in the cache until the block is evicted or
+ * sync() is called; otherwise they are written through at once.
+ * The wrapped device and its descriptor are owned by the cache.
+ */
+class CachedBlockDevice : public BlockDevice
+{
+private:
+  struct Slot {
+    uint64_t blockNo;
+    bool used;
+    bool dirty;
+    bool referenced;
+  };
+
+  unique_ptr<BlockDevice> inner;
+  uint32_t blockSize;
+  uintmax_t origin;
+  uintmax_t devSize;
+  bool writeBack;
+  size_t bypassBytes;
+  vector<Slot> slots;
+  unique_ptr<unsigned char[]> data;
+  unordered_map<uint64_t, uint32_t> index;
+  uint32_t clockHand;
+  uint64_t hits;
+  uint64_t misses;
+  mutex lock;
+
+  unsigned char *slotData(uint32_t slot) throw();
+  uint32_t getSlot(uint64_t blockNo, bool load) throw(LLIOError, LLIOEOF);
+  uint32_t evictSlot() throw(LLIOError);
+  void flushSlot(uint32_t slot) throw(LLIOError);
+  void flushRange(uintmax_t offset, size_t count) throw(LLIOError);
+  void dropRange(uintmax_t offset, size_t count) throw();
+  size_t blockBytes(uint64_t blockNo) throw();
+  bool isCached(uintmax_t offset, size_t count) throw();
+
+public:
+  static const size_t BypassBytes;
+
+  CachedBlockDevice(BlockDevice *dev, uint32_t blockCnt, uint32_t _blockSize,
+                    uintmax_t _origin, bool _writeBack) throw(LLIOError);
+  ~CachedBlockDevice() throw();
+  void xpread(void *buf, size_t count, off_t offset) throw(LLIOError, LLIOEOF);
+  void xpwrite(void *buf, size_t count, off_t offset) throw(LLIOError);
+  void xpreadBatch(vector<IORequest> &reqs) throw(LLIOError, LLIOEOF);
+  const void *map(off_t offset, size_t len) throw();
+  void unmap(const void *addr, size_t len) throw();
+  void sync() throw(LLIOError);
+  uint64_t getHits() throw();
+  uint64_t getMisses() throw();
+};
+#endif //CACHEDBLOCKDEVICE_HPP
@@ -0,0 +1,150 @@
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <endian.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include "LowLevelIO.hpp"
+#include "Fat32DataAccess.hpp"
+#include "ClusterIndex.hpp"
+using namespace std;
+
+const char ClusterIndex::Magic[8] = { 'F', '3', '2', 'C', 'I', 'D', 'X', '1' };
+
+ClusterIndex::ClusterIndex(const string &fileName) throw(FileIOError)
+  : name(fileName), base(NULL), size(0), records(NULL), recordLen(0)
+{
+  int fd = open(fileName.c_str(), O_RDONLY);
+  struct stat st;
+
+  if (-1 == fd) {
+    throw FileIOError(errno, fileName);
+  }
+
+  if (-1 == fstat(fd, &st)) {
+    int err = errno;
+    ::close(fd);
+    throw FileIOError(err, fileName);
+  }
+
+  size = st.st_size;
+
+  if (size < sizeof(Header)) {
+    ::close(fd);
+    throw FileIOError(EINVAL, fileName + ": not a cluster index");
+  }
+
+  void *mapping = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  int err = errno;
+  ::close(fd);
+
+  if (MAP_FAILED == mapping) {
+    throw FileIOError(err, fileName);
+  }
+
+  base = (const uint8_t *) mapping;
+  memcpy(&header, base, sizeof(header));
+  header.volID = le32toh(header.volID);
+  header.bytsPerClus = le32toh(header.bytsPerClus);
+  header.digestLen = le32toh(header.digestLen);
+  header.count = le64toh(header.count);
+  recordLen = header.digestLen + sizeof(uint32_t);
+
+  if (0 != memcmp(header.magic, Magic, sizeof(Magic)) ||
+      0 == header.digestLen || header.digestLen > 64 ||
+      (size - sizeof(Header)) / recordLen != header.count ||
+      (size - sizeof(Header)) % recordLen != 0) {
+    munmap(mapping, size);
+    base = NULL;
+    throw FileIOError(EINVAL, fileName + ": not a cluster index");
+  }
+
+  records = base + sizeof(Header);
+  madvise(mapping, size, MADV_RANDOM);
+}
+ClusterIndex::~ClusterIndex() throw()
+{
+  if (NULL != base) {
+    munmap((void *) base, size);
+  }
+}
+/*
+ * Every cluster whose digest is digest, lowest first.
+ */
+void ClusterIndex::lookup(const uint8_t *digest,
+                          vector<uint32_t> &clusters) const throw()
+{
+  clusters.clear();
+  //Binary search for the first record not below digest
+  uint64_t lo = 0, hi = header.count;
+
+  while (lo < hi) {
+    uint64_t mid = lo + (hi - lo) / 2;
+
+    if (memcmp(records + mid * recordLen, digest, header.digestLen) < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  for (; lo < header.count; ++lo) {
+    const uint8_t *r = records + lo * recordLen;
+
+    if (0 != memcmp(r, digest, header.digestLen)) {
+      break;
+    }
+
+    uint32_t clusNo;
+    memcpy(&clusNo, r + header.digestLen, sizeof(clusNo));
+    clusters.push_back(le32toh(clusNo));
+  }
+}
+const ClusterIndex::Header &ClusterIndex::getHeader() const throw()
+{
+  return header;
+}
+string ClusterIndex::getAlgorithm() const
+{
+  return string(header.algorithm, strnlen(header.algorithm,
+                sizeof(header.algorithm)));
+}
+/*
+ * Whether a block is one byte value over and over. Such blocks, zeroed
+ * clusters mostly, match too much to tell anything, so they are neither
+ * indexed nor looked up.
+ */
+bool ClusterIndex::isUniform(const uint8_t *data, size_t len) throw()
+{
+  return 0 == len || 0 == memcmp(data, data + 1, len - 1);
+}
+/*
+ * Write header and the sorted records, already in file layout, in place
+ * of fileName.
+ */
+void ClusterIndex::write(const string &fileName, Header &header,
+                         const vector<uint8_t> &records) throw(FileIOError)
+{
+  Header h = header;
+  memcpy(h.magic, Magic, sizeof(Magic));
+  h.volID = htole32(header.volID);
+  h.bytsPerClus = htole32(header.bytsPerClus);
+  h.digestLen = htole32(header.digestLen);
+  h.reserved = 0;
+  h.count = htole64(header.count);
+
+  struct iovec iov[2] = {
+    { &h, sizeof(h) },
+    { (void *) records.data(), records.size() }
+  };
+
+  try {
+    LowLevelIO::replaceFile(fileName, iov, 2);
+  } catch (LLIOError &e) {
+    throw FileIOError(e.code(), fileName);
+  }
+}
@@ -0,0 +1,50 @@
+#ifndef CLUSTERINDEX_HPP
+#define CLUSTERINDEX_HPP
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include "Fat32DataAccess.hpp"
+using namespace std;
+/*
+ * On-disk index from the digest of a cluster's content to the cluster:
+ * a Header, then Header::count records of digestLen digest bytes and a
+ * little-endian cluster number, sorted by digest and then cluster. It is
+ * read through a read-only mapping and searched in place, so opening it
+ * costs the same whatever its size.
+ */
+class ClusterIndex
+{
+public:
+  struct Header {
+    char magic[8];
+    uint32_t volID;       //BS_VolID of the volume indexed
+    uint32_t bytsPerClus;
+    uint32_t digestLen;
+    uint32_t reserved;
+    uint64_t count;
+    char algorithm[16];   //As given to Digest::create()
+  } __attribute__((__packed__));
+
+  static const char Magic[8];
+
+  explicit ClusterIndex(const string &fileName) throw(FileIOError);
+  ~ClusterIndex() throw();
+  void lookup(const uint8_t *digest, vector<uint32_t> &clusters) const
+  throw();
+  const Header &getHeader() const throw();
+  string getAlgorithm() const;
+
+  static void write(const string &fileName, Header &header,
+                    const vector<uint8_t> &records) throw(FileIOError);
+  static bool isUniform(const uint8_t *data, size_t len) throw();
+
+private:
+  string name;
+  const uint8_t *base;
+  size_t size;
+  Header header;
+  const uint8_t *records;
+  size_t recordLen;
+};
+#endif //CLUSTERINDEX_HPP
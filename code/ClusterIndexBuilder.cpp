@@ -0,0 +1,161 @@
+#include <stdint.h>
+#include <string.h>
+#include <endian.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <iostream>
+#include "Fat32Action.hpp"
+#include "Fat32DataAccess.hpp"
+#include "Digest.hpp"
+#include "MultiMD5.hpp"
+#include "ThreadPool.hpp"
+#include "ClusterIndex.hpp"
+#include "ClusterIndexBuilder.hpp"
+using namespace std;
+
+const size_t ClusterIndexBuilder::WindowBytes = 4 << 20;
+const size_t ClusterIndexBuilder::ChunkBytes = 64 << 20;
+
+ClusterIndexBuilder::ClusterIndexBuilder(const string &devName,
+    const DeviceOptions &opts, const string &index,
+    const string &alg) throw(FileIOError)
+  : Fat32Action(devName, opts), indexName(index), algorithm(alg)
+{
+  unique_ptr<Digest> d(Digest::create(alg));
+  digestLen = d->getSize();
+}
+ClusterIndexBuilder::~ClusterIndexBuilder() throw() {}
+void ClusterIndexBuilder::hashChunk(Chunk &chunk) throw(FileIOError)
+{
+  uint32_t bytsPerClus = fat32DA.getBytsPerClus();
+  uint32_t windowClus = WindowBytes / bytsPerClus > 0 ?
+                        WindowBytes / bytsPerClus : 1;
+  unique_ptr<uint8_t[]> buf(new uint8_t[(size_t) windowClus * bytsPerClus]);
+  size_t recordLen = digestLen + sizeof(uint32_t);
+  MultiMD5 multi;
+  vector<MultiMD5::Job> jobs;
+  vector<uint32_t> clusNos;
+
+  for (uint32_t done = 0; done < chunk.len;) {
+    uint32_t cnt = chunk.len - done < windowClus ? chunk.len - done :
+                   windowClus;
+    fat32DA.readClusters(chunk.fstClus + done, cnt, buf.get());
+    jobs.clear();
+    clusNos.clear();
+
+    for (uint32_t i = 0; i < cnt; ++i) {
+      const uint8_t *data = buf.get() + (size_t) i * bytsPerClus;
+
+      if (!ClusterIndex::isUniform(data, bytsPerClus)) {
+        MultiMD5::Job job;
+        job.data = data;
+        job.len = bytsPerClus;
+        jobs.push_back(job);
+        clusNos.push_back(htole32(chunk.fstClus + done + i));
+      }
+    }
+
+    size_t at = chunk.records.size();
+    chunk.records.resize(at + jobs.size() * recordLen);
+    uint8_t *r = chunk.records.data() + at;
+
+    if (algorithm == "md5") {
+      multi.hash(jobs);
+    }
+
+    for (size_t i = 0; i < jobs.size(); ++i, r += recordLen) {
+      if (algorithm == "md5") {
+        memcpy(r, jobs[i].digest, digestLen);
+      } else {
+        unique_ptr<Digest> d(Digest::create(algorithm));
+        d->update(jobs[i].data, jobs[i].len);
+        d->final(r);
+      }
+
+      memcpy(r + digestLen, &clusNos[i], sizeof(uint32_t));
+    }
+
+    done += cnt;
+  }
+}
+void ClusterIndexBuilder::run() throw(FileIOError, Fat32ActionError)
+{
+  vector<Fat32DataAccess::ClusterRun> runs;
+  fat32DA.getFreeRuns(runs);
+  uint32_t bytsPerClus = fat32DA.getBytsPerClus();
+  uint32_t chunkClus = ChunkBytes / bytsPerClus > 0 ?
+                       ChunkBytes / bytsPerClus : 1;
+  vector<Chunk> chunks;
+
+  for (uint32_t r = 0; r < runs.size(); ++r) {
+    for (uint32_t done = 0; done < runs[r].len; done += chunkClus) {
+      Chunk chunk;
+      chunk.fstClus = runs[r].fstClus + done;
+      chunk.len = runs[r].len - done < chunkClus ? runs[r].len - done :
+                  chunkClus;
+      chunks.push_back(chunk);
+    }
+  }
+
+  {
+    ThreadPool pool(threadCnt);
+
+    for (size_t i = 0; i < chunks.size(); ++i) {
+      Chunk *chunk = &chunks[i];
+      pool.submit([this, chunk]() {
+        hashChunk(*chunk);
+      });
+    }
+
+    pool.wait();
+  }
+  //Sort record positions rather than moving records of a runtime size
+  size_t recordLen = digestLen + sizeof(uint32_t);
+  vector<uint8_t> all;
+
+  for (vector<Chunk>::iterator it = chunks.begin(); it != chunks.end(); ++it) {
+    all.insert(all.end(), it->records.begin(), it->records.end());
+    vector<uint8_t>().swap(it->records);
+  }
+
+  size_t count = all.size() / recordLen;
+  vector<size_t> order(count);
+
+  for (size_t i = 0; i < count; ++i) {
+    order[i] = i * recordLen;
+  }
+
+  const uint8_t *base = all.empty() ? NULL : &all[0];
+  size_t len = digestLen;
+  sort(order.begin(), order.end(), [base, len](size_t a, size_t b) {
+    int c = memcmp(base + a, base + b, len);
+    //Chunks come in cluster order, so ties stay in cluster order
+    return c < 0 || (0 == c && a < b);
+  });
+  vector<uint8_t> sorted(all.size());
+
+  for (size_t i = 0; i < count; ++i) {
+    memcpy(&sorted[i * recordLen], base + order[i], recordLen);
+  }
+
+  ClusterIndex::Header header;
+  memset(&header, 0, sizeof(header));
+  header.volID = fat32DA.getVolID();
+  header.bytsPerClus = bytsPerClus;
+  header.digestLen = digestLen;
+  header.count = count;
+  strncpy(header.algorithm, algorithm.c_str(), sizeof(header.algorithm));
+  ClusterIndex::write(indexName, header, sorted);
+  uint32_t freeCnt = 0;
+
+  for (vector<Fat32DataAccess::ClusterRun>::iterator it = runs.begin();
+       it != runs.end(); ++it) {
+    freeCnt += it->len;
+  }
+
+  unique_ptr<Digest> d(Digest::create(algorithm));
+  cout << count << " of " << freeCnt << " free clusters indexed with "
+       << d->getName() << endl;
+}
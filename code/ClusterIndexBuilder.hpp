@@ -0,0 +1,43 @@
+#ifndef CLUSTERINDEXBUILDER_HPP
+#define CLUSTERINDEXBUILDER_HPP
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "Fat32Action.hpp"
+using namespace std;
+/*
+ * -X: hash every free cluster once and write a ClusterIndex of them, for
+ * ClusterIndexQuery to match known files' blocks against later without
+ * reading the device again.
+ * The free runs are cut into chunks hashed on a thread pool, each read
+ * a window at a time; with MD5 the clusters of a window are hashed in
+ * MultiMD5 lanes. Clusters holding one byte value throughout, zeroed
+ * ones above all, are left out: they would match the same blocks of
+ * every file and say nothing about where it lies.
+ */
+class ClusterIndexBuilder : public Fat32Action
+{
+private:
+  struct Chunk {
+    uint32_t fstClus;
+    uint32_t len;
+    vector<uint8_t> records;  //In index layout, unsorted
+  };
+
+  static const size_t WindowBytes;
+  static const size_t ChunkBytes;
+
+  string indexName;
+  string algorithm;
+  size_t digestLen;
+
+  void hashChunk(Chunk &chunk) throw(FileIOError);
+
+public:
+  ClusterIndexBuilder(const string &devName, const DeviceOptions &opts,
+                      const string &index, const string &alg = "md5")
+  throw(FileIOError);
+  ~ClusterIndexBuilder() throw();
+  void run() throw(FileIOError, Fat32ActionError);
+};
+#endif //CLUSTERINDEXBUILDER_HPP
@@ -0,0 +1,141 @@
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include "Fat32Action.hpp"
+#include "Fat32DataAccess.hpp"
+#include "Digest.hpp"
+#include "ClusterIndex.hpp"
+#include "ClusterIndexQuery.hpp"
+using namespace std;
+ClusterIndexQuery::ClusterIndexQuery(const string &devName,
+                                     const DeviceOptions &opts,
+                                     const string &index,
+                                     const string &list) throw(FileIOError)
+  : Fat32Action(devName, opts), indexName(index), listName(list) {}
+ClusterIndexQuery::~ClusterIndexQuery() throw() {}
+/*
+ * Clusters as runs, 48-49,53-55.
+ */
+static string runsOf(const vector<uint32_t> &clusters)
+{
+  ostringstream out;
+
+  for (size_t i = 0; i < clusters.size();) {
+    size_t j = i + 1;
+
+    while (j < clusters.size() && clusters[j] == clusters[j - 1] + 1) {
+      j++;
+    }
+
+    out << (0 == i ? "" : ",") << clusters[i];
+
+    if (j - i > 1) {
+      out << "-" << clusters[j - 1];
+    }
+
+    i = j;
+  }
+
+  return out.str();
+}
+void ClusterIndexQuery::run() throw(FileIOError, Fat32ActionError)
+{
+  ClusterIndex index(indexName);
+  const ClusterIndex::Header &header = index.getHeader();
+
+  if (header.volID != fat32DA.getVolID() ||
+      header.bytsPerClus != fat32DA.getBytsPerClus()) {
+    throw Fat32ActionError(indexName + ": error - index of another volume");
+  }
+
+  string algorithm = index.getAlgorithm();
+
+  if (!Digest::isAlgorithm(algorithm)) {
+    throw Fat32ActionError(indexName + ": error - unknown digest " +
+                           algorithm);
+  }
+
+  ifstream list(listName.c_str());
+
+  if (!list) {
+    throw FileIOError(errno, listName);
+  }
+
+  uint32_t bytsPerClus = header.bytsPerClus;
+  unique_ptr<uint8_t[]> block(new uint8_t[bytsPerClus]);
+  vector<uint8_t> digest(header.digestLen);
+  vector<uint32_t> candidates;
+  string path;
+
+  while (getline(list, path)) {
+    if (path.empty() || '#' == path[0]) {
+      continue;
+    }
+
+    ifstream in(path.c_str(), ios::binary);
+
+    if (!in) {
+      cout << path << ": error - cannot open" << endl;
+      continue;
+    }
+
+    vector<uint32_t> found;
+    uint32_t blocks = 0;
+    uint32_t matched = 0;
+    uint32_t prev = 0;
+
+    while (in.read((char *) block.get(), bytsPerClus)) {
+      if (ClusterIndex::isUniform(block.get(), bytsPerClus)) {
+        prev = 0;
+        continue;
+      }
+
+      blocks++;
+      unique_ptr<Digest> d(Digest::create(algorithm));
+      d->update(block.get(), bytsPerClus);
+      d->final(&digest[0]);
+      index.lookup(&digest[0], candidates);
+
+      if (candidates.empty()) {
+        prev = 0;
+        continue;
+      }
+
+      //Prefer the cluster that carries on from the previous block
+      uint32_t clusNo = candidates[0];
+
+      if (0 != prev &&
+          binary_search(candidates.begin(), candidates.end(), prev + 1)) {
+        clusNo = prev + 1;
+      }
+
+      matched++;
+      found.push_back(clusNo);
+      prev = clusNo;
+    }
+
+    if (in.bad()) {
+      cout << path << ": error - cannot read" << endl;
+      continue;
+    }
+
+    cout << path << ": " << matched << " of " << blocks << " blocks found";
+
+    if (!found.empty()) {
+      cout << " in " << runsOf(found);
+    }
+
+    cout << endl;
+  }
+
+  if (list.bad()) {
+    throw FileIOError(EIO, listName);
+  }
+}
@@ -0,0 +1,30 @@
+#ifndef CLUSTERINDEXQUERY_HPP
+#define CLUSTERINDEXQUERY_HPP
+#include <string>
+#include "Fat32Action.hpp"
+using namespace std;
+/*
+ * -X with -Q: block-hash matching of known files against the free
+ * clusters in a ClusterIndex. The files, on the host, are listed one
+ * path per line. Each is cut into cluster-sized blocks, hashed the way
+ * the index was built and looked up, so the volume itself is only read
+ * for its boot sector and FAT. The last block is skipped unless whole,
+ * since the rest of its cluster holds whatever was there before, and so
+ * are blocks of a single byte value, which the index leaves out.
+ * Prints, per file, how many blocks were found and the clusters they
+ * lie in; where a block is in several clusters, the one following the
+ * previous block's is taken.
+ */
+class ClusterIndexQuery : public Fat32Action
+{
+private:
+  string indexName;
+  string listName;
+public:
+  ClusterIndexQuery(const string &devName, const DeviceOptions &opts,
+                    const string &index, const string &list)
+  throw(FileIOError);
+  ~ClusterIndexQuery() throw();
+  void run() throw(FileIOError, Fat32ActionError);
+};
+#endif //CLUSTERINDEXQUERY_HPP
@@ -0,0 +1,90 @@
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <stdexcept>
+#include "Digest.hpp"
+#include "EVPDigest.hpp"
+#include "Blake3Digest.hpp"
+#include "XXH3Digest.hpp"
+using namespace std;
+
+Digest::~Digest() throw() {}
+string Digest::finalHex() throw()
+{
+  uint8_t out[64];
+  final(out);
+  return toHex(out, getSize());
+}
+bool Digest::isAlgorithm(const string &alg) throw()
+{
+  return alg == "md5" || alg == "sha1" || alg == "sha256" ||
+         alg == "blake3" || alg == "xxh3";
+}
+/*
+ * A new digest of the named algorithm:
+ *   md5, sha1, sha256  OpenSSL
+ *   blake3             BLAKE3, 256-bit output
+ *   xxh3               XXH3, 64-bit, seed 0; not cryptographic
+ */
+Digest *Digest::create(const string &alg)
+{
+  if (alg == "blake3") {
+    return new Blake3Digest();
+  } else if (alg == "xxh3") {
+    return new XXH3Digest();
+  } else if (isAlgorithm(alg)) {
+    return new EVPDigest(alg);
+  }
+
+  throw logic_error("Unknown digest " + alg);
+}
+string Digest::toHex(const uint8_t *bytes, size_t len) throw()
+{
+  static const char digits[] = "0123456789abcdef";
+  string hex(2 * len, '0');
+
+  for (size_t i = 0; i < len; ++i) {
+    hex[2 * i] = digits[bytes[i] >> 4];
+    hex[2 * i + 1] = digits[bytes[i] & 0xf];
+  }
+
+  return hex;
+}
+static int hexValue(char c)
+{
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  } else if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  } else if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+
+  return -1;
+}
+/*
+ * Decode hex, of either case. Returns false if it is not whole bytes of
+ * hex digits.
+ */
+bool Digest::fromHex(const string &hex, vector<uint8_t> &bytes) throw()
+{
+  if (0 != hex.length() % 2) {
+    return false;
+  }
+
+  bytes.resize(hex.length() / 2);
+
+  for (size_t i = 0; i < bytes.size(); ++i) {
+    int hi = hexValue(hex[2 * i]);
+    int lo = hexValue(hex[2 * i + 1]);
+
+    if (hi < 0 || lo < 0) {
+      return false;
+    }
+
+    bytes[i] = (hi << 4) | lo;
+  }
+
+  return true;
+}
@@ -0,0 +1,32 @@
+#ifndef DIGEST_HPP
+#define DIGEST_HPP
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+using namespace std;
+/*
+ * Incremental message digest:
+ *   unique_ptr<Digest> d(Digest::create("sha256"));
+ *   d->update(buf, len); ...
+ *   d->final(out);
+ * final() may be called once. clone() copies the state so far, so a
+ * common prefix need only be hashed once.
+ */
+class Digest
+{
+public:
+  virtual ~Digest() throw();
+  virtual void update(const void *data, size_t len) throw() = 0;
+  virtual void final(uint8_t *out) throw() = 0;
+  virtual Digest *clone() const = 0;
+  virtual size_t getSize() const throw() = 0;
+  virtual const char *getName() const throw() = 0;
+
+  string finalHex() throw();
+  static bool isAlgorithm(const string &alg) throw();
+  static Digest *create(const string &alg);
+  static string toHex(const uint8_t *bytes, size_t len) throw();
+  static bool fromHex(const string &hex, vector<uint8_t> &bytes) throw();
+};
+#endif //DIGEST_HPP
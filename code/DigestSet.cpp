@@ -0,0 +1,133 @@
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include "Fat32DataAccess.hpp"
+#include "Digest.hpp"
+#include "DigestSet.hpp"
+using namespace std;
+
+DigestSet::DigestSet(size_t len)
+  : digestLen(len), slotCnt(1024), count(0), slots(slotCnt * len),
+    used(slotCnt / 64) {}
+size_t DigestSet::home(const uint8_t *digest) const throw()
+{
+  uint64_t h = 0;
+  memcpy(&h, digest, digestLen < sizeof(h) ? digestLen : sizeof(h));
+  return h & (slotCnt - 1);
+}
+bool DigestSet::isUsed(size_t slot) const throw()
+{
+  return used[slot / 64] >> (slot % 64) & 1;
+}
+void DigestSet::grow()
+{
+  vector<uint8_t> oldSlots;
+  vector<uint64_t> oldUsed;
+  oldSlots.swap(slots);
+  oldUsed.swap(used);
+  size_t oldCnt = slotCnt;
+  slotCnt *= 2;
+  slots.assign(slotCnt * digestLen, 0);
+  used.assign(slotCnt / 64, 0);
+  count = 0;
+
+  for (size_t i = 0; i < oldCnt; ++i) {
+    if (oldUsed[i / 64] >> (i % 64) & 1) {
+      insert(&oldSlots[i * digestLen]);
+    }
+  }
+}
+/*
+ * Returns false if the digest was in the set already.
+ */
+bool DigestSet::insert(const uint8_t *digest)
+{
+  if (4 * (count + 1) > 3 * slotCnt) {
+    grow();
+  }
+
+  size_t slot = home(digest);
+
+  for (; isUsed(slot); slot = (slot + 1) & (slotCnt - 1)) {
+    if (0 == memcmp(&slots[slot * digestLen], digest, digestLen)) {
+      return false;
+    }
+  }
+
+  memcpy(&slots[slot * digestLen], digest, digestLen);
+  used[slot / 64] |= (uint64_t) 1 << (slot % 64);
+  count++;
+  return true;
+}
+bool DigestSet::contains(const uint8_t *digest) const throw()
+{
+  for (size_t slot = home(digest); isUsed(slot);
+       slot = (slot + 1) & (slotCnt - 1)) {
+    if (0 == memcmp(&slots[slot * digestLen], digest, digestLen)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+bool DigestSet::contains(const string &hex) const throw()
+{
+  vector<uint8_t> digest;
+  return Digest::fromHex(hex, digest) && digest.size() == digestLen &&
+         contains(&digest[0]);
+}
+size_t DigestSet::size() const throw()
+{
+  return count;
+}
+/*
+ * Add the digests listed in a file, the first word of each line as
+ * written by md5sum and its kind, in hex. Blank lines, lines starting
+ * with # and lines whose first word is not a digest of this size are
+ * skipped. Returns the number of lines skipped that way, but blank and
+ * comment lines.
+ */
+size_t DigestSet::load(const string &fileName) throw(FileIOError)
+{
+  ifstream in(fileName.c_str());
+
+  if (!in) {
+    throw FileIOError(errno, fileName);
+  }
+
+  string line;
+  vector<uint8_t> digest;
+  size_t skipped = 0;
+
+  while (getline(in, line)) {
+    size_t from = line.find_first_not_of(" \t\r");
+
+    if (string::npos == from || '#' == line[from]) {
+      continue;
+    }
+
+    size_t to = line.find_first_of(" \t\r", from);
+    string word = line.substr(from, string::npos == to ? string::npos :
+                              to - from);
+
+    //md5sum starts the line with a backslash when the name is escaped
+    if ('\\' == word[0]) {
+      word.erase(0, 1);
+    }
+
+    if (Digest::fromHex(word, digest) && digest.size() == digestLen) {
+      insert(&digest[0]);
+    } else {
+      skipped++;
+    }
+  }
+
+  if (in.bad()) {
+    throw FileIOError(EIO, fileName);
+  }
+
+  return skipped;
+}
@@ -0,0 +1,38 @@
+#ifndef DIGESTSET_HPP
+#define DIGESTSET_HPP
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include "Fat32DataAccess.hpp"
+using namespace std;
+/*
+ * A set of fixed-size binary digests, for millions of reference hashes.
+ * Open addressing with linear probing over one flat array of digestLen
+ * bytes per slot, plus a bitmap of the slots in use: no per-entry
+ * allocation or pointer, and a lookup touches one or two cache lines.
+ * The digests are uniformly distributed already, so their first bytes
+ * serve as the hash. The table doubles before it gets 3/4 full.
+ */
+class DigestSet
+{
+private:
+  size_t digestLen;
+  size_t slotCnt;           //A power of two
+  size_t count;
+  vector<uint8_t> slots;
+  vector<uint64_t> used;    //Bit per slot
+
+  size_t home(const uint8_t *digest) const throw();
+  bool isUsed(size_t slot) const throw();
+  void grow();
+
+public:
+  explicit DigestSet(size_t len);
+  bool insert(const uint8_t *digest);
+  bool contains(const uint8_t *digest) const throw();
+  bool contains(const string &hex) const throw();
+  size_t size() const throw();
+  size_t load(const string &fileName) throw(FileIOError);
+};
+#endif //DIGESTSET_HPP
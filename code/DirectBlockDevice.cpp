@@ -0,0 +1,253 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include "LowLevelIO.hpp"
+#include "BlockDevice.hpp"
+#include "AlignedBufferPool.hpp"
+#include "DirectBlockDevice.hpp"
+using namespace std;
+
+const size_t DirectBlockDevice::DefaultAlignment = 4096;
+const size_t DirectBlockDevice::PoolIdleBytes = 16 << 20;
+
+DirectBlockDevice::DirectBlockDevice(BlockDevice *dev) throw(LLIOError)
+  : BlockDevice(dev->getFd()),
+    inner(dev),
+    align(deviceAlignment(dev->getFd())),
+    devSize(0),
+    pool(align, PoolIdleBytes)
+{
+  //The descriptor belongs to the wrapped device
+  try {
+    devSize = inner->getSize();
+  } catch (LLIOError &e) {
+    fd = -1;
+    throw;
+  }
+}
+DirectBlockDevice::~DirectBlockDevice() throw()
+{
+  fd = -1;
+}
+/*
+ * The logical block size of a block device; regular files get a value
+ * that satisfies every common file system.
+ */
+size_t DirectBlockDevice::deviceAlignment(int fd) throw()
+{
+  struct stat st;
+  int sectorSize;
+
+  if (0 == fstat(fd, &st) && S_ISBLK(st.st_mode) &&
+      0 == ioctl(fd, BLKSSZGET, &sectorSize) && sectorSize > 0) {
+    return sectorSize;
+  }
+
+  return DefaultAlignment;
+}
+void *DirectBlockDevice::bounceBuffer(size_t len,
+                                      size_t &cap) throw(LLIOError)
+{
+  try {
+    return pool.acquire(len, cap);
+  } catch (bad_alloc &e) {
+    throw LLIOError(ENOMEM);
+  }
+}
+bool DirectBlockDevice::isAligned(const void *buf, size_t count,
+                                  off_t offset) throw()
+{
+  return 0 == (uintptr_t) buf % align && 0 == count % align &&
+         0 == offset % align;
+}
+/*
+ * Transfer through the page cache, for the partial block at the end of
+ * the device that O_DIRECT cannot reach.
+ */
+void DirectBlockDevice::bufferedIO(bool write, void *buf, size_t count,
+                                   off_t offset) throw(LLIOError, LLIOEOF)
+{
+  lock_guard<mutex> guard(bufferedLock);
+  int flags = fcntl(fd, F_GETFL);
+
+  if (-1 == flags || -1 == fcntl(fd, F_SETFL, flags & ~O_DIRECT)) {
+    throw LLIOError(errno);
+  }
+
+  try {
+    if (write) {
+      LowLevelIO::xpwrite(fd, buf, count, offset);
+    } else {
+      LowLevelIO::xpread(fd, buf, count, offset);
+    }
+  } catch (...) {
+    fcntl(fd, F_SETFL, flags);
+    throw;
+  }
+
+  fcntl(fd, F_SETFL, flags);
+}
+void DirectBlockDevice::xpread(void *buf, size_t count,
+                               off_t offset) throw(LLIOError, LLIOEOF)
+{
+  if (0 == count) {
+    return;
+  }
+
+  if (isAligned(buf, count, offset)) {
+    inner->xpread(buf, count, offset);
+    return;
+  }
+
+  off_t alignedOffset = offset - offset % align;
+  uintmax_t alignedEnd = (offset + count + align - 1) / align * align;
+
+  if (alignedEnd > devSize) {
+    bufferedIO(false, buf, count, offset);
+    return;
+  }
+
+  size_t cap;
+  void *bounce = bounceBuffer(alignedEnd - alignedOffset, cap);
+
+  try {
+    inner->xpread(bounce, alignedEnd - alignedOffset, alignedOffset);
+  } catch (...) {
+    pool.release(bounce, cap);
+    throw;
+  }
+
+  memcpy(buf, (unsigned char *) bounce + (offset - alignedOffset), count);
+  pool.release(bounce, cap);
+}
+void DirectBlockDevice::xpwrite(void *buf, size_t count,
+                                off_t offset) throw(LLIOError)
+{
+  if (0 == count) {
+    return;
+  }
+
+  lock_guard<mutex> guard(writeLock);
+
+  if (isAligned(buf, count, offset)) {
+    inner->xpwrite(buf, count, offset);
+    return;
+  }
+
+  off_t alignedOffset = offset - offset % align;
+  uintmax_t alignedEnd = (offset + count + align - 1) / align * align;
+
+  try {
+    if (alignedEnd > devSize) {
+      bufferedIO(true, buf, count, offset);
+      return;
+    }
+  } catch (LLIOEOF &e) {
+    throw LLIOError(EIO);
+  }
+
+  size_t cap;
+  void *bounce = bounceBuffer(alignedEnd - alignedOffset, cap);
+
+  try {
+    inner->xpread(bounce, alignedEnd - alignedOffset, alignedOffset);
+    memcpy((unsigned char *) bounce + (offset - alignedOffset), buf, count);
+    inner->xpwrite(bounce, alignedEnd - alignedOffset, alignedOffset);
+  } catch (LLIOEOF &e) {
+    pool.release(bounce, cap);
+    throw LLIOError(EIO);
+  } catch (...) {
+    pool.release(bounce, cap);
+    throw;
+  }
+
+  pool.release(bounce, cap);
+}
+/*
+ * Widen the unaligned requests into bounce buffers and pass the whole
+ * batch on, so a queueing backend still sees every request at once.
+ */
+void DirectBlockDevice::xpreadBatch(vector<IORequest> &reqs) throw(LLIOError,
+    LLIOEOF)
+{
+  struct Bounce {
+    void *buf;
+    size_t cap;
+    size_t skip;
+    size_t req;
+  };
+  vector<IORequest> out;
+  vector<Bounce> bounces;
+  vector<size_t> tails;
+
+  try {
+    for (size_t i = 0; i < reqs.size(); ++i) {
+      IORequest &r = reqs[i];
+      off_t alignedOffset = r.offset - r.offset % align;
+      uintmax_t alignedEnd = (r.offset + r.count + align - 1) / align * align;
+
+      if (0 == r.count) {
+        continue;
+      } else if (isAligned(r.buf, r.count, r.offset)) {
+        out.push_back(r);
+      } else if (alignedEnd > devSize) {
+        tails.push_back(i);
+      } else {
+        Bounce b;
+        b.buf = bounceBuffer(alignedEnd - alignedOffset, b.cap);
+        b.skip = r.offset - alignedOffset;
+        b.req = i;
+        bounces.push_back(b);
+        IORequest widened;
+        widened.buf = b.buf;
+        widened.count = alignedEnd - alignedOffset;
+        widened.offset = alignedOffset;
+        out.push_back(widened);
+      }
+    }
+
+    inner->xpreadBatch(out);
+
+    for (vector<Bounce>::iterator it = bounces.begin(); it != bounces.end();
+         ++it) {
+      memcpy(reqs[it->req].buf, (unsigned char *) it->buf + it->skip,
+             reqs[it->req].count);
+    }
+  } catch (...) {
+    for (vector<Bounce>::iterator it = bounces.begin(); it != bounces.end();
+         ++it) {
+      pool.release(it->buf, it->cap);
+    }
+
+    throw;
+  }
+
+  for (vector<Bounce>::iterator it = bounces.begin(); it != bounces.end();
+       ++it) {
+    pool.release(it->buf, it->cap);
+  }
+
+  for (vector<size_t>::iterator it = tails.begin(); it != tails.end(); ++it) {
+    bufferedIO(false, reqs[*it].buf, reqs[*it].count, reqs[*it].offset);
+  }
+}
+const void *DirectBlockDevice::map(off_t offset, size_t len) throw()
+{
+  return NULL;
+}
+void DirectBlockDevice::unmap(const void *addr, size_t len) throw()
+{
+}
+void DirectBlockDevice::sync() throw(LLIOError)
+{
+  inner->sync();
+}
@@ -0,0 +1,51 @@
+#ifndef DIRECTBLOCKDEVICE_HPP
+#define DIRECTBLOCKDEVICE_HPP
+#include <stdint.h>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include "BlockDevice.hpp"
+#include "AlignedBufferPool.hpp"
+using namespace std;
+/*
+ * Adapts a device opened O_DIRECT to callers that use arbitrary
+ * buffers, offsets and lengths.
+ * Requests that are already aligned go straight to the wrapped device.
+ * Other reads are widened to the alignment and read into a bounce
+ * buffer from the pool. Other writes read, patch and write back the
+ * widened range. A range that runs past the last aligned block of the
+ * device is transferred with O_DIRECT cleared for that one call.
+ * map() always fails, so nothing is pulled through the page cache.
+ * The wrapped device and its descriptor are owned by this one.
+ */
+class DirectBlockDevice : public BlockDevice
+{
+private:
+  unique_ptr<BlockDevice> inner;
+  size_t align;
+  uintmax_t devSize;
+  AlignedBufferPool pool;
+  mutex writeLock;
+  mutex bufferedLock;
+
+  bool isAligned(const void *buf, size_t count, off_t offset) throw();
+  void *bounceBuffer(size_t len, size_t &cap) throw(LLIOError);
+  void bufferedIO(bool write, void *buf, size_t count,
+                  off_t offset) throw(LLIOError, LLIOEOF);
+
+public:
+  static const size_t DefaultAlignment;
+  static const size_t PoolIdleBytes;
+
+  explicit DirectBlockDevice(BlockDevice *dev) throw(LLIOError);
+  ~DirectBlockDevice() throw();
+  void xpread(void *buf, size_t count, off_t offset) throw(LLIOError, LLIOEOF);
+  void xpwrite(void *buf, size_t count, off_t offset) throw(LLIOError);
+  void xpreadBatch(vector<IORequest> &reqs) throw(LLIOError, LLIOEOF);
+  const void *map(off_t offset, size_t len) throw();
+  void unmap(const void *addr, size_t len) throw();
+  void sync() throw(LLIOError);
+
+  static size_t deviceAlignment(int fd) throw();
+};
+#endif //DIRECTBLOCKDEVICE_HPP
@@ -0,0 +1,112 @@
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <mutex>
+#include <functional>
+#ifdef DEBUG
+#include <iostream>
+#endif
+#include "Fat32DataAccess.hpp"
+#include "ThreadPool.hpp"
+#include "DirectoryTraversal.hpp"
+using namespace std;
+
+const size_t DirectoryTraversal::PrefetchBatch = 32;
+
+DirectoryTraversal::DirectoryTraversal(Fat32DataAccess &da,
+                                       uint32_t threadCnt) throw(system_error)
+  : fat32DA(da), pool(threadCnt) {}
+DirectoryTraversal::~DirectoryTraversal() throw() {}
+
+void DirectoryTraversal::run(const function<void(FileHandler &)> &visit)
+{
+  visitor = visit;
+  FileHandler root = fat32DA.getRootHandler();
+  markSeen(root.getFstClus());
+  pool.submit(bind(&DirectoryTraversal::scanDir, this, root, false));
+  pool.wait();
+}
+/*
+ * Directory clusters already scanned. Guards against cycles in a
+ * corrupted tree. A cluster is only marked once openDir() accepts it, so
+ * a deleted directory whose first cluster now belongs to a live one,
+ * refused as occupied, does not hide the live one's subtree.
+ */
+bool DirectoryTraversal::markSeen(uint32_t clusNo) throw()
+{
+  lock_guard<mutex> guard(seenLock);
+  return seenClus.insert(clusNo).second;
+}
+void DirectoryTraversal::scanDir(FileHandler dh, bool deleted)
+throw(FileIOError)
+{
+#ifdef DEBUG
+  cout << "\x1b[7m";
+  cout << "Scanning " << dh.getDirPath() << (deleted ? " (deleted)" : "")
+       << endl;
+  cout << "\x1b[0m";
+#endif //DEBUG
+  DirIterator it(fat32DA, dh);
+  FileHandler fh;
+  bool first = true;
+  vector<FileHandler> subs;
+  vector<bool> subDeleted;
+
+  while (it.next(fh)) {
+    //A freed cluster that no longer starts with "." is not a directory
+    if (first && deleted && 0 != fh.getShortName().compare(".")) {
+      return;
+    }
+
+    first = false;
+
+    if (0 == fh.getShortName().compare(".") ||
+        0 == fh.getShortName().compare("..")) {
+      continue;
+    }
+
+    fh.setDirPath(dh.getDirPath());
+    fh.setInDeletedDir(deleted);
+    {
+      lock_guard<mutex> guard(visitLock);
+      visitor(fh);
+    }
+
+    FileHandler sub;
+
+    if (fh.isDirectory() &&
+        Fat32DataAccess::ReadOK == fat32DA.openDir(fh, sub) &&
+        markSeen(fh.getFstClus())) {
+      subs.push_back(sub);
+      subDeleted.push_back(deleted || fh.isDeleted());
+
+      if (subs.size() == PrefetchBatch) {
+        submitDirs(subs, subDeleted);
+      }
+    }
+  }
+
+  submitDirs(subs, subDeleted);
+
+  if (Fat32DataAccess::DirScanEnd != it.getStatus()) {
+    throw FileIOError(-it.getStatus(), "Reading " + dh.getDirPath());
+  }
+}
+void DirectoryTraversal::submitDirs(vector<FileHandler> &subs,
+                                    vector<bool> &deleted) throw(FileIOError)
+{
+  if (subs.empty()) {
+    return;
+  }
+
+  fat32DA.prefetchDirs(subs);
+
+  for (size_t i = 0; i < subs.size(); ++i) {
+    pool.submit(bind(&DirectoryTraversal::scanDir, this, subs[i],
+                     (bool) deleted[i]));
+  }
+
+  subs.clear();
+  deleted.clear();
+}
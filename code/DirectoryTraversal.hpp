@@ -0,0 +1,46 @@
+#ifndef DIRECTORYTRAVERSAL_HPP
+#define DIRECTORYTRAVERSAL_HPP
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <mutex>
+#include <functional>
+#include "Fat32DataAccess.hpp"
+#include "ThreadPool.hpp"
+using namespace std;
+/*
+ * Walk every directory reachable from the root, live or deleted.
+ * Each directory is scanned as one ThreadPool task and its
+ * subdirectories are submitted as new tasks, so idle workers steal
+ * whole subtrees. Entries are handed to the visitor as soon as they are
+ * decoded; calls to the visitor are serialised but arrive in no
+ * particular order. "." and ".." are not reported.
+ * Subdirectories found in one scan are handed over in groups of up to
+ * PrefetchBatch, whose first blocks are fetched in a single device batch
+ * before the tasks are queued.
+ */
+class DirectoryTraversal
+{
+private:
+  static const size_t PrefetchBatch;
+
+  Fat32DataAccess &fat32DA;
+  ThreadPool pool;
+  function<void(FileHandler &)> visitor;
+  mutex visitLock;
+  mutex seenLock;
+  unordered_set<uint32_t> seenClus;
+
+  void scanDir(FileHandler dh, bool deleted) throw(FileIOError);
+  bool markSeen(uint32_t clusNo) throw();
+  void submitDirs(vector<FileHandler> &subs, vector<bool> &deleted)
+  throw(FileIOError);
+
+public:
+  DirectoryTraversal(Fat32DataAccess &da, uint32_t threadCnt)
+  throw(system_error);
+  ~DirectoryTraversal() throw();
+  void run(const function<void(FileHandler &)> &visit);
+};
+#endif //DIRECTORYTRAVERSAL_HPP
@@ -0,0 +1,74 @@
+#include <stdint.h>
+#include <string>
+#include <new>
+#include <stdexcept>
+#include <openssl/evp.h>
+#include "Digest.hpp"
+#include "EVPDigest.hpp"
+using namespace std;
+
+EVPDigest::EVPDigest(const string &alg)
+  : md(NULL), ctx(NULL), name(NULL)
+{
+  if (alg == "md5") {
+    md = EVP_md5();
+    name = "MD5";
+  } else if (alg == "sha1") {
+    md = EVP_sha1();
+    name = "SHA-1";
+  } else if (alg == "sha256") {
+    md = EVP_sha256();
+    name = "SHA-256";
+  } else {
+    throw logic_error("Unknown digest " + alg);
+  }
+
+  ctx = EVP_MD_CTX_new();
+
+  if (NULL == ctx) {
+    throw bad_alloc();
+  }
+
+  if (1 != EVP_DigestInit_ex(ctx, md, NULL)) {
+    EVP_MD_CTX_free(ctx);
+    throw runtime_error(string("Cannot set up ") + name);
+  }
+}
+EVPDigest::EVPDigest(const EVPDigest &other)
+  : Digest(other), md(other.md), ctx(NULL), name(other.name)
+{
+  ctx = EVP_MD_CTX_new();
+
+  if (NULL == ctx) {
+    throw bad_alloc();
+  }
+
+  if (1 != EVP_MD_CTX_copy_ex(ctx, other.ctx)) {
+    EVP_MD_CTX_free(ctx);
+    throw runtime_error(string("Cannot copy ") + name);
+  }
+}
+EVPDigest::~EVPDigest() throw()
+{
+  EVP_MD_CTX_free(ctx);
+}
+void EVPDigest::update(const void *data, size_t len) throw()
+{
+  EVP_DigestUpdate(ctx, data, len);
+}
+void EVPDigest::final(uint8_t *out) throw()
+{
+  EVP_DigestFinal_ex(ctx, out, NULL);
+}
+Digest *EVPDigest::clone() const
+{
+  return new EVPDigest(*this);
+}
+size_t EVPDigest::getSize() const throw()
+{
+  return EVP_MD_size(md);
+}
+const char *EVPDigest::getName() const throw()
+{
+  return name;
+}
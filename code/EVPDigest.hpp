@@ -0,0 +1,29 @@
+#ifndef EVPDIGEST_HPP
+#define EVPDIGEST_HPP
+#include <stdint.h>
+#include <string>
+#include <openssl/evp.h>
+#include "Digest.hpp"
+using namespace std;
+/*
+ * MD5, SHA-1 or SHA-256 through OpenSSL's EVP interface.
+ */
+class EVPDigest : public Digest
+{
+private:
+  const EVP_MD *md;
+  EVP_MD_CTX *ctx;
+  const char *name;
+
+  EVPDigest(const EVPDigest &other);
+
+public:
+  explicit EVPDigest(const string &alg);
+  ~EVPDigest() throw();
+  void update(const void *data, size_t len) throw();
+  void final(uint8_t *out) throw();
+  Digest *clone() const;
+  size_t getSize() const throw();
+  const char *getName() const throw();
+};
+#endif //EVPDIGEST_HPP
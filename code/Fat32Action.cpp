@@ -1,9 +1,93 @@
 #include <string>
+#include <functional>
+#include <memory>
+#include <iostream>
 #include "Fat32DataAccess.hpp"
+#include "DirectoryTraversal.hpp"
+#include "MetadataIndex.hpp"
 #include "Fat32Action.hpp"
 using namespace std;
 Fat32ActionError::Fat32ActionError(const string &what_arg)
   : runtime_error(what_arg) {}
-Fat32Action::Fat32Action(const string &devName) throw(FileIOError)
-  : fat32DA(devName) {}
-Fat32Action::~Fat32Action() throw() {}
+Fat32Action::Fat32Action(const string &devName,
+                         const DeviceOptions &opts) throw(FileIOError)
+  : fat32DA(devName, opts), recursive(false), threadCnt(1) {}
+/*
+ * An index read or built in this run no longer matches a volume that
+ * was written to since.
+ */
+Fat32Action::~Fat32Action() throw()
+{
+  if (!indexName.empty() && fat32DA.isModified()) {
+    MetadataIndex::remove(indexName);
+  }
+}
+/*
+ * Scan the root directory only, or with rec set, every directory on the
+ * volume using threads worker threads.
+ */
+void Fat32Action::setTraversal(bool rec, uint32_t threads) throw()
+{
+  recursive = rec;
+  threadCnt = threads;
+}
+/*
+ * Take directory entries from the metadata index name, building it if
+ * it is missing or stale, instead of scanning the directories.
+ */
+void Fat32Action::setIndex(const string &name) throw()
+{
+  indexName = name;
+}
+/*
+ * With -c, how the cluster cache did; nothing otherwise.
+ */
+void Fat32Action::printCacheStats() throw()
+{
+  uint64_t hits, misses;
+
+  if (fat32DA.getCacheStats(hits, misses)) {
+    cout << "Cluster cache: " << hits << " hits, " << misses << " misses"
+         << endl;
+  }
+}
+void Fat32Action::forEachEntry(const function<void(FileHandler &)> &visit)
+throw(FileIOError, Fat32ActionError)
+{
+  if (!indexName.empty() && !fat32DA.isModified()) {
+    if (!metaIndex) {
+      metaIndex.reset(new MetadataIndex(indexName));
+
+      if (!metaIndex->open(fat32DA)) {
+        metaIndex->build(fat32DA, threadCnt);
+      }
+
+#ifdef DEBUG
+      cout << "\x1b[7m";
+      cout << metaIndex->getCount() << " entries in the metadata index"
+           << endl;
+      cout << "\x1b[0m";
+#endif //DEBUG
+    }
+
+    metaIndex->forEach(fat32DA, recursive, visit);
+    return;
+  }
+
+  if (recursive) {
+    DirectoryTraversal traversal(fat32DA, threadCnt);
+    traversal.run(visit);
+    return;
+  }
+
+  DirIterator it(fat32DA, fat32DA.getRootHandler());
+  FileHandler fh;
+
+  while (it.next(fh)) {
+    visit(fh);
+  }
+
+  if (Fat32DataAccess::DirScanEnd != it.getStatus()) {
+    throw FileIOError(-it.getStatus(), "Reading root directory");
+  }
+}
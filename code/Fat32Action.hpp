@@ -2,8 +2,11 @@
 #define FAT32ACTION_HPP
 #include <string>
 #include <stdexcept>
+#include <functional>
+#include <memory>
 #include "Fat32DataAccess.hpp"
 using namespace std;
+class MetadataIndex;
 class Fat32ActionError : public runtime_error
 {
 public:
@@ -13,11 +16,21 @@ class Fat32Action
 {
 protected:
   Fat32DataAccess fat32DA;
+  bool recursive;
+  uint32_t threadCnt;
+  string indexName;         //Empty if -I was not given
+  unique_ptr<MetadataIndex> metaIndex;
+
+  void forEachEntry(const function<void(FileHandler &)> &visit)
+  throw(FileIOError, Fat32ActionError);
 
 public:
-  Fat32Action(const string &devName)
+  Fat32Action(const string &devName, const DeviceOptions &opts)
   throw(FileIOError);
   virtual ~Fat32Action() throw();
+  void setTraversal(bool rec, uint32_t threads) throw();
+  void setIndex(const string &name) throw();
+  void printCacheStats() throw();
   virtual void run() throw(FileIOError, Fat32ActionError) = 0;
 };
 #endif //FAT32ACTION_HPP
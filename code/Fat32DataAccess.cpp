@@ -1,5 +1,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdexcept>
@@ -9,13 +11,19 @@
 #include <endian.h>
 #include <list>
 #include <vector>
+#include <algorithm>
 #include <errno.h>
 #include <memory>
 #ifdef DEBUG
 #include <iostream>
 #endif
 #include "Fat32DataAccess.hpp"
+#include "Digest.hpp"
 #include "LowLevelIO.hpp"
+#include "FatTable.hpp"
+#include "BlockDevice.hpp"
+#include "CachedBlockDevice.hpp"
+#include "JournaledBlockDevice.hpp"
 
 using namespace std;
 
@@ -39,7 +47,10 @@ FileHandler::FileHandler() throw()
     size(0),
     offset(0),
     dirClus(0),
-    dirOffset(0) {}
+    dirOffset(0),
+    extentsGen(0),
+    dirPath("/"),
+    inDelDir(false) {}
 FileHandler::FileHandler(const string &sName, const string &lName, bool _isDel,
                          bool _isDir, uint32_t _fstClus, uint32_t _size,
                          uint32_t _dirClus, uint32_t _dirOffset, list<uint32_t> &_dirLFNOffsets) throw()
@@ -52,7 +63,10 @@ FileHandler::FileHandler(const string &sName, const string &lName, bool _isDel,
     offset(0),
     dirClus(_dirClus),
     dirOffset(_dirOffset),
-    dirLFNOffsets(_dirLFNOffsets)
+    dirLFNOffsets(_dirLFNOffsets),
+    extentsGen(0),
+    dirPath("/"),
+    inDelDir(false)
 {
 #ifdef DEBUG
   cout << "\x1b[7m";
@@ -77,7 +91,10 @@ FileHandler::FileHandler(uint32_t _fstClus, uint32_t _offset) throw()
     size(0),
     offset(_offset),
     dirClus(0),
-    dirOffset(0)
+    dirOffset(0),
+    extentsGen(0),
+    dirPath("/"),
+    inDelDir(false)
 {
 #ifdef DEBUG
   cout << "\x1b[7m";
@@ -140,6 +157,47 @@ const list<uint32_t> & FileHandler::getDirLFNOffsets()
 {
   return dirLFNOffsets;
 }
+/*
+ * Cached extents are shared between copies of a handler and are only
+ * valid for the FAT generation they were built from.
+ */
+shared_ptr<vector<FileHandler::Extent> > FileHandler::getExtents(uint32_t gen)
+{
+  if (gen != extentsGen) {
+    return shared_ptr<vector<Extent> >();
+  }
+
+  return extents;
+}
+void FileHandler::setExtents(shared_ptr<vector<Extent> > ext, uint32_t gen)
+{
+  extents = ext;
+  extentsGen = gen;
+}
+shared_ptr<FileHandler::DirBuffer> FileHandler::getDirBuffer()
+{
+  return dirBuffer;
+}
+void FileHandler::setDirBuffer(shared_ptr<DirBuffer> buf)
+{
+  dirBuffer = buf;
+}
+string FileHandler::getDirPath()
+{
+  return dirPath;
+}
+void FileHandler::setDirPath(const string &path)
+{
+  dirPath = path;
+}
+bool FileHandler::isInDeletedDir()
+{
+  return inDelDir;
+}
+void FileHandler::setInDeletedDir(bool inDel)
+{
+  inDelDir = inDel;
+}
 
 string FileHandler::toString()
 {
@@ -190,23 +248,90 @@ const uint8_t Fat32DataAccess::DirEntryIsEmpty = 0x00;
 const uint8_t Fat32DataAccess::DirEntryIsDeleted = 0x01;
 const uint8_t Fat32DataAccess::DirEntryIsLFN = 0x02;
 const uint8_t Fat32DataAccess::DirEntryIsSFN = 0x04;
-
-Fat32DataAccess::Fat32DataAccess(const string &devName) throw(FileIOError)
-  : deviceFd(-1)
+const uint8_t Fat32DataAccess::DirEntryIsEnd = 0x80;
+
+const int Fat32DataAccess::DirScanOK = 0;
+const int Fat32DataAccess::DirScanEnd = 1;
+
+const int Fat32DataAccess::ReadOK = 0;
+const int Fat32DataAccess::ReadClusterOccupied = 1;
+const int Fat32DataAccess::ReadBrokenFATChain = 2;
+
+const uint32_t Fat32DataAccess::DirReadMax = 64 * 1024;
+
+DeviceOptions::DeviceOptions()
+  : backend(BlockDevice::DefaultBackend),
+    readOnly(false),
+    cacheClusters(0),
+    writeBack(false),
+    direct(false),
+    rollback(false),
+    contiguous(false) {}
+
+Fat32DataAccess::Fat32DataAccess(const string &devName,
+                                 const DeviceOptions &opts) throw(FileIOError)
+  : journal(NULL),
+    cache(NULL),
+    rolledBack(0),
+    view(NULL),
+    viewLen(0),
+    allocClusCnt(-1),
+    fatGen(1),
+    fatBatching(false),
+    dataGen(1),
+    assumeContiguous(opts.contiguous)
 {
   //Detecting endianess first
   if ((uint16_t) 1 == le16toh((uint16_t) 1)) {
     isLittleEndian = true;
   }
 
-  deviceFd = open(devName.c_str(), O_RDWR);
+  try {
+    device.reset(BlockDevice::open(devName, opts.backend, opts.readOnly,
+                                   opts.direct));
+
+    //Replays or rolls back before anything is read from the volume
+    if (!opts.journal.empty()) {
+      journal = new JournaledBlockDevice(device.release(), opts.journal);
+      device.reset(journal);
+
+      if (opts.rollback) {
+        rolledBack = journal->rollback();
+      }
+    }
 
-  if (-1 == deviceFd) {
-    throw FileIOError(errno, devName);
+    //Read-only scans look at the device in place instead of copying it,
+    //unless the page cache is to be left alone, or the backend or the
+    //cluster cache is wanted
+    if (opts.readOnly && !opts.direct && NULL == journal &&
+        0 == opts.cacheClusters && BlockDevice::supportsView(opts.backend)) {
+      viewLen = device->getSize();
+      view = (const uint8_t *) device->map(0, viewLen);
+    }
+  } catch (LLIOError &e) {
+    throw FileIOError(e.code().value(), devName);
   }
 
+#ifdef DEBUG
+  cout << "\x1b[7m";
+  cout << "Device view: " << (NULL == view ? "none" : "mapped") << endl;
+  cout << "\x1b[0m";
+#endif // DEBUG
+
   BootSector bootSector;
-  readBootSector(bootSector);
+
+  try {
+    readBootSector(bootSector);
+    checkBootSector(bootSector);
+  } catch (FileIOError &e) {
+    //No destructor runs for a half-built object
+    if (NULL != view) {
+      device->unmap(view, viewLen);
+    }
+
+    throw;
+  }
+
   bytsPerSec = bootSector.BPB_BytsPerSec;
 #ifdef DEBUG
   cout << "\x1b[7m";
@@ -276,6 +401,7 @@ Fat32DataAccess::Fat32DataAccess(const string &devName) throw(FileIOError)
   cout << "DirEntry Per Cluster:" << maxDirEntryPerClus << endl;
   cout << "\x1b[0m";
 #endif // DEBUG
+  volID = bootSector.BS_VolID;
   rootClusNo = bootSector.BPB_RootClus;
 #ifdef DEBUG
   cout << "\x1b[7m";
@@ -285,19 +411,59 @@ Fat32DataAccess::Fat32DataAccess(const string &devName) throw(FileIOError)
   list<uint32_t> tmp;
   rootHandler =
     FileHandler("/", "/", false, true, rootClusNo, 0, rootClusNo, 0, tmp);
+  //Cache the data area in clusters; the FAT has FatTable for that
+  if (opts.cacheClusters > 0) {
+    try {
+      cache = new CachedBlockDevice(device.release(), opts.cacheClusters,
+                                    bytsPerClus, dataOffset, opts.writeBack);
+      device.reset(cache);
+    } catch (LLIOError &e) {
+      throw FileIOError(e.code().value(), devName);
+    }
+  }
+
+  //FAT lookups jump around; directories and files are read front to back
+  adviseView(fatOffset, bytsPerFat * numFATs, MADV_RANDOM);
+  adviseView(dataOffset, viewLen > dataOffset ? viewLen - dataOffset : 0,
+             MADV_SEQUENTIAL);
   readFAT();
 }
 Fat32DataAccess::~Fat32DataAccess() throw()
 {
-  if (-1 != deviceFd) {
-    close(deviceFd);
+  fatTable.reset();
+
+  if (NULL != view) {
+    device->unmap(view, viewLen);
   }
+
+  device.reset();
+}
+void Fat32DataAccess::adviseView(uintmax_t offset, uintmax_t len,
+                                 int advice) throw()
+{
+  if (NULL == view || offset >= viewLen || 0 == len) {
+    return;
+  }
+
+  if (offset + len > viewLen) {
+    len = viewLen - offset;
+  }
+
+  long pageSize = sysconf(_SC_PAGESIZE);
+  uintptr_t start = (uintptr_t)(view + offset);
+  uintptr_t aligned = start - start % pageSize;
+  //Only a hint; failure is harmless
+  madvise((void *) aligned, len + (start - aligned), advice);
 }
 void Fat32DataAccess::readBootSector(BootSector &bootSector) throw(
   FileIOError)
 {
   try {
-    LowLevelIO::xpread(deviceFd, &bootSector, sizeof(BootSector), 0);
+    if (NULL != view && viewLen >= sizeof(BootSector)) {
+      memcpy(&bootSector, view, sizeof(BootSector));
+    } else {
+      device->xpread(&bootSector, sizeof(BootSector), 0);
+    }
   } catch (LLIOError &e) {
     throw FileIOError(e.code(), "Reading BootSector");
   } catch (LLIOEOF &e) {
@@ -323,62 +489,117 @@ void Fat32DataAccess::readBootSector(BootSector &bootSector) throw(
     bootSector.BS_VolID = le32toh(bootSector.BS_VolID);
   }
 }
+static bool isPowerOfTwo(uint32_t v)
+{
+  return 0 != v && 0 == (v & (v - 1));
+}
+/*
+ * Reject a boot sector whose geometry cannot be a FAT32 volume: the
+ * sizes below are divided by, and the FAT must hold an entry for every
+ * cluster.
+ */
+void Fat32DataAccess::checkBootSector(const BootSector &bootSector) throw(
+  FileIOError)
+{
+  if (!isPowerOfTwo(bootSector.BPB_BytsPerSec) ||
+      !isPowerOfTwo(bootSector.BPB_SecPerClus) ||
+      bootSector.BPB_NumFATs < 1) {
+    throw FileIOError(EINVAL, "Bad BootSector geometry");
+  }
+
+  uintmax_t totSec = (uintmax_t) bootSector.BPB_TotSec32 +
+                     bootSector.BPB_TotSec16;
+  uintmax_t metaSec = bootSector.BPB_RsvdSecCnt +
+                      (uintmax_t) bootSector.BPB_NumFATs * bootSector.BPB_FATSz32;
+
+  if (totSec < metaSec) {
+    throw FileIOError(EINVAL, "Bad BootSector sector counts");
+  }
+
+  uintmax_t clusCnt = (totSec - metaSec) / bootSector.BPB_SecPerClus;
 
+  if ((uintmax_t) bootSector.BPB_FATSz32 * bootSector.BPB_BytsPerSec <
+      (clusCnt + 2) * sizeof(uint32_t)) {
+    throw FileIOError(EINVAL, "Bad BootSector FAT size");
+  }
+
+  if (bootSector.BPB_RootClus < 2 || bootSector.BPB_RootClus >= clusCnt + 2) {
+    throw FileIOError(EINVAL, "Bad BootSector root cluster");
+  }
+}
+
+/*
+ * Set up the first FAT for lazy access.
+ * Nothing is read here; FatTable loads a chunk of entries the first time
+ * getNextClus() or setNextClus() touches it.
+ */
 void Fat32DataAccess::readFAT() throw(FileIOError)
 {
-  fatMap.clear();
-  unique_ptr<uint32_t[]> fat(new uint32_t[bytsPerFat]);
+  fatTable.reset(new FatTable(*device, fatOffset, bytsPerFat, totClusCnt + 2,
+                              FatTable::DefaultMaxChunks));
 
-  try {
-    LowLevelIO::xpread(deviceFd, fat.get(), bytsPerFat, fatOffset);
-  } catch (LLIOError &e) {
-    throw FileIOError(e.code(), "Reading FAT table");
-  } catch (LLIOEOF &e) {
-    throw FileIOError(EIO, "Unexpected EOF when reading FAT table");
-  }
 #ifdef DEBUG
   cout << "\x1b[7m";
   cout << "===========" << endl;
   cout << "FAT entries" << endl;
   cout << "\x1b[0m";
-#endif // DEBUG
-  for (uint32_t i = 0; i < totClusCnt + 2; i++) {
-    if (!isLittleEndian) {
-      fat[i] = le32toh(fat[i]);
-    }
 
-    fat[i] = fat[i] & FATEntryMask;
+  for (uint32_t i = 0; i < totClusCnt + 2; i++) {
+    uint32_t entry = readFATEntry(i);
 
-    if (FATFreeClus != fat[i]) {
-#ifdef DEBUG
-  cout << "\x1b[7m";
+    if (FATFreeClus != entry) {
+      cout << "\x1b[7m";
       cout << i << ": 0x";
       cout << hex;
       cout.width(8);
       cout.fill('0');
-      cout << fat[i];
+      cout << entry;
       cout.width(0);
       cout.fill(' ');
       cout << dec << endl;
-  cout << "\x1b[0m";
-#endif // DEBUG
-      fatMap[i] = fat[i];
+      cout << "\x1b[0m";
     }
   }
-#ifdef DEBUG
+
   cout << "\x1b[7m";
   cout << "===========" << endl;
   cout << "\x1b[0m";
 #endif // DEBUG
 }
+/*
+ * Count the allocated entries once, on first use.
+ * Entries 0 and 1 are reserved and always non-free.
+ */
+void Fat32DataAccess::countFATEntries() throw(FileIOError)
+{
+  try {
+    allocClusCnt = (int64_t) fatTable->countNonFree(FATEntryMask) - 2;
+
+    //The table does not know about entries still pending in a batch
+    for (map<uint32_t, uint32_t>::iterator it = fatDirty.begin();
+         it != fatDirty.end(); ++it) {
+      uint32_t onDisk = le32toh(fatTable->get(it->first)) & FATEntryMask;
+
+      if (isFreeClus(onDisk) && !isFreeClus(it->second & FATEntryMask)) {
+        ++allocClusCnt;
+      } else if (!isFreeClus(onDisk) && isFreeClus(it->second & FATEntryMask)) {
+        --allocClusCnt;
+      }
+    }
+  } catch (LLIOError &e) {
+    throw FileIOError(e.code(), "Reading FAT table");
+  } catch (LLIOEOF &e) {
+    throw FileIOError(EIO, "Unexpected EOF when reading FAT table");
+  }
+}
 /*
  * Recover the file pointed to by fh
  * Rename the first character in SFN entry to name0
  * Assumption: name0 is character/numeric
  */
 void Fat32DataAccess::recover(FileHandler &fh,
-                              char name0, bool recoverLFN) throw(ClusterOccupied,
-                                  BrokenFATChain)
+                              char name0, bool recoverLFN) throw(FileIOError,
+                                  ClusterOccupied, BrokenFATChain)
 {
   if (!isalnum(name0)) {
     throw logic_error("The first character should be alphanumeric");
@@ -392,14 +613,105 @@ void Fat32DataAccess::recover(FileHandler &fh,
     throw logic_error("Cannot recover a directory");
   }
 
-  if (fh.getSize() > bytsPerClus) {
+  //Its directory's clusters are free; nothing would lead to the entry
+  if (fh.isInDeletedDir()) {
     throw BrokenFATChain();
   }
 
-  if (!isFreeClus(fh.getFstClus()) && !isFreeClus(getNextClus(fh.getFstClus()))) {
+  uint32_t clusCnt = (fh.getSize() + bytsPerClus - 1) / bytsPerClus;
+
+  if (clusCnt > 1) {
+    int status = getRunStatus(fh);
+
+    if (ReadClusterOccupied == status) {
+      throw ClusterOccupied();
+    } else if (ReadOK != status) {
+      throw BrokenFATChain();
+    }
+  } else if (!isFreeClus(fh.getFstClus()) &&
+             !isFreeClus(getNextClus(fh.getFstClus()))) {
     throw ClusterOccupied();
   }
 
+  restoreEntry(fh, name0, recoverLFN);
+
+  if (clusCnt > 1) {
+    vector<ClusterRun> runs(1);
+    runs[0].fstClus = fh.getFstClus();
+    runs[0].len = clusCnt;
+    writeChain(runs);
+  } else {
+    setNextClus(fh.getFstClus(), FATEOFClus);
+  }
+
+  commitRecovery();
+}
+/*
+ * Recover fh onto the given runs of clusters, in file order, such as a
+ * file found in fragments. The first run must start at the first
+ * cluster of fh and the runs must hold exactly its size.
+ */
+void Fat32DataAccess::recoverFragments(FileHandler &fh, char name0,
+                                       bool recoverLFN,
+                                       const vector<ClusterRun> &runs)
+throw(FileIOError, ClusterOccupied, BrokenFATChain)
+{
+  if (!isalnum(name0)) {
+    throw logic_error("The first character should be alphanumeric");
+  }
+
+  name0 = (char)toupper(name0);
+
+  if (!fh.isDeleted()) {
+    throw logic_error("Cannot recover an existing entry");
+  }
+
+  if (fh.isDirectory()) {
+    throw logic_error("Cannot recover a directory");
+  }
+
+  //Its directory's clusters are free; nothing would lead to the entry
+  if (fh.isInDeletedDir()) {
+    throw BrokenFATChain();
+  }
+
+  uint32_t clusCnt = (fh.getSize() + bytsPerClus - 1) / bytsPerClus;
+  uint32_t total = 0;
+
+  for (vector<ClusterRun>::const_iterator it = runs.begin(); it != runs.end();
+       ++it) {
+    if (it->fstClus < 2 || it->fstClus >= totClusCnt ||
+        it->len > totClusCnt - it->fstClus) {
+      throw BrokenFATChain();
+    }
+
+    total += it->len;
+  }
+
+  if (runs.empty() || runs[0].fstClus != fh.getFstClus() || total != clusCnt) {
+    throw BrokenFATChain();
+  }
+
+  for (vector<ClusterRun>::const_iterator it = runs.begin(); it != runs.end();
+       ++it) {
+    for (uint32_t i = 0; i < it->len; ++i) {
+      if (!isFreeClus(getNextClus(it->fstClus + i))) {
+        throw ClusterOccupied();
+      }
+    }
+  }
+
+  restoreEntry(fh, name0, recoverLFN);
+  writeChain(runs);
+  commitRecovery();
+}
+/*
+ * Put name0 back as the first character of the SFN entry of fh and, with
+ * recoverLFN, renumber its LFN entries.
+ */
+void Fat32DataAccess::restoreEntry(FileHandler &fh, char name0,
+                                   bool recoverLFN) throw(FileIOError)
+{
   FileHandler dfh(fh.getDirClus(), fh.getDirOffset());
   fs32write(dfh, &name0, 1);
   if (recoverLFN && !fh.getDirLFNOffsets().empty()) {
@@ -415,7 +727,59 @@ void Fat32DataAccess::recover(FileHandler &fh,
       ++buf;
     }
   }
-  setNextClus(fh.getFstClus(), FATEOFClus);
+}
+/*
+ * Chain the clusters of runs in order and end the chain; the whole chain
+ * lands in the FAT at once.
+ */
+void Fat32DataAccess::writeChain(const vector<ClusterRun> &runs)
+throw(FileIOError)
+{
+  bool ownBatch = !fatBatching;
+  uint32_t prev = 0;
+
+  if (ownBatch) {
+    beginFATBatch();
+  }
+
+  try {
+    for (vector<ClusterRun>::const_iterator it = runs.begin();
+         it != runs.end(); ++it) {
+      for (uint32_t i = 0; i < it->len; ++i) {
+        if (0 != prev) {
+          setNextClus(prev, it->fstClus + i);
+        }
+
+        prev = it->fstClus + i;
+      }
+    }
+
+    setNextClus(prev, FATEOFClus);
+
+    if (ownBatch) {
+      commitFATBatch();
+    }
+  } catch (...) {
+    //A caller's batch is the caller's to abort
+    if (ownBatch) {
+      abortFATBatch();
+    }
+
+    throw;
+  }
+}
+/*
+ * Outside a batch, each recovery is one journal transaction.
+ */
+void Fat32DataAccess::commitRecovery() throw(FileIOError)
+{
+  if (NULL != journal && !fatBatching) {
+    try {
+      device->sync();
+    } catch (LLIOError &e) {
+      throw FileIOError(e.code(), "Committing journal");
+    }
+  }
 }
 ssize_t Fat32DataAccess::fs32write(FileHandler &fh, void *buf,
                                    size_t count) throw(FileIOError)
@@ -440,13 +804,8 @@ ssize_t Fat32DataAccess::fs32write(FileHandler &fh, void *buf,
   }
 
   ssize_t ret = 0;
-  off_t offset = fh.getOffset();
-  uint32_t clusNo = fh.getFstClus();
-
-  while (offset >= (off_t)bytsPerClus) {
-    offset -= bytsPerClus;
-    clusNo = getNextClus(clusNo);
-  }
+  uint32_t offset = fh.getOffset();
+  ++dataGen;
 
   do {
 #ifdef DEBUG
@@ -454,16 +813,17 @@ ssize_t Fat32DataAccess::fs32write(FileHandler &fh, void *buf,
     cout << "Remaining bytes " << count << endl;
   cout << "\x1b[0m";
 #endif //DEBUG
-    size_t realCount = 0;
+    uintmax_t devOffset;
+    size_t runBytes;
 
-    if (offset + count >= bytsPerClus) {
-      realCount = bytsPerClus - offset;
-    } else {
-      realCount = count;
+    if (!mapOffset(fh, offset, devOffset, runBytes)) {
+      throw logic_error("fs32write: Offset beyond end of cluster chain");
     }
 
+    size_t realCount = count < runBytes ? count : runBytes;
+
     try {
-      LowLevelIO::xpwrite(deviceFd, buf, count, offset + getClusOffset(clusNo));
+      device->xpwrite(buf, realCount, devOffset);
     } catch (LLIOError &e) {
       throw FileIOError(e.code(), "f32write");
     } catch (LLIOEOF &e) {
@@ -474,11 +834,6 @@ ssize_t Fat32DataAccess::fs32write(FileHandler &fh, void *buf,
     count -= realCount;
     offset += realCount;
     ret += realCount;
-
-    if (offset == (off_t)bytsPerClus) {
-      offset = 0;
-      clusNo = getNextClus(clusNo);
-    }
   } while (0 != count);
 
   fh.setOffset(fh.getOffset() + ret);
@@ -489,10 +844,91 @@ ssize_t Fat32DataAccess::fs32write(FileHandler &fh, void *buf,
 #endif //DEBUG
   return ret;
 }
-ssize_t Fat32DataAccess::fs32read(FileHandler &fh, void *buf,
-                                  size_t count) throw(FileIOError,
-                                      ClusterOccupied,
-                                      BrokenFATChain)
+/*
+ * Whether the data of fh can still be read, without throwing.
+ * Live files always can; a deleted file only while it fits in its first
+ * cluster and that cluster has not been reused. With contiguous set in
+ * DeviceOptions, a larger deleted file is readable while every cluster
+ * of the run from its first cluster is free.
+ */
+int Fat32DataAccess::getReadStatus(FileHandler &fh) throw(FileIOError)
+{
+  if (!fh.isDeleted() || fh.getSize() == 0) {
+    return ReadOK;
+  }
+
+  if (fh.getSize() > bytsPerClus) {
+    if (assumeContiguous) {
+      return getRunStatus(fh);
+    }
+
+#ifdef DEBUG
+  cout << "\x1b[7m";
+    cout << "Deleted file spanning across multiple clusters" << endl;
+  cout << "\x1b[0m";
+#endif //DEBUG
+    return ReadBrokenFATChain;
+  }
+
+  if (fh.getFstClus() < 2 || fh.getFstClus() >= totClusCnt) {
+    return ReadBrokenFATChain;
+  }
+
+  if (!isFreeClus(getNextClus(fh.getFstClus()))) {
+#ifdef DEBUG
+  cout << "\x1b[7m";
+    cout << "Deleted file has been overwritten" << endl;
+  cout << "\x1b[0m";
+#endif //DEBUG
+    return ReadClusterOccupied;
+  }
+
+  return ReadOK;
+}
+/*
+ * Check the clusters a deleted fh would occupy if it was stored in one
+ * run: ReadBrokenFATChain if the run leaves the volume or contiguous
+ * recovery is off, ReadClusterOccupied if any of them is in use.
+ */
+int Fat32DataAccess::getRunStatus(FileHandler &fh) throw(FileIOError)
+{
+  return getRunStatus(fh, 0, (fh.getSize() + bytsPerClus - 1) / bytsPerClus);
+}
+/*
+ * The same for only cnt clusters of the run, from its fromClus-th.
+ */
+int Fat32DataAccess::getRunStatus(FileHandler &fh, uint32_t fromClus,
+                                  uint32_t cnt) throw(FileIOError)
+{
+  uint32_t clusCnt = (fh.getSize() + bytsPerClus - 1) / bytsPerClus;
+
+  if (!assumeContiguous || fh.getFstClus() < 2 ||
+      fh.getFstClus() >= totClusCnt || clusCnt > totClusCnt - fh.getFstClus()) {
+    return ReadBrokenFATChain;
+  }
+
+  for (uint32_t i = fromClus; i < fromClus + cnt && i < clusCnt; ++i) {
+    if (!isFreeClus(getNextClus(fh.getFstClus() + i))) {
+#ifdef DEBUG
+      cout << "\x1b[7m";
+      cout << "Cluster " << fh.getFstClus() + i << " of the run is in use"
+           << endl;
+      cout << "\x1b[0m";
+#endif //DEBUG
+      return ReadClusterOccupied;
+    }
+  }
+
+  return ReadOK;
+}
+/*
+ * Checks shared by fs32read() and fs32readBatch(): clamp count to the
+ * end of fh and append the device ranges holding those bytes to reqs,
+ * one per contiguous run. Returns the clamped count.
+ */
+size_t Fat32DataAccess::planRead(FileHandler &fh, void *buf, size_t count,
+                                 vector<BlockDevice::IORequest> &reqs)
+throw(FileIOError, ClusterOccupied, BrokenFATChain)
 {
   if (fh.isDirectory()) {
     throw logic_error("fs32read: Cannot read directory");
@@ -525,128 +961,259 @@ ssize_t Fat32DataAccess::fs32read(FileHandler &fh, void *buf,
 #endif //DEBUG
   }
 
-  if (fh.isDeleted()) {
-    if (fh.getSize() > bytsPerClus) {
+  int readStatus;
+
+  if (fh.isDeleted() && assumeContiguous && fh.getSize() > bytsPerClus) {
+    //Only the clusters this read touches, so reading a file a chunk at a
+    //time checks each cluster once rather than the whole run per chunk
+    uint32_t fromClus = fh.getOffset() / bytsPerClus;
+    uint32_t toClus = (fh.getOffset() + count - 1) / bytsPerClus;
+    readStatus = getRunStatus(fh, fromClus, toClus - fromClus + 1);
+  } else {
+    readStatus = getReadStatus(fh);
+  }
+
+  if (ReadClusterOccupied == readStatus) {
+    throw ClusterOccupied();
+  } else if (ReadBrokenFATChain == readStatus) {
+    throw BrokenFATChain();
+  }
+
+  size_t planned = 0;
+  uint32_t offset = fh.getOffset();
+
+  while (planned != count) {
+    uintmax_t devOffset;
+    size_t runBytes;
+
+    if (!mapOffset(fh, offset, devOffset, runBytes)) {
 #ifdef DEBUG
   cout << "\x1b[7m";
-      cout << "fs32read: Deleted file spanning across multiple clusters"
-           << endl;
+      cout << "fs32read: Cluster chain ends before end of file" << endl;
   cout << "\x1b[0m";
 #endif //DEBUG
       throw BrokenFATChain();
     }
 
-    if (!isFreeClus(getNextClus(fh.getFstClus()))) {
+    //A whole contiguous run is fetched with a single read
+    BlockDevice::IORequest req;
+    req.buf = (unsigned char *)buf + planned;
+    req.count = count - planned < runBytes ? count - planned : runBytes;
+    req.offset = devOffset;
+    reqs.push_back(req);
+    planned += req.count;
+    offset += req.count;
+  }
+
+  return count;
+}
+ssize_t Fat32DataAccess::fs32read(FileHandler &fh, void *buf,
+                                  size_t count) throw(FileIOError,
+                                      ClusterOccupied,
+                                      BrokenFATChain)
+{
+  vector<BlockDevice::IORequest> reqs;
+  ssize_t ret = planRead(fh, buf, count, reqs);
+  readRuns(reqs);
+  fh.setOffset(fh.getOffset() + ret);
 #ifdef DEBUG
   cout << "\x1b[7m";
-      cout << "fs32read: Deleted file has been overwritten" << endl;
+  cout << ret << "bytes read" << endl;
   cout << "\x1b[0m";
 #endif //DEBUG
-      throw ClusterOccupied();
+  return ret;
+}
+static bool byDevOffset(const BlockDevice::IORequest &a,
+                        const BlockDevice::IORequest &b)
+{
+  return a.offset < b.offset;
+}
+/*
+ * Fill the buffers of planned runs, from the view when there is one.
+ * Runs that lie close together on the device (the tails of small files
+ * in neighbouring clusters, say) are read with one vectored read; gaps of
+ * up to a cluster between them are read into a scratch buffer. The rest
+ * go to the device as a batch.
+ */
+void Fat32DataAccess::readRuns(vector<BlockDevice::IORequest> &reqs)
+throw(FileIOError)
+{
+  if (NULL != view) {
+    for (vector<BlockDevice::IORequest>::iterator it = reqs.begin();
+         it != reqs.end(); ++it) {
+      if ((uintmax_t) it->offset + it->count > viewLen) {
+        throw FileIOError(EIO, "Unexpected EOF in f32read");
+      }
+
+      memcpy(it->buf, view + it->offset, it->count);
     }
+
+    return;
   }
 
-  ssize_t ret = 0;
-  off_t offset = fh.getOffset();
-  uint32_t clusNo = fh.getFstClus();
+  vector<BlockDevice::IORequest> sorted(reqs);
+  vector<BlockDevice::IORequest> single;
+  unique_ptr<unsigned char[]> gapBuf;
+  sort(sorted.begin(), sorted.end(), byDevOffset);
 
-  while (offset >= (off_t)bytsPerClus) {
-    offset -= bytsPerClus;
-    clusNo = getNextClus(clusNo);
-  }
+  try {
+    size_t i = 0;
 
-  do {
-#ifdef DEBUG
-  cout << "\x1b[7m";
-    cout << "Remaining bytes " << count << endl;
-  cout << "\x1b[0m";
-#endif //DEBUG
-    size_t realCount = 0;
+    while (i < sorted.size()) {
+      size_t j = i + 1;
 
-    if (offset + count > (off_t)bytsPerClus) {
-      realCount = bytsPerClus - offset;
-    } else {
-      realCount = count;
-    }
+      while (j < sorted.size() &&
+             sorted[j - 1].offset + (off_t) sorted[j - 1].count <=
+             sorted[j].offset &&
+             sorted[j - 1].offset + (off_t) sorted[j - 1].count +
+             (off_t) bytsPerClus >= sorted[j].offset) {
+        ++j;
+      }
+
+      if (j - i == 1) {
+        single.push_back(sorted[i]);
+      } else {
+        vector<struct iovec> iov;
+
+        if (!gapBuf) {
+          gapBuf.reset(new unsigned char[bytsPerClus]);
+        }
+
+        for (size_t k = i; k < j; ++k) {
+          struct iovec v;
+
+          if (k > i) {
+            v.iov_base = gapBuf.get();
+            v.iov_len = sorted[k].offset - sorted[k - 1].offset -
+                        sorted[k - 1].count;
+
+            if (0 != v.iov_len) {
+              iov.push_back(v);
+            }
+          }
+
+          v.iov_base = sorted[k].buf;
+          v.iov_len = sorted[k].count;
+          iov.push_back(v);
+        }
 
-    try {
 #ifdef DEBUG
   cout << "\x1b[7m";
-      cout << "...Read " << realCount << "bytes at device offset "
-           << offset + getClusOffset(clusNo) << "B " << endl;
+        cout << "...Read " << j - i << " runs at device offset "
+             << sorted[i].offset << "B in one go" << endl;
   cout << "\x1b[0m";
 #endif //DEBUG
-      LowLevelIO::xpread(deviceFd, buf, realCount,
-                         offset + getClusOffset(clusNo));
-    } catch (LLIOError &e) {
-      throw FileIOError(e.code(), "f32read");
-    } catch (LLIOEOF &e) {
-      throw FileIOError(EIO, "Unexpected EOF in f32read");
-    }
-
-    buf = (unsigned char *)buf + realCount;
-    count -= realCount;
-    offset += realCount;
-    ret += realCount;
+        device->xpreadv(iov.data(), iov.size(), sorted[i].offset);
+      }
 
-    if (offset == (off_t)bytsPerClus) {
-      offset = 0;
-      clusNo = getNextClus(clusNo);
+      i = j;
     }
-  } while (0 != count);
 
-  fh.setOffset(fh.getOffset() + ret);
 #ifdef DEBUG
-  cout << "\x1b[7m";
-  cout << ret << "bytes read" << endl;
-  cout << "\x1b[0m";
+    for (vector<BlockDevice::IORequest>::iterator it = single.begin();
+         it != single.end(); ++it) {
+      cout << "\x1b[7m";
+      cout << "...Read " << it->count << "bytes at device offset "
+           << it->offset << "B " << endl;
+      cout << "\x1b[0m";
+    }
 #endif //DEBUG
-  return ret;
+    device->xpreadBatch(single);
+  } catch (LLIOError &e) {
+    throw FileIOError(e.code(), "f32read");
+  } catch (LLIOEOF &e) {
+    throw FileIOError(EIO, "Unexpected EOF in f32read");
+  }
+}
+/*
+ * fs32read() on several files at once. Every range of every read is
+ * handed to the device in one batch, so a backend that can queue them
+ * (io_uring) keeps them all in flight together.
+ */
+void Fat32DataAccess::fs32readBatch(vector<BatchRead> &reads)
+throw(FileIOError, ClusterOccupied, BrokenFATChain)
+{
+  vector<BlockDevice::IORequest> reqs;
+
+  for (vector<BatchRead>::iterator it = reads.begin(); it != reads.end();
+       ++it) {
+    it->ret = planRead(*it->fh, it->buf, it->count, reqs);
+  }
+
+  readRuns(reqs);
+
+  for (vector<BatchRead>::iterator it = reads.begin(); it != reads.end();
+       ++it) {
+    it->fh->setOffset(it->fh->getOffset() + it->ret);
+  }
 }
 uint8_t Fat32DataAccess::readDirEntry(FileHandler &dh,
-                                      DirEntry &de) throw(FileIOError,
-                                          NoMoreData)
+                                      DirEntry &de) throw(FileIOError)
 {
+  //FileIOError rather than logic_error: nextFileHandlerFromDir() must not
+  //throw
   if (!dh.isDirectory() || dh.isDeleted()) {
-    throw logic_error("FileHandler is not a directory or is deleted");
+    throw FileIOError(EINVAL, "FileHandler is not a directory or is deleted");
   }
 
   uint32_t offset = dh.getOffset();
-  uint32_t clusNo = dh.getFstClus();
 
   if (offset % sizeof(de) != 0) {
-    throw logic_error("Invalid offset for DirEntry");
+    throw FileIOError(EINVAL, "Invalid offset for DirEntry");
   }
 
-  while (offset >= bytsPerClus && !isEOFClus(clusNo)) {
-    offset -= bytsPerClus;
-    clusNo = getNextClus(clusNo);
-  }
+  uintmax_t devOffset;
+  size_t runBytes;
 
-  if (isEOFClus(clusNo)) {
-    throw NoMoreData();
+  if (!mapOffset(dh, offset, devOffset, runBytes)) {
+    return DirEntryIsEnd;
   }
 
-  if (clusNo < 2 || clusNo >= totClusCnt || isFreeClus(getNextClus(clusNo))) {
-    throw logic_error("Cluster index outof range");
-  }
+  shared_ptr<FileHandler::DirBuffer> db = dh.getDirBuffer();
 
-  uint32_t realOffset = getClusOffset(clusNo) + offset;
+  if (!db || db->gen != dataGen || devOffset < db->devOffset ||
+      devOffset + sizeof(de) > db->devOffset + db->len) {
+    //Fetch the rest of the contiguous run, up to DirReadMax, in one go
+    size_t len = runBytes < DirReadMax ? runBytes : DirReadMax;
 
-  try {
-    LowLevelIO::xpread(deviceFd, &de, sizeof(de), realOffset);
+    if (!db) {
+      db.reset(new FileHandler::DirBuffer());
+      dh.setDirBuffer(db);
+    }
+
+    if (NULL != view && devOffset + len <= viewLen) {
+      //Look at the run in place instead of copying it
+      adviseView(devOffset, len, MADV_WILLNEED);
+      db->data.clear();
+      db->bytes = view + devOffset;
+    } else {
+      db->data.resize(len);
+      db->bytes = db->data.data();
+      db->len = 0;
+
+      try {
+        device->xpread(db->data.data(), len, devOffset);
 #ifdef DEBUG
   cout << "\x1b[7m";
-    cout << "Read from cluster " << clusNo << " offset " << offset << "B "
-         << sizeof(de) << " bytes" << endl;
+        cout << "Read directory at device offset " << devOffset << "B "
+             << len << " bytes" << endl;
   cout << "\x1b[0m";
 #endif
-  } catch (LLIOError &e) {
-    throw FileIOError(e.code(), "Reading DirEntry");
-  } catch (LLIOEOF &e) {
-    throw FileIOError(EIO, "Unexpected EOF when reading DirEntry");
+      } catch (LLIOError &e) {
+        db->data.clear();
+        throw FileIOError(e.code(), "Reading DirEntry");
+      } catch (LLIOEOF &e) {
+        db->data.clear();
+        throw FileIOError(EIO, "Unexpected EOF when reading DirEntry");
+      }
+    }
+
+    db->devOffset = devOffset;
+    db->len = len;
+    db->gen = dataGen;
   }
 
+  memcpy(&de, db->bytes + (devOffset - db->devOffset), sizeof(de));
   dh.setOffset(dh.getOffset() + sizeof(de));
 
   if (DirEntryEmptyFlag == de.raw.status) {
@@ -692,11 +1259,81 @@ uint8_t Fat32DataAccess::readDirEntry(FileHandler &dh,
     return DirEntryIsSFN;
   }
 }
+/*
+ * Fill the directory buffers of all of dirs in one device batch, so the
+ * first run of every directory of a tree level is read concurrently.
+ * Iteration then starts from the buffer instead of the device.
+ */
+void Fat32DataAccess::prefetchDirs(vector<FileHandler> &dirs)
+throw(FileIOError)
+{
+  vector<BlockDevice::IORequest> reqs;
+  vector<shared_ptr<FileHandler::DirBuffer> > bufs;
+
+  for (vector<FileHandler>::iterator it = dirs.begin(); it != dirs.end();
+       ++it) {
+    uintmax_t devOffset;
+    size_t runBytes;
+
+    if (!it->isDirectory() || it->isDeleted() ||
+        !mapOffset(*it, it->getOffset(), devOffset, runBytes)) {
+      continue;
+    }
+
+    if (NULL != view) {
+      //readDirEntry() looks at the view directly; just start the readahead
+      adviseView(devOffset, runBytes < DirReadMax ? runBytes : DirReadMax,
+                 MADV_WILLNEED);
+      continue;
+    }
+
+    shared_ptr<FileHandler::DirBuffer> db(new FileHandler::DirBuffer());
+    db->data.resize(runBytes < DirReadMax ? runBytes : DirReadMax);
+    db->bytes = db->data.data();
+    db->len = db->data.size();
+    db->devOffset = devOffset;
+    db->gen = 0;
+    BlockDevice::IORequest req;
+    req.buf = db->data.data();
+    req.count = db->data.size();
+    req.offset = devOffset;
+    reqs.push_back(req);
+    bufs.push_back(db);
+    it->setDirBuffer(db);
+  }
+
+  readRuns(reqs);
+
+  //Generation 0 is never current, so a failed batch is simply reread
+  for (vector<shared_ptr<FileHandler::DirBuffer> >::iterator it =
+         bufs.begin(); it != bufs.end(); ++it) {
+    (*it)->gen = dataGen;
+  }
+}
 FileHandler Fat32DataAccess::getNextFileHandlerFromDir(FileHandler &dh) throw(
   FileIOError, NoMoreData)
 {
-  if (!dh.isDirectory() && !dh.isDeleted()) {
-    throw logic_error("File handler is not a directory or is deleted");
+  FileHandler fh;
+  int status = nextFileHandlerFromDir(dh, fh);
+
+  if (DirScanEnd == status) {
+    throw NoMoreData();
+  } else if (DirScanOK != status) {
+    throw FileIOError(-status, "Reading DirEntry");
+  }
+
+  return fh;
+}
+/*
+ * Decode the next file in directory dh into fh without throwing.
+ * Returns DirScanOK, DirScanEnd at the end of the directory, -EINVAL if
+ * dh is not a live directory, or -errno if the device failed.
+ */
+int Fat32DataAccess::nextFileHandlerFromDir(FileHandler &dh,
+    FileHandler &fh) throw()
+{
+  if (!dh.isDirectory() || dh.isDeleted()) {
+    return -EINVAL;
   }
   const int WaitingDeleted = 2;
   const int WaitingUnDel = 1;
@@ -711,7 +1348,17 @@ FileHandler Fat32DataAccess::getNextFileHandlerFromDir(FileHandler &dh) throw(
   //adjacent.
   while (true) {
     uint8_t dirEntryType;
-    dirEntryType = readDirEntry(dh, de);
+
+    try {
+      dirEntryType = readDirEntry(dh, de);
+    } catch (FileIOError &e) {
+      return -e.code().value();
+    }
+
+    if (DirEntryIsEnd == dirEntryType) {
+      return DirScanEnd;
+    }
+
 #ifdef DEBUG
     cout << "\x1b[7m";
     cout << "DirEntry Type: 0x" << hex << (int) dirEntryType << dec << endl;
@@ -772,8 +1419,9 @@ FileHandler Fat32DataAccess::getNextFileHandlerFromDir(FileHandler &dh) throw(
     }
   }
 
-  return buildFileHandler(de, leList, dh.getFstClus(),
-                          dh.getOffset() - sizeof(de), leOffsetList);
+  fh = buildFileHandler(de, leList, dh.getFstClus(),
+                        dh.getOffset() - sizeof(de), leOffsetList);
+  return DirScanOK;
 }
 FileHandler Fat32DataAccess::buildFileHandler(
     DirEntry &de, list<DirEntry> &leList, uint32_t dirClus, uint32_t dirOffset,
@@ -893,6 +1541,78 @@ FileHandler Fat32DataAccess::getRootHandler() throw()
 {
   return rootHandler;
 }
+/*
+ * Set dh up to iterate the directory fh refers to.
+ * The chain of a deleted directory is gone, so only its first cluster
+ * can be read, and only while no other file has claimed it.
+ * Returns ReadOK, ReadClusterOccupied or ReadBrokenFATChain.
+ */
+int Fat32DataAccess::openDir(FileHandler &fh, FileHandler &dh)
+throw(FileIOError)
+{
+  if (!fh.isDirectory()) {
+    throw logic_error("openDir: Not a directory");
+  }
+
+  if (fh.getFstClus() < 2 || fh.getFstClus() >= totClusCnt) {
+    return ReadBrokenFATChain;
+  }
+
+  if (fh.isDeleted() && !isFreeClus(getNextClus(fh.getFstClus()))) {
+    return ReadClusterOccupied;
+  }
+
+  dh = FileHandler(fh.getFstClus(), 0);
+  string name = fh.hasLongName() ? fh.getLongName() : fh.getShortName();
+
+  //The 0xE5 deletion mark is not text
+  if (fh.isDeleted() && !fh.hasLongName() && !name.empty()) {
+    name[0] = '?';
+  }
+
+  dh.setDirPath(fh.getDirPath() + name + "/");
+  return ReadOK;
+}
+/*
+ * The free clusters of the volume, as maximal runs of consecutive
+ * cluster numbers in ascending order.
+ */
+void Fat32DataAccess::getFreeRuns(vector<ClusterRun> &runs) throw(FileIOError)
+{
+  for (uint32_t clusNo = 2; clusNo < totClusCnt; ++clusNo) {
+    if (!isFreeClus(getNextClus(clusNo))) {
+      continue;
+    }
+
+    if (!runs.empty() && runs.back().fstClus + runs.back().len == clusNo) {
+      runs.back().len++;
+    } else {
+      ClusterRun run = { clusNo, 1 };
+      runs.push_back(run);
+    }
+  }
+}
+/*
+ * Read cnt clusters starting at clusNo, whatever the FAT says of them.
+ * May be called from several threads at once.
+ */
+void Fat32DataAccess::readClusters(uint32_t clusNo, uint32_t cnt,
+                                   void *buf) throw(FileIOError)
+{
+  if (0 == cnt) {
+    return;
+  }
+
+  if (clusNo < 2 || clusNo >= totClusCnt || cnt > totClusCnt - clusNo) {
+    throw logic_error("readClusters: Cluster index outof range");
+  }
+
+  vector<BlockDevice::IORequest> reqs(1);
+  reqs[0].buf = buf;
+  reqs[0].count = (size_t) cnt * bytsPerClus;
+  reqs[0].offset = getClusOffset(clusNo);
+  readRuns(reqs);
+}
 bool Fat32DataAccess::isFreeClus(uint32_t clusNo) throw()
 {
   if (FATFreeClus == clusNo) {
@@ -909,25 +1629,141 @@ bool Fat32DataAccess::isEOFClus(uint32_t clusNo) throw()
     return false;
   }
 }
-uint32_t Fat32DataAccess::getNextClus(uint32_t clusNo) throw()
+uint32_t Fat32DataAccess::getNextClus(uint32_t clusNo) throw(FileIOError)
 {
   if (clusNo < 2 || clusNo >= totClusCnt) {
     throw logic_error("getNextClus: Cluster index outof range");
   }
 
-  if (0 == fatMap.count(clusNo)) {
-    return FATFreeClus;
-  } else {
-    return fatMap[clusNo];
+  return readFATEntry(clusNo);
+}
+uint32_t Fat32DataAccess::readFATEntry(uint32_t idx) throw(FileIOError)
+{
+  if (!fatDirty.empty()) {
+    map<uint32_t, uint32_t>::iterator it = fatDirty.find(idx);
+
+    if (it != fatDirty.end()) {
+      return it->second & FATEntryMask;
+    }
+  }
+
+  try {
+    return le32toh(fatTable->get(idx)) & FATEntryMask;
+  } catch (LLIOError &e) {
+    throw FileIOError(e.code(), "Reading FAT table");
+  } catch (LLIOEOF &e) {
+    throw FileIOError(EIO, "Unexpected EOF when reading FAT table");
   }
 }
-uint32_t Fat32DataAccess::getClusOffset(uint32_t clusNo) throw()
+uintmax_t Fat32DataAccess::getClusOffset(uint32_t clusNo) throw()
 {
   if (clusNo < 2 || clusNo >= totClusCnt) {
     throw logic_error("getClusOffset: Cluster index outof range");
   } else {
-    return dataOffset + bytsPerClus * (clusNo - 2);
+    return dataOffset + (uintmax_t) bytsPerClus * (clusNo - 2);
+  }
+}
+static bool extentAfter(uint32_t fileClus, const FileHandler::Extent &ext)
+{
+  return fileClus < ext.fileClus;
+}
+/*
+ * Runs of physically contiguous clusters making up fh, built from the FAT
+ * on first use and cached in fh until the FAT changes.
+ * A deleted entry has no chain left, only its first cluster is known.
+ */
+const vector<FileHandler::Extent> &Fat32DataAccess::getExtents(
+  FileHandler &fh) throw(FileIOError)
+{
+  shared_ptr<vector<FileHandler::Extent> > ext = fh.getExtents(fatGen);
+
+  if (ext) {
+    return *ext;
+  }
+
+  ext.reset(new vector<FileHandler::Extent>);
+  uint32_t maxClus = totClusCnt;
+
+  if (fh.isDeleted() && assumeContiguous) {
+    //The chain is gone; the clusters are taken to follow each other
+    uint32_t clusCnt = (fh.getSize() + bytsPerClus - 1) / bytsPerClus;
+
+    if (fh.getFstClus() >= 2 && fh.getFstClus() < totClusCnt && clusCnt > 0 &&
+        clusCnt <= totClusCnt - fh.getFstClus()) {
+      FileHandler::Extent run = { 0, fh.getFstClus(), clusCnt };
+      ext->push_back(run);
+    }
+
+    fh.setExtents(ext, fatGen);
+    return *ext;
+  } else if (fh.isDeleted()) {
+    maxClus = 1;
+  } else if (!fh.isDirectory()) {
+    maxClus = (fh.getSize() + bytsPerClus - 1) / bytsPerClus;
+  }
+
+  uint32_t clusNo = fh.getFstClus();
+
+  for (uint32_t fileClus = 0; fileClus < maxClus; ++fileClus) {
+    if (clusNo < 2 || clusNo >= totClusCnt) {
+      break;
+    }
+
+    if (!ext->empty() && ext->back().fstClus + ext->back().len == clusNo) {
+      ext->back().len++;
+    } else {
+      FileHandler::Extent run = { fileClus, clusNo, 1 };
+      ext->push_back(run);
+    }
+
+    if (fileClus + 1 < maxClus) {
+      clusNo = getNextClus(clusNo);
+    }
+  }
+
+#ifdef DEBUG
+  cout << "\x1b[7m";
+  cout << "Extents of cluster " << fh.getFstClus() << ":";
+
+  for (vector<FileHandler::Extent>::iterator it = ext->begin();
+       it != ext->end(); ++it) {
+    cout << " " << it->fstClus << "+" << it->len;
+  }
+
+  cout << endl;
+  cout << "\x1b[0m";
+#endif //DEBUG
+  fh.setExtents(ext, fatGen);
+  return *ext;
+}
+/*
+ * Translate a byte offset in fh to a device offset.
+ * runBytes is the number of bytes from there to the end of the
+ * contiguous run. Returns false past the end of the cluster chain.
+ */
+bool Fat32DataAccess::mapOffset(FileHandler &fh, uint32_t offset,
+                                uintmax_t &devOffset,
+                                size_t &runBytes) throw(FileIOError)
+{
+  const vector<FileHandler::Extent> &ext = getExtents(fh);
+  uint32_t fileClus = offset / bytsPerClus;
+  vector<FileHandler::Extent>::const_iterator it =
+    upper_bound(ext.begin(), ext.end(), fileClus, extentAfter);
+
+  if (it == ext.begin()) {
+    return false;
   }
+
+  --it;
+
+  if (fileClus >= it->fileClus + it->len) {
+    return false;
+  }
+
+  uint32_t inClus = offset % bytsPerClus;
+  devOffset = getClusOffset(it->fstClus + (fileClus - it->fileClus)) + inClus;
+  runBytes = (size_t)(it->fileClus + it->len - fileClus) * bytsPerClus - inClus;
+  return true;
 }
 void Fat32DataAccess::setNextClus(uint32_t curClus,
                                   uint32_t nextClus) throw(FileIOError)
@@ -943,7 +1779,29 @@ void Fat32DataAccess::setNextClus(uint32_t curClus,
     throw logic_error("setNextClus: Cluster index outof range");
   }
 
-  fatMap[curClus] = nextClus;
+  if (curClus < totClusCnt + 2) {
+    uint32_t oldClus = readFATEntry(curClus);
+
+    if (-1 != allocClusCnt) {
+      if (isFreeClus(oldClus) && !isFreeClus(nextClus)) {
+        ++allocClusCnt;
+      } else if (!isFreeClus(oldClus) && isFreeClus(nextClus)) {
+        --allocClusCnt;
+      }
+    }
+
+    if (!fatBatching) {
+      fatTable->set(curClus, htole32(nextClus));
+    }
+
+    ++fatGen;
+  }
+
+  if (fatBatching) {
+    fatDirty[curClus] = nextClus;
+    return;
+  }
+
   vector<off_t> offsets;
   for (uint32_t i =0; i < numFATs; ++i ) {
     offsets.push_back(fatOffset + i * bytsPerFat + curClus * sizeof(uint32_t));
@@ -954,13 +1812,114 @@ void Fat32DataAccess::setNextClus(uint32_t curClus,
     while (!offsets.empty()) {
       off_t offset = offsets.back();
       offsets.pop_back();
-      LowLevelIO::xpwrite(deviceFd, &nextClusLE, sizeof(uint32_t), offset);
+      device->xpwrite(&nextClusLE, sizeof(uint32_t), offset);
     }
   } catch (LLIOError &e) {
     throw FileIOError(e.code(), "Writing FAT table");
   }
 }
 
+/*
+ * Collect FAT changes instead of writing them one entry at a time.
+ * Until commitFATBatch(), setNextClus() only records the new value and
+ * every lookup through this object sees it. Not to be used while another
+ * thread is reading the FAT.
+ */
+void Fat32DataAccess::beginFATBatch() throw()
+{
+  fatBatching = true;
+}
+/*
+ * Write every entry changed in the batch. Each FAT copy is patched in one
+ * pass of sorted writes, a run of adjacent dirty sectors at a time, and
+ * the device is synced once at the end.
+ */
+void Fat32DataAccess::commitFATBatch() throw(FileIOError)
+{
+  if (fatDirty.empty()) {
+    fatBatching = false;
+    return;
+  }
+
+  try {
+    writeFATEntries();
+    device->sync();
+  } catch (LLIOError &e) {
+    abortFATBatch();
+    throw FileIOError(e.code(), "Writing FAT table");
+  } catch (LLIOEOF &e) {
+    abortFATBatch();
+    throw FileIOError(EIO, "Unexpected EOF when writing FAT table");
+  }
+
+  fatBatching = false;
+
+  for (map<uint32_t, uint32_t>::iterator it = fatDirty.begin();
+       it != fatDirty.end(); ++it) {
+    if (it->first < totClusCnt + 2) {
+      fatTable->set(it->first, htole32(it->second));
+    }
+  }
+
+  fatDirty.clear();
+  ++fatGen;
+}
+void Fat32DataAccess::writeFATEntries() throw(LLIOError, LLIOEOF)
+{
+  vector<uint8_t> buf;
+
+  for (uint32_t fat = 0; fat < numFATs; ++fat) {
+    uintmax_t base = fatOffset + (uintmax_t) fat * bytsPerFat;
+    map<uint32_t, uint32_t>::iterator it = fatDirty.begin();
+
+    while (it != fatDirty.end()) {
+      uint32_t firstSec = it->first * sizeof(uint32_t) / bytsPerSec;
+      uint32_t lastSec = firstSec;
+      map<uint32_t, uint32_t>::iterator runEnd = it;
+
+      while (runEnd != fatDirty.end() &&
+             runEnd->first * sizeof(uint32_t) / bytsPerSec <= lastSec + 1) {
+        lastSec = runEnd->first * sizeof(uint32_t) / bytsPerSec;
+        ++runEnd;
+      }
+
+      size_t len = (size_t)(lastSec - firstSec + 1) * bytsPerSec;
+      uintmax_t runOffset = base + (uintmax_t) firstSec * bytsPerSec;
+      buf.resize(len);
+      device->xpread(buf.data(), len, runOffset);
+
+      for (; it != runEnd; ++it) {
+        uint32_t entryLE = htole32(it->second);
+        memcpy(&buf[it->first * sizeof(uint32_t) -
+                    (size_t) firstSec * bytsPerSec], &entryLE,
+               sizeof(entryLE));
+      }
+
+#ifdef DEBUG
+  cout << "\x1b[7m";
+      cout << "FAT " << fat << ": writing sectors " << firstSec << "-"
+           << lastSec << endl;
+  cout << "\x1b[0m";
+#endif //DEBUG
+      device->xpwrite(buf.data(), len, runOffset);
+    }
+  }
+}
+/*
+ * Forget the changes of the batch. After a failed commit some of them may
+ * be on the device already; lookups go back to the FAT as it was read.
+ */
+void Fat32DataAccess::abortFATBatch() throw()
+{
+  fatBatching = false;
+
+  if (!fatDirty.empty()) {
+    fatDirty.clear();
+    allocClusCnt = -1;
+    ++fatGen;
+  }
+}
+
 uint32_t Fat32DataAccess::getBytsPerSec() throw()
 {
   return (uint32_t) bytsPerSec;
@@ -981,12 +1940,107 @@ uint32_t Fat32DataAccess::getTotClusCnt() throw()
 {
   return totClusCnt;
 }
-uint32_t Fat32DataAccess::getFreeClusCnt() throw()
+uint32_t Fat32DataAccess::getBytsPerClus() throw()
+{
+  return bytsPerClus;
+}
+uint32_t Fat32DataAccess::getVolID() throw()
+{
+  return volID;
+}
+/*
+ * Feed the entries of the first FAT to d, as they are on the device.
+ */
+void Fat32DataAccess::digestFAT(Digest &d) throw(FileIOError)
+{
+  const size_t window = 1 << 20;
+  uintmax_t len = (uintmax_t)(totClusCnt + 2) * sizeof(uint32_t);
+
+  if (len > bytsPerFat) {
+    len = bytsPerFat;
+  }
+
+  unique_ptr<uint8_t[]> buf(new uint8_t[window]);
+  vector<BlockDevice::IORequest> reqs(1);
+
+  for (uintmax_t done = 0; done < len;) {
+    reqs[0].buf = buf.get();
+    reqs[0].count = len - done < window ? len - done : window;
+    reqs[0].offset = fatOffset + done;
+    readRuns(reqs);
+    d.update(buf.get(), reqs[0].count);
+    done += reqs[0].count;
+  }
+}
+/*
+ * Give fh extents known to match the FAT as it is now, from an index,
+ * so they need not be rebuilt from the FAT.
+ */
+void Fat32DataAccess::seedExtents(FileHandler &fh,
+                                  shared_ptr<vector<FileHandler::Extent> > ext)
+throw()
+{
+  fh.setExtents(ext, fatGen);
+}
+/*
+ * Whether the volume differs from what was there when it was opened:
+ * something was written or a journal commit rolled back.
+ */
+bool Fat32DataAccess::isModified() throw()
+{
+  return 1 != dataGen || 1 != fatGen || rolledBack > 0;
+}
+uint32_t Fat32DataAccess::getFreeClusCnt() throw(FileIOError)
+{
+  return totClusCnt - getAllocClusCnt();
+}
+/*
+ * Journal writes undone while opening, with DeviceOptions::rollback.
+ */
+size_t Fat32DataAccess::getRolledBack() throw()
+{
+  return rolledBack;
+}
+/*
+ * Hits and misses of the cluster cache so far; false without -c.
+ */
+bool Fat32DataAccess::getCacheStats(uint64_t &hits,
+                                    uint64_t &misses) throw()
 {
-  return totClusCnt - fatMap.size() + 2;
+  if (NULL == cache) {
+    return false;
+  }
+
+  hits = cache->getHits();
+  misses = cache->getMisses();
+  return true;
 }
-uint32_t Fat32DataAccess::getAllocClusCnt() throw()
+uint32_t Fat32DataAccess::getAllocClusCnt() throw(FileIOError)
 {
-  return fatMap.size() - 2;
+  if (-1 == allocClusCnt) {
+    countFATEntries();
+  }
+
+  return (uint32_t) allocClusCnt;
 }
 
+
+DirIterator::DirIterator(Fat32DataAccess &da, const FileHandler &dir) throw()
+  : fat32DA(da), dh(dir), status(Fat32DataAccess::DirScanOK) {}
+bool DirIterator::next(FileHandler &fh) throw()
+{
+  if (Fat32DataAccess::DirScanOK != status) {
+    return false;
+  }
+
+  status = fat32DA.nextFileHandlerFromDir(dh, fh);
+  return Fat32DataAccess::DirScanOK == status;
+}
+int DirIterator::getStatus() throw()
+{
+  return status;
+}
+FileHandler &DirIterator::getDirHandler() throw()
+{
+  return dh;
+}
@@ -3,10 +3,17 @@
 
 #include <stdint.h>
 #include <system_error>
-#include <map>
 #include <list>
+#include <vector>
+#include <map>
 #include <memory>
+#include "FatTable.hpp"
+#include "BlockDevice.hpp"
 using namespace std;
+class JournaledBlockDevice;
+class CachedBlockDevice;
+class Digest;
+
 class FileIOError : public system_error
 {
 public:
@@ -32,6 +39,20 @@ public:
 };
 class FileHandler
 {
+public:
+  struct Extent {
+    uint32_t fileClus; //Index of the first cluster of the run in the file
+    uint32_t fstClus;  //First cluster of the run on the volume
+    uint32_t len;      //Number of contiguous clusters in the run
+  };
+  struct DirBuffer {
+    uintmax_t devOffset; //Device offset of bytes[0]
+    uint32_t gen;        //Write generation the data was read at
+    const uint8_t *bytes; //data.data(), or a pointer into the device view
+    size_t len;
+    vector<uint8_t> data;
+  };
+
 private:
   string shortName;
   string longName;
@@ -43,6 +64,11 @@ private:
   uint32_t dirClus;
   uint32_t dirOffset;
   list<uint32_t> dirLFNOffsets;
+  shared_ptr<vector<Extent> > extents; //Built lazily by Fat32DataAccess
+  uint32_t extentsGen;
+  shared_ptr<DirBuffer> dirBuffer;     //Directory clusters being iterated
+  string dirPath;                      //Path of the parent directory
+  bool inDelDir;                       //Parent directory is deleted
 
 public:
   static const uint8_t FileIsDir;
@@ -63,12 +89,43 @@ public:
   uint32_t getDirClus();
   uint32_t getDirOffset();
   const list<uint32_t> &getDirLFNOffsets();
+  shared_ptr<vector<Extent> > getExtents(uint32_t gen);
+  void setExtents(shared_ptr<vector<Extent> > ext, uint32_t gen);
+  shared_ptr<DirBuffer> getDirBuffer();
+  string getDirPath();
+  void setDirPath(const string &path);
+  bool isInDeletedDir();
+  void setInDeletedDir(bool inDel);
+  void setDirBuffer(shared_ptr<DirBuffer> buf);
   string toString();
 };
 
+/*
+ * How a volume is opened, set from the command line.
+ */
+struct DeviceOptions {
+  string backend; //See BlockDevice::open()
+  bool readOnly;  //Open O_RDONLY; with pread or mmap and no cache, read
+                  //through a mapping of the device
+  uint32_t cacheClusters; //Clusters kept by CachedBlockDevice, 0 for none
+  bool writeBack;         //Cache writes until eviction instead of writing through
+  bool direct;            //Open O_DIRECT, bypassing the page cache
+  string journal;         //Write-ahead journal file, empty for none
+  bool rollback;          //Undo the journal's last commit when opening
+  bool contiguous;        //Assume deleted files were stored in one run
+
+  DeviceOptions();
+};
+
 class Fat32DataAccess
 {
 
+public:
+  struct ClusterRun {
+    uint32_t fstClus;
+    uint32_t len;
+  };
+
 private:
   struct BootSector {
     uint8_t BS_jmpBoot[3];
@@ -140,15 +197,27 @@ private:
     } __attribute__((__packed__)) raw;
   };
   void readBootSector(BootSector &bootSector) throw(FileIOError);
+  void checkBootSector(const BootSector &bootSector) throw(FileIOError);
   void readFAT() throw(FileIOError);
-  uint8_t readDirEntry(FileHandler &dh, DirEntry &de) throw(FileIOError,
-      NoMoreData);
-  uint32_t getNextClus(uint32_t clusNo) throw();
-  uint32_t getClusOffset(uint32_t clusNo) throw();
+  void countFATEntries() throw(FileIOError);
+  uint8_t readDirEntry(FileHandler &dh, DirEntry &de) throw(FileIOError);
+  uint32_t getNextClus(uint32_t clusNo) throw(FileIOError);
+  uint32_t readFATEntry(uint32_t idx) throw(FileIOError);
+  int getRunStatus(FileHandler &fh) throw(FileIOError);
+  int getRunStatus(FileHandler &fh, uint32_t fromClus,
+                   uint32_t cnt) throw(FileIOError);
+  void restoreEntry(FileHandler &fh, char name0,
+                    bool recoverLFN) throw(FileIOError);
+  void writeChain(const vector<ClusterRun> &runs) throw(FileIOError);
+  void commitRecovery() throw(FileIOError);
+  uintmax_t getClusOffset(uint32_t clusNo) throw();
+  bool mapOffset(FileHandler &fh, uint32_t offset, uintmax_t &devOffset,
+                 size_t &runBytes) throw(FileIOError);
   bool isFreeClus(uint32_t clusNo) throw();
   bool isEOFClus(uint32_t clusNo) throw();
 
   void setNextClus(uint32_t curClus, uint32_t nextClus) throw(FileIOError);
+  void writeFATEntries() throw(LLIOError, LLIOEOF);
 
   FileHandler buildFileHandler(DirEntry &de, list<DirEntry> &leList,
                                uint32_t dirClus, uint32_t dirOffset,
@@ -157,8 +226,18 @@ private:
   string getLongNameSegLFN(DirEntry &le) throw();
   ssize_t fs32write(FileHandler &fh, void *buf,
                     size_t count) throw(FileIOError);
+  size_t planRead(FileHandler &fh, void *buf, size_t count,
+                  vector<BlockDevice::IORequest> &reqs)
+  throw(FileIOError, ClusterOccupied, BrokenFATChain);
+  void readRuns(vector<BlockDevice::IORequest> &reqs) throw(FileIOError);
+  void adviseView(uintmax_t offset, uintmax_t len, int advice) throw();
 
-  int deviceFd;
+  unique_ptr<BlockDevice> device;
+  JournaledBlockDevice *journal; //Inside device; NULL without a journal
+  CachedBlockDevice *cache;      //Device itself with -c, NULL without
+  size_t rolledBack;
+  const uint8_t *view;      //Whole device, mapped read-only; NULL if unused
+  uintmax_t viewLen;
   bool isLittleEndian;
   uintmax_t fatOffset;
   uintmax_t bytsPerFat;
@@ -166,7 +245,13 @@ private:
   uint32_t totSecCnt;
   uint32_t totClusCnt;
   uint32_t maxDirEntryPerClus;
-  map<uint32_t, uint32_t> fatMap;
+  unique_ptr<FatTable> fatTable;
+  int64_t allocClusCnt;     //-1 until counted
+  uint32_t fatGen;          //Bumped on every FAT change
+  bool fatBatching;         //Between beginFATBatch() and commit or abort
+  map<uint32_t, uint32_t> fatDirty; //Entries set in the batch, not yet written
+  uint32_t dataGen;         //Bumped on every write through fs32write
+  bool assumeContiguous;    //Deleted files occupy getFstClus() onwards
   FileHandler rootHandler;
   uint32_t rootClusNo;
 
@@ -175,8 +260,16 @@ private:
   uint32_t secPerClus;
   uint32_t numFATs;
   uint32_t rsvdSecCnt;
+  uint32_t volID;
 
 public:
+  struct BatchRead {
+    FileHandler *fh;
+    void *buf;
+    size_t count;
+    ssize_t ret;   //Bytes read, as fs32read() would return
+  };
+
   static const uint32_t FATEOFClus;
   static const uint32_t FATEntryMask;
   static const uint32_t FATFreeClus;
@@ -193,23 +286,55 @@ public:
   static const uint8_t DirEntryIsDeleted;
   static const uint8_t DirEntryIsLFN;
   static const uint8_t DirEntryIsSFN;
+  static const uint8_t DirEntryIsEnd;
+
+  static const int DirScanOK;
+  static const int DirScanEnd;
+
+  static const int ReadOK;
+  static const int ReadClusterOccupied;
+  static const int ReadBrokenFATChain;
 
-  Fat32DataAccess(const string &devName)
+  static const uint32_t DirReadMax;
+
+  Fat32DataAccess(const string &devName,
+                  const DeviceOptions &opts = DeviceOptions())
   throw(FileIOError);
   ~Fat32DataAccess() throw();
 
+  int getReadStatus(FileHandler &fh) throw(FileIOError);
   ssize_t fs32read(FileHandler &fh, void *buf,
                    size_t count) throw(FileIOError, ClusterOccupied,
                                        BrokenFATChain);
+  void fs32readBatch(vector<BatchRead> &reads) throw(FileIOError,
+      ClusterOccupied, BrokenFATChain);
+  void prefetchDirs(vector<FileHandler> &dirs) throw(FileIOError);
+
+  void beginFATBatch() throw();
+  void commitFATBatch() throw(FileIOError);
+  void abortFATBatch() throw();
 
   //Milestone 4-6:
-  void recover(FileHandler &fh, char name0, bool recoverLFN) throw(ClusterOccupied,
-      BrokenFATChain);
+  void recover(FileHandler &fh, char name0, bool recoverLFN) throw(FileIOError,
+      ClusterOccupied, BrokenFATChain);
+  void recoverFragments(FileHandler &fh, char name0, bool recoverLFN,
+                        const vector<ClusterRun> &runs)
+  throw(FileIOError, ClusterOccupied, BrokenFATChain);
+  size_t getRolledBack() throw();
+  bool getCacheStats(uint64_t &hits, uint64_t &misses) throw();
+
+  int openDir(FileHandler &fh, FileHandler &dh) throw(FileIOError);
+
+  //Carving:
+  void getFreeRuns(vector<ClusterRun> &runs) throw(FileIOError);
+  void readClusters(uint32_t clusNo, uint32_t cnt,
+                    void *buf) throw(FileIOError);
 
   //Milestone 3:
   FileHandler getRootHandler() throw();
   FileHandler getNextFileHandlerFromDir(FileHandler &dh) throw(FileIOError,
       NoMoreData);
+  int nextFileHandlerFromDir(FileHandler &dh, FileHandler &fh) throw();
 
   //Milestone 2:
   uint32_t getBytsPerSec() throw();
@@ -217,7 +342,34 @@ public:
   uint32_t getRsvdSecCnt() throw();
   uint32_t getNumFATs() throw();
   uint32_t getTotClusCnt() throw();
-  uint32_t getFreeClusCnt() throw();
-  uint32_t getAllocClusCnt() throw();
+  uint32_t getBytsPerClus() throw();
+  uint32_t getVolID() throw();
+  void digestFAT(Digest &d) throw(FileIOError);
+  const vector<FileHandler::Extent> &getExtents(FileHandler &fh)
+  throw(FileIOError);
+  void seedExtents(FileHandler &fh,
+                   shared_ptr<vector<FileHandler::Extent> > ext) throw();
+  bool isModified() throw();
+  uint32_t getFreeClusCnt() throw(FileIOError);
+  uint32_t getAllocClusCnt() throw(FileIOError);
+};
+/*
+ * Exception-free iteration over one directory:
+ *   DirIterator it(fat32DA, dirHandler);
+ *   while (it.next(fh)) { ... }
+ * Afterwards getStatus() is DirScanEnd, or -errno if the device failed.
+ */
+class DirIterator
+{
+private:
+  Fat32DataAccess &fat32DA;
+  FileHandler dh;
+  int status;
+
+public:
+  DirIterator(Fat32DataAccess &da, const FileHandler &dir) throw();
+  bool next(FileHandler &fh) throw();
+  int getStatus() throw();
+  FileHandler &getDirHandler() throw();
 };
 #endif // FAT32DATAACCESS_HPP
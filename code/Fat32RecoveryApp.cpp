@@ -1,12 +1,26 @@
 #include <string>
 #include <stdexcept>
 #include <iostream>
+#include <cstdlib>
+#include <memory>
+#include <vector>
 #include "Fat32Action.hpp"
+#include "ThreadPool.hpp"
+#include "BlockDevice.hpp"
 #include "PrintBootSectorInfo.hpp"
 #include "ListAllDirectoryEntry.hpp"
 #include "FileRecovery83.hpp"
 #include "FileRecovery83WithMD5.hpp"
 #include "FileRecoveryLong.hpp"
+#include "JournalRollback.hpp"
+#include "BatchRecovery.hpp"
+#include "FileCarver.hpp"
+#include "FragmentedRecovery.hpp"
+#include "KnownFileScan.hpp"
+#include "ClusterIndexBuilder.hpp"
+#include "ClusterIndexQuery.hpp"
+#include "RecoveryServer.hpp"
+#include "Digest.hpp"
 #include "Fat32RecoveryApp.hpp"
 
 using namespace std;
@@ -35,12 +49,30 @@ throw (InvalidArgumentError, FileIOError)
   string deviceName;
   string targetName;
   string md5String;
+  string manifestName;
+  string hashSetName;
+  string indexName;
+  string queryName;
+  string metaIndexName;
+  string sockName;
+  string algorithm = "md5";
   bool has_d = false;
   bool has_i = false;
   bool has_l = false;
   bool has_r = false;
   bool has_m = false;
   bool has_R = false;
+  bool has_a = false;
+  bool has_u = false;
+  bool has_M = false;
+  bool has_k = false;
+  bool has_F = false;
+  bool has_K = false;
+  bool has_X = false;
+  bool has_Q = false;
+  bool has_S = false;
+  uint32_t threadCnt = ThreadPool::defaultThreadCnt();
+  DeviceOptions devOpts;
 
   for (int i = 1; i < argc; i++) {
     string argcur = argv[i];
@@ -55,21 +87,24 @@ throw (InvalidArgumentError, FileIOError)
         throw InvalidArgumentError("around -d");
       }
     } else if (argcur == "-i") {
-      if (!has_i && !has_l && !has_r && !has_m && !has_R) {
+      if (!has_i && !has_l && !has_r && !has_m && !has_R && !has_u && !has_M &&
+          !has_k && !has_K && !has_X && !has_S) {
         has_i = true;
       } else {
         printUsage();
         throw InvalidArgumentError("around -i");
       }
     } else if (argcur == "-l") {
-      if (!has_l && !has_i && !has_r && !has_m && !has_R) {
+      if (!has_l && !has_i && !has_r && !has_m && !has_R && !has_u && !has_M &&
+          !has_k && !has_K && !has_X && !has_S) {
         has_l = true;
       } else {
         printUsage();
         throw InvalidArgumentError("around -l");
       }
     } else if (argcur == "-r") {
-      if ( !has_r && !has_l && !has_i && !has_R && i + 1 < argc) {
+      if ( !has_r && !has_l && !has_i && !has_R && !has_u && !has_M && !has_k &&
+           !has_K && !has_X && !has_S && i + 1 < argc) {
         i++;
         targetName = argv[i];
         has_r = true;
@@ -78,7 +113,8 @@ throw (InvalidArgumentError, FileIOError)
         throw InvalidArgumentError("around -r");
       }
     } else if (argcur == "-m") {
-      if ( !has_m && !has_l && !has_i && !has_R && i + 1 < argc) {
+      if ( !has_m && !has_l && !has_i && !has_R && !has_u && !has_M && !has_k &&
+           !has_K && !has_X && !has_S && i + 1 < argc) {
         i++;
         md5String = argv[i];
         has_m = true;
@@ -87,7 +123,8 @@ throw (InvalidArgumentError, FileIOError)
         throw InvalidArgumentError("around -m");
       }
     } else if (argcur == "-R") {
-      if ( !has_R && !has_i && !has_r && !has_l && !has_m && i + 1 < argc) {
+      if ( !has_R && !has_i && !has_r && !has_l && !has_m && !has_u && !has_M &&
+           !has_k && !has_K && !has_X && !has_S && i + 1 < argc) {
         i++;
         targetName = argv[i];
         has_R = true;
@@ -95,17 +132,180 @@ throw (InvalidArgumentError, FileIOError)
         printUsage();
         throw InvalidArgumentError("-R");
       }
+    } else if (argcur == "-M") {
+      if (!has_M && !has_i && !has_l && !has_r && !has_m && !has_R && !has_u &&
+          !has_k && !has_K && !has_X && !has_S && i + 1 < argc) {
+        i++;
+        manifestName = argv[i];
+        has_M = true;
+      } else {
+        printUsage();
+        throw InvalidArgumentError("around -M");
+      }
+    } else if (argcur == "-k") {
+      if (!has_k && !has_i && !has_l && !has_r && !has_m && !has_R && !has_u &&
+          !has_M && !has_K && !has_X && !has_S) {
+        has_k = true;
+      } else {
+        printUsage();
+        throw InvalidArgumentError("around -k");
+      }
+    } else if (argcur == "-K") {
+      if (!has_K && !has_i && !has_l && !has_r && !has_m && !has_R && !has_u &&
+          !has_M && !has_k && !has_X && !has_S && i + 1 < argc) {
+        i++;
+        hashSetName = argv[i];
+        has_K = true;
+      } else {
+        printUsage();
+        throw InvalidArgumentError("around -K");
+      }
+    } else if (argcur == "-X") {
+      if (!has_X && !has_i && !has_l && !has_r && !has_m && !has_R && !has_u &&
+          !has_M && !has_k && !has_K && !has_S && i + 1 < argc) {
+        i++;
+        indexName = argv[i];
+        has_X = true;
+      } else {
+        printUsage();
+        throw InvalidArgumentError("around -X");
+      }
+    } else if (argcur == "-S") {
+      if (!has_S && !has_i && !has_l && !has_r && !has_m && !has_R && !has_u &&
+          !has_M && !has_k && !has_K && !has_X && i + 1 < argc) {
+        i++;
+        sockName = argv[i];
+        has_S = true;
+      } else {
+        printUsage();
+        throw InvalidArgumentError("around -S");
+      }
+    } else if (argcur == "-Q") {
+      if (!has_Q && i + 1 < argc) {
+        i++;
+        queryName = argv[i];
+        has_Q = true;
+      } else {
+        printUsage();
+        throw InvalidArgumentError("around -Q");
+      }
+    } else if (argcur == "-H") {
+      if (i + 1 < argc && Digest::isAlgorithm(argv[i + 1])) {
+        i++;
+        algorithm = argv[i];
+      } else {
+        printUsage();
+        throw InvalidArgumentError("around -H");
+      }
+    } else if (argcur == "-a") {
+      if (!has_a) {
+        has_a = true;
+      } else {
+        printUsage();
+        throw InvalidArgumentError("around -a");
+      }
+    } else if (argcur == "-b") {
+      if (i + 1 < argc && BlockDevice::isBackend(argv[i + 1])) {
+        i++;
+        devOpts.backend = argv[i];
+      } else {
+        printUsage();
+        throw InvalidArgumentError("around -b");
+      }
+    } else if (argcur == "-c") {
+      if (i + 1 < argc && atoi(argv[i + 1]) > 0) {
+        i++;
+        devOpts.cacheClusters = atoi(argv[i]);
+      } else {
+        printUsage();
+        throw InvalidArgumentError("around -c");
+      }
+    } else if (argcur == "-w") {
+      devOpts.writeBack = true;
+    } else if (argcur == "-D") {
+      devOpts.direct = true;
+    } else if (argcur == "-C") {
+      devOpts.contiguous = true;
+    } else if (argcur == "-F") {
+      has_F = true;
+    } else if (argcur == "-I") {
+      if (i + 1 < argc) {
+        i++;
+        metaIndexName = argv[i];
+      } else {
+        printUsage();
+        throw InvalidArgumentError("around -I");
+      }
+    } else if (argcur == "-J") {
+      if (i + 1 < argc) {
+        i++;
+        devOpts.journal = argv[i];
+      } else {
+        printUsage();
+        throw InvalidArgumentError("around -J");
+      }
+    } else if (argcur == "-u") {
+      if (!has_u && !has_i && !has_l && !has_r && !has_m && !has_R &&
+          !has_M && !has_k && !has_K && !has_X && !has_S) {
+        has_u = true;
+      } else {
+        printUsage();
+        throw InvalidArgumentError("around -u");
+      }
+    } else if (argcur == "-j") {
+      if (i + 1 < argc && atoi(argv[i + 1]) > 0) {
+        i++;
+        threadCnt = atoi(argv[i]);
+      } else {
+        printUsage();
+        throw InvalidArgumentError("around -j");
+      }
     } else {
       printUsage();
       throw InvalidArgumentError("Invalid option: "+argcur);
     }
   }
 
-  if ( !has_d || !( has_i || has_l || has_r || has_R) ) {
+  if ( !has_d || !( has_i || has_l || has_r || has_R || has_u ||
+                   has_M || has_k || has_K || has_X || has_S) ) {
     printUsage();
     throw InvalidArgumentError("Device or action not specified");
   }
 
+  if (has_F && !has_r) {
+    printUsage();
+    throw InvalidArgumentError("-F needs a file given with -r");
+  }
+
+  if (has_m) {
+    unique_ptr<Digest> d(Digest::create(algorithm));
+    vector<uint8_t> bytes;
+
+    if (!Digest::fromHex(md5String, bytes) || bytes.size() != d->getSize()) {
+      printUsage();
+      throw InvalidArgumentError("-m needs a " + string(d->getName()) +
+                                 " digest in hex");
+    }
+
+    //Digests are compared in lowercase
+    md5String = Digest::toHex(&bytes[0], bytes.size());
+  }
+
+  if (has_Q && !has_X) {
+    printUsage();
+    throw InvalidArgumentError("-Q needs an index given with -X");
+  }
+
+  if (has_u && devOpts.journal.empty()) {
+    printUsage();
+    throw InvalidArgumentError("-u needs a journal given with -J");
+  }
+
+  if (devOpts.direct && !BlockDevice::supportsDirect(devOpts.backend)) {
+    printUsage();
+    throw InvalidArgumentError("-D needs the pread or uring backend");
+  }
+
 #ifdef DEBUG
   cout << "\x1b[7m";
   cout << "-d :" << has_d
@@ -113,24 +313,71 @@ throw (InvalidArgumentError, FileIOError)
       << " | -i: " << has_i
       << " | -l: " << has_l
       << " | -m: " << has_m
-      << " | md5: " << md5String
+      << " | digest: " << md5String
+      << " | algorithm: " << algorithm
       << " | -r: " << has_r
       << " | -R: " << has_R
+      << " | -a: " << has_a
+      << " | threads: " << threadCnt
+      << " | backend: " << devOpts.backend
+      << " | read-only: " << (has_i || has_l)
+      << " | cache: " << devOpts.cacheClusters
+      << (devOpts.writeBack ? " write-back" : " write-through")
+      << " | direct: " << devOpts.direct
+      << " | contiguous: " << devOpts.contiguous
+      << " | fragmented: " << has_F
+      << " | journal: " << devOpts.journal
+      << " | -u: " << has_u
+      << " | -M: " << manifestName
+      << " | -k: " << has_k
+      << " | -K: " << hashSetName
+      << " | -X: " << indexName
+      << " | -Q: " << queryName
+      << " | -I: " << metaIndexName
+      << " | -S: " << sockName
       << " | targetName: " << targetName << endl;
   cout << "\x1b[0m";
 #endif //DEBUG
 
+  //Listing and printing never write to the volume, but a journal may
+  //have a commit to replay
+  devOpts.readOnly = (has_i || has_l || has_k || has_K || has_X) &&
+                     devOpts.journal.empty();
+  devOpts.rollback = has_u;
+
   if (has_i) {
-    action = new PrintBootSectorInfo(deviceName);
+    action = new PrintBootSectorInfo(deviceName, devOpts);
   } else if (has_l) {
-    action = new ListAllDirectoryEntry(deviceName);
+    action = new ListAllDirectoryEntry(deviceName, devOpts);
+  } else if (has_r && has_F) {
+    action = new FragmentedRecovery(deviceName, devOpts, targetName,
+                                    md5String, algorithm);
   } else if (has_r && !has_m) {
-    action = new FileRecovery83(deviceName, targetName);
+    action = new FileRecovery83(deviceName, devOpts, targetName);
   } else if (has_r && has_m) {
-    action = new FileRecovery83WithMD5(deviceName, targetName, md5String);
+    action = new FileRecovery83WithMD5(deviceName, devOpts, targetName,
+                                       md5String, algorithm);
   } else if (has_R) {
-    action = new FileRecoveryLong(deviceName, targetName);
+    action = new FileRecoveryLong(deviceName, devOpts, targetName);
+  } else if (has_u) {
+    action = new JournalRollback(deviceName, devOpts);
+  } else if (has_M) {
+    action = new BatchRecovery(deviceName, devOpts, manifestName, algorithm);
+  } else if (has_k) {
+    action = new FileCarver(deviceName, devOpts);
+  } else if (has_K) {
+    action = new KnownFileScan(deviceName, devOpts, hashSetName, algorithm);
+  } else if (has_X && has_Q) {
+    action = new ClusterIndexQuery(deviceName, devOpts, indexName, queryName);
+  } else if (has_X) {
+    action = new ClusterIndexBuilder(deviceName, devOpts, indexName,
+                                     algorithm);
+  } else if (has_S) {
+    action = new RecoveryServer(deviceName, devOpts, sockName);
   }
+
+  action->setTraversal(has_a, threadCnt);
+  action->setIndex(metaIndexName);
 }
 void Fat32RecoveryApp::
 run() throw(FileIOError)
@@ -145,6 +392,8 @@ run() throw(FileIOError)
   } catch (Fat32ActionError &e) {
     cout << e.what() << endl;
   }
+
+  action->printCacheStats();
 }
 void Fat32RecoveryApp::printUsage() throw() {
   try {
@@ -152,8 +401,51 @@ void Fat32RecoveryApp::printUsage() throw() {
          << endl;
     cout << "-i                    Print boot sector information" << endl;
     cout << "-l                    List all the directory entries" << endl;
-    cout << "-r filename [-m md5]  File recovery with 8.3 filename" << endl;
+    cout << "-r filename [-m hash] File recovery with 8.3 filename" << endl;
+    cout << "-F                    With -r, search free clusters for a file split"
+         << endl;
+    cout << "                      in two fragments" << endl;
     cout << "-R filename           File recovery with long filename" << endl;
+    cout << "-M manifest           Recover every file listed, one name and"
+         << endl;
+    cout << "                      optional digest per line" << endl;
+    cout << "-K hashfile           List deleted files whose digest is in hashfile"
+         << endl;
+    cout << "-X index [-Q files]   Hash every free cluster into index, or look up"
+         << endl;
+    cout << "                      the blocks of the files listed in files there"
+         << endl;
+    cout << "-S socket             Serve listing, reads and recovery of this and"
+         << endl;
+    cout << "                      other volumes on a Unix domain socket" << endl;
+    cout << "-H algorithm          Digest to use: md5 (default), sha1, sha256,"
+         << endl;
+    cout << "                      blake3 or xxh3" << endl;
+    cout << "-k                    List files carved out of free clusters"
+         << endl;
+    cout << "-a                    Search all directories, not just the root"
+         << endl;
+    cout << "-j threads            Worker threads for -a, -I, -k, -X, -F"
+         << endl;
+    cout << "                      and -S" << endl;
+    cout << "-b backend            Device access: pread (default), mmap, memory"
+         << endl;
+    cout << "                      or uring" << endl;
+    cout << "-c clusters           Cache this many clusters of the data area"
+         << endl;
+    cout << "-w                    Write back cached clusters (with -c)" << endl;
+    cout << "-D                    Open the device O_DIRECT (pread or uring)"
+         << endl;
+    cout << "-C                    Take deleted files to be stored contiguously"
+         << endl;
+    cout << "-I index              Keep directory entries in index, rebuilt when"
+         << endl;
+    cout << "                      the FAT changes, instead of scanning each run"
+         << endl;
+    cout << "-J journal            Commit changes through a write-ahead journal"
+         << endl;
+    cout << "-u                    Roll back the last commit in the journal"
+         << endl;
   }
   catch (...) {
   }
@@ -0,0 +1,204 @@
+#include <sys/types.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <endian.h>
+#include <string.h>
+#include <vector>
+#include <memory>
+#include <mutex>
+#ifdef DEBUG
+#include <iostream>
+#endif
+#include "LowLevelIO.hpp"
+#include "BlockDevice.hpp"
+#include "FatTable.hpp"
+using namespace std;
+
+const uint32_t FatTable::ChunkShift = 16;     //256KiB of entries per chunk
+const uint32_t FatTable::EntriesPerChunk = 1 << FatTable::ChunkShift;
+const uint32_t FatTable::DefaultMaxChunks = 64;
+
+FatTable::FatTable(BlockDevice &dev, uintmax_t offset, uintmax_t size,
+                   uint32_t cnt, uint32_t maxResident) throw()
+  : device(dev),
+    fatOffset(offset),
+    bytsPerFat(size),
+    entryCnt(cnt),
+    maxChunks(maxResident > 0 ? maxResident : 1),
+    chunks((cnt + EntriesPerChunk - 1) >> ChunkShift),
+    clockHand(0)
+{
+  for (vector<Chunk>::iterator it = chunks.begin(); it != chunks.end(); ++it) {
+    it->entries = NULL;
+    it->mapping = NULL;
+    it->mappingLen = 0;
+    it->referenced = false;
+  }
+}
+FatTable::~FatTable() throw()
+{
+  for (vector<Chunk>::iterator it = chunks.begin(); it != chunks.end(); ++it) {
+    releaseChunk(*it);
+  }
+}
+uint32_t *FatTable::loadChunk(uint32_t chunkNo) throw(LLIOError, LLIOEOF)
+{
+  if (resident.size() >= maxChunks) {
+    evictChunk();
+  }
+
+  Chunk &chunk = chunks[chunkNo];
+  uintmax_t chunkOffset = fatOffset + (uintmax_t) chunkNo * EntriesPerChunk *
+                          sizeof(uint32_t);
+  size_t chunkLen = EntriesPerChunk * sizeof(uint32_t);
+  uint32_t used = entryCnt - chunkNo * EntriesPerChunk;
+  size_t usedLen = (used < EntriesPerChunk ? used : EntriesPerChunk) *
+                   sizeof(uint32_t);
+
+  if (chunkOffset >= fatOffset + bytsPerFat) {
+    chunkLen = 0;
+  } else if (chunkOffset + chunkLen > fatOffset + bytsPerFat) {
+    chunkLen = fatOffset + bytsPerFat - chunkOffset;
+  }
+
+  //A FAT too short for its entries is read, the rest reading as free
+  chunk.mapping = chunkLen >= usedLen ? device.map(chunkOffset, chunkLen) :
+                  NULL;
+
+  if (NULL != chunk.mapping) {
+    chunk.mappingLen = chunkLen;
+    chunk.entries = (uint32_t *) chunk.mapping;
+  } else {
+    chunk.buf.reset(new uint32_t[EntriesPerChunk]);
+    memset(chunk.buf.get(), 0, EntriesPerChunk * sizeof(uint32_t));
+
+    if (chunkLen > 0) {
+      device.xpread(chunk.buf.get(), chunkLen, chunkOffset);
+    }
+
+    chunk.entries = chunk.buf.get();
+  }
+
+#ifdef DEBUG
+  cout << "\x1b[7m";
+  cout << "Loaded FAT chunk " << chunkNo << ", " << chunkLen << " bytes"
+       << (NULL == chunk.mapping ? " (read)" : " (mapped)") << endl;
+  cout << "\x1b[0m";
+#endif //DEBUG
+  chunk.referenced = true;
+  resident.push_back(chunkNo);
+  return chunk.entries;
+}
+uint32_t FatTable::get(uint32_t idx) throw(LLIOError, LLIOEOF)
+{
+  lock_guard<mutex> guard(lock);
+  Chunk &chunk = chunks[idx >> ChunkShift];
+
+  if (NULL == chunk.entries) {
+    loadChunk(idx >> ChunkShift);
+  }
+
+  chunk.referenced = true;
+  return chunk.entries[idx & (EntriesPerChunk - 1)];
+}
+/*
+ * Second-chance eviction: skip chunks referenced since the hand last
+ * passed them, drop the first one that was not.
+ */
+void FatTable::evictChunk() throw()
+{
+  while (true) {
+    if (clockHand >= resident.size()) {
+      clockHand = 0;
+    }
+
+    Chunk &chunk = chunks[resident[clockHand]];
+
+    if (chunk.referenced) {
+      chunk.referenced = false;
+      ++clockHand;
+    } else {
+#ifdef DEBUG
+      cout << "\x1b[7m";
+      cout << "Evicting FAT chunk " << resident[clockHand] << endl;
+      cout << "\x1b[0m";
+#endif //DEBUG
+      releaseChunk(chunk);
+      resident[clockHand] = resident.back();
+      resident.pop_back();
+      return;
+    }
+  }
+}
+void FatTable::releaseChunk(Chunk &chunk) throw()
+{
+  if (NULL != chunk.mapping) {
+    device.unmap(chunk.mapping, chunk.mappingLen);
+  }
+
+  chunk.buf.reset();
+  chunk.entries = NULL;
+  chunk.mapping = NULL;
+  chunk.mappingLen = 0;
+  chunk.referenced = false;
+}
+/*
+ * Keep a resident copy in step with a write to the device.
+ * Mapped chunks already see the write through the page cache, and a
+ * chunk that is not resident will be loaded fresh from the device.
+ */
+void FatTable::set(uint32_t idx, uint32_t raw) throw()
+{
+  lock_guard<mutex> guard(lock);
+  Chunk &chunk = chunks[idx >> ChunkShift];
+
+  if (NULL != chunk.entries && NULL == chunk.mapping) {
+    chunk.entries[idx & (EntriesPerChunk - 1)] = raw;
+  }
+}
+/*
+ * Count entries that are not free, streaming chunk by chunk.
+ * Chunks loaded only for counting are dropped again so that a full
+ * count never holds more than one extra chunk.
+ */
+uint32_t FatTable::countNonFree(uint32_t mask) throw(LLIOError, LLIOEOF)
+{
+  lock_guard<mutex> guard(lock);
+  uint32_t cnt = 0;
+
+  for (uint32_t chunkNo = 0; chunkNo < chunks.size(); ++chunkNo) {
+    Chunk &chunk = chunks[chunkNo];
+    bool wasResident = (NULL != chunk.entries);
+    const uint32_t *entries = wasResident ? chunk.entries : loadChunk(chunkNo);
+    uint32_t first = chunkNo << ChunkShift;
+    uint32_t last = first + EntriesPerChunk;
+
+    if (last > entryCnt) {
+      last = entryCnt;
+    }
+
+    for (uint32_t i = 0; i < last - first; ++i) {
+      if (0 != (le32toh(entries[i]) & mask)) {
+        ++cnt;
+      }
+    }
+
+    if (!wasResident) {
+      releaseChunk(chunk);
+
+      for (uint32_t i = 0; i < resident.size(); ++i) {
+        if (resident[i] == chunkNo) {
+          resident[i] = resident.back();
+          resident.pop_back();
+          break;
+        }
+      }
+    }
+  }
+
+  return cnt;
+}
+uint32_t FatTable::getEntryCnt() throw()
+{
+  return entryCnt;
+}
@@ -0,0 +1,56 @@
+#ifndef FATTABLE_HPP
+#define FATTABLE_HPP
+#include <stdint.h>
+#include <sys/types.h>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include "LowLevelIO.hpp"
+#include "BlockDevice.hpp"
+using namespace std;
+/*
+ * The first FAT of a volume, loaded lazily in fixed-size chunks.
+ * A chunk is mapped through the BlockDevice (or read) the first time one of its entries is
+ * touched. At most maxChunks chunks stay resident; the least recently
+ * referenced one is dropped, CLOCK style, to make room for a new one.
+ * Entries are returned raw (little-endian, unmasked).
+ * All public members may be called from several threads at once.
+ */
+class FatTable
+{
+private:
+  struct Chunk {
+    uint32_t *entries;        //NULL if not resident
+    const void *mapping;      //NULL if read into buf
+    size_t mappingLen;
+    unique_ptr<uint32_t[]> buf;
+    bool referenced;
+  };
+  BlockDevice &device;
+  uintmax_t fatOffset;
+  uintmax_t bytsPerFat;
+  uint32_t entryCnt;
+  uint32_t maxChunks;
+  vector<Chunk> chunks;
+  vector<uint32_t> resident;
+  uint32_t clockHand;
+  mutex lock;
+
+  uint32_t *loadChunk(uint32_t chunkNo) throw(LLIOError, LLIOEOF);
+  void evictChunk() throw();
+  void releaseChunk(Chunk &chunk) throw();
+
+public:
+  static const uint32_t ChunkShift;
+  static const uint32_t EntriesPerChunk;
+  static const uint32_t DefaultMaxChunks;
+
+  FatTable(BlockDevice &dev, uintmax_t offset, uintmax_t size, uint32_t cnt,
+           uint32_t maxResident) throw();
+  ~FatTable() throw();
+  uint32_t get(uint32_t idx) throw(LLIOError, LLIOEOF);
+  void set(uint32_t idx, uint32_t raw) throw();
+  uint32_t countNonFree(uint32_t mask) throw(LLIOError, LLIOEOF);
+  uint32_t getEntryCnt() throw();
+};
+#endif //FATTABLE_HPP
@@ -0,0 +1,223 @@
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <iostream>
+#include "Fat32Action.hpp"
+#include "Fat32DataAccess.hpp"
+#include "SignatureMatcher.hpp"
+#include "ThreadPool.hpp"
+#include "FileCarver.hpp"
+using namespace std;
+
+const FileCarver::Format FileCarver::Formats[] = {
+  { "jpg", "\xFF\xD8\xFF", 3, "\xFF\xD9", 2, 0, 64 << 20 },
+  { "png", "\x89PNG\r\n\x1A\n", 8, "IEND\xAE\x42\x60\x82", 8, 0, 64 << 20 },
+  { "gif", "GIF89a", 6, "\x00\x3B", 2, 0, 16 << 20 },
+  { "gif", "GIF87a", 6, "\x00\x3B", 2, 0, 16 << 20 },
+  { "pdf", "%PDF-", 5, "%%EOF", 5, 0, 256 << 20 },
+  //End of central directory; its fixed part runs on after the signature
+  { "zip", "PK\x03\x04", 4, "PK\x05\x06", 4, 18, 256 << 20 }
+};
+const uint32_t FileCarver::FormatCnt = sizeof(Formats) / sizeof(Formats[0]);
+const size_t FileCarver::WindowBytes = 4 << 20;
+const size_t FileCarver::ChunkBytes = 64 << 20;
+const uintmax_t FileCarver::NoPos = UINTMAX_MAX;
+
+FileCarver::FileCarver(const string &devName,
+                       const DeviceOptions &opts) throw(FileIOError)
+  : Fat32Action(devName, opts)
+{
+  //Pattern ids: 2 * format for the header, 2 * format + 1 for the footer
+  for (uint32_t i = 0; i < FormatCnt; ++i) {
+    matcher.add((const uint8_t *) Formats[i].header, Formats[i].headerLen,
+                2 * i);
+    matcher.add((const uint8_t *) Formats[i].footer, Formats[i].footerLen,
+                2 * i + 1);
+  }
+}
+FileCarver::~FileCarver() throw() {}
+bool FileCarver::close(uint32_t format, uintmax_t start, uintmax_t footerPos,
+                       uintmax_t runEnd, Candidate &c) throw()
+{
+  const Format &fmt = Formats[format];
+  uintmax_t end = footerPos + fmt.footerLen + fmt.footerExtra;
+  uint32_t bytsPerClus = fat32DA.getBytsPerClus();
+
+  if (end > runEnd || end - start > fmt.maxBytes) {
+    return false;
+  }
+
+  c.format = format;
+  c.fstClus = start / bytsPerClus + 2;
+  c.lastClus = (end - 1) / bytsPerClus + 2;
+  c.bytes = end - start;
+  return true;
+}
+/*
+ * Stream one chunk through the matcher a window at a time. The last
+ * bytes of each window are carried over to the front of the next, so a
+ * footer across the seam is still seen, once; for the same reason the
+ * cluster after the chunk is read too, if the run goes on. Matches are
+ * kept only if they start inside the chunk.
+ */
+void FileCarver::scanChunk(Chunk &chunk) throw(FileIOError)
+{
+  uint32_t bytsPerClus = fat32DA.getBytsPerClus();
+  uint32_t windowClus = WindowBytes / bytsPerClus > 0 ?
+                        WindowBytes / bytsPerClus : 1;
+  size_t overlap = matcher.getMaxLen() - 1;
+  uintmax_t chunkStart = (uintmax_t)(chunk.fstClus - 2) * bytsPerClus;
+  uintmax_t chunkEnd = chunkStart + (uintmax_t) chunk.len * bytsPerClus;
+  uint32_t total = chunk.len + (chunkEnd < chunk.runEnd ? 1 : 0);
+  unique_ptr<uint8_t[]> buf(new uint8_t[overlap + (size_t) windowClus *
+                                        bytsPerClus]);
+  vector<SignatureMatcher::Match> matches;
+  size_t carried = 0;
+  bool open = false;
+  uint32_t openFormat = 0;
+  uintmax_t openStart = 0;
+  chunk.hasHeader = false;
+  chunk.headFooter.assign(FormatCnt, NoPos);
+
+  for (uint32_t done = 0; done < total;) {
+    uint32_t cnt = total - done < windowClus ? total - done : windowClus;
+    fat32DA.readClusters(chunk.fstClus + done, cnt, buf.get() + carried);
+    size_t len = carried + (size_t) cnt * bytsPerClus;
+    //Position of buf[0]
+    uintmax_t base = chunkStart + (uintmax_t) done * bytsPerClus - carried;
+    matches.clear();
+    matcher.scan(buf.get(), len, matches);
+
+    for (vector<SignatureMatcher::Match>::iterator it = matches.begin();
+         it != matches.end(); ++it) {
+      uint32_t format = it->id / 2;
+      bool header = 0 == it->id % 2;
+      size_t patLen = header ? Formats[format].headerLen :
+                      Formats[format].footerLen;
+      uintmax_t pos = base + it->pos;
+
+      if (it->pos + patLen <= carried || pos >= chunkEnd) {
+        continue; //Seen in the previous window, or the next chunk's
+      }
+
+      if (header) {
+        if (0 == pos % bytsPerClus) {
+          chunk.hasHeader = true;
+          open = true;
+          openFormat = format;
+          openStart = pos;
+        }
+      } else if (!chunk.hasHeader) {
+        if (NoPos == chunk.headFooter[format]) {
+          chunk.headFooter[format] = pos;
+        }
+      } else if (open && openFormat == format &&
+                 pos >= openStart + Formats[format].headerLen) {
+        Candidate c;
+
+        if (close(format, openStart, pos, chunk.runEnd, c)) {
+          chunk.found.push_back(c);
+        }
+
+        open = false;
+      }
+    }
+
+    done += cnt;
+    carried = len < overlap ? len : overlap;
+    memmove(buf.get(), buf.get() + len - carried, carried);
+  }
+
+  chunk.tailOpen = open;
+  chunk.tailFormat = openFormat;
+  chunk.tailStart = openStart;
+}
+void FileCarver::run() throw(FileIOError, Fat32ActionError)
+{
+  vector<Fat32DataAccess::ClusterRun> runs;
+  fat32DA.getFreeRuns(runs);
+  uint32_t bytsPerClus = fat32DA.getBytsPerClus();
+  uint32_t chunkClus = ChunkBytes / bytsPerClus > 0 ?
+                       ChunkBytes / bytsPerClus : 1;
+  vector<Chunk> chunks;
+
+  for (uint32_t r = 0; r < runs.size(); ++r) {
+    for (uint32_t done = 0; done < runs[r].len; done += chunkClus) {
+      Chunk chunk;
+      chunk.run = r;
+      chunk.fstClus = runs[r].fstClus + done;
+      chunk.len = runs[r].len - done < chunkClus ? runs[r].len - done :
+                  chunkClus;
+      chunk.runEnd = (uintmax_t)(runs[r].fstClus - 2 + runs[r].len) *
+                     bytsPerClus;
+      chunks.push_back(chunk);
+    }
+  }
+
+#ifdef DEBUG
+  cout << "\x1b[7m";
+  cout << "Carving " << runs.size() << " runs of free clusters in "
+       << chunks.size() << " chunks with the " << matcher.getImpl()
+       << " matcher" << endl;
+  cout << "\x1b[0m";
+#endif //DEBUG
+  {
+    ThreadPool pool(threadCnt);
+
+    for (size_t i = 0; i < chunks.size(); ++i) {
+      Chunk *chunk = &chunks[i];
+      pool.submit([this, chunk]() {
+        scanChunk(*chunk);
+      });
+    }
+
+    pool.wait();
+  }
+  //Stitch: a candidate left open runs into the next chunk of its run
+  vector<Candidate> found;
+  bool open = false;
+  uint32_t openFormat = 0;
+  uintmax_t openStart = 0;
+
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    Chunk &chunk = chunks[i];
+
+    if (i > 0 && chunks[i - 1].run != chunk.run) {
+      open = false;
+    }
+
+    if (open) {
+      Candidate c;
+
+      if (NoPos != chunk.headFooter[openFormat]) {
+        if (close(openFormat, openStart, chunk.headFooter[openFormat],
+                  chunk.runEnd, c)) {
+          found.push_back(c);
+        }
+
+        open = false;
+      } else if (chunk.hasHeader) {
+        open = false;
+      }
+    }
+
+    found.insert(found.end(), chunk.found.begin(), chunk.found.end());
+
+    if (chunk.tailOpen) {
+      open = true;
+      openFormat = chunk.tailFormat;
+      openStart = chunk.tailStart;
+    }
+  }
+
+  unsigned int i = 0;
+
+  for (vector<Candidate>::iterator it = found.begin(); it != found.end();
+       ++it) {
+    i++;
+    cout << i << ", " << Formats[it->format].ext << ", " << it->bytes << ", "
+         << it->fstClus << "-" << it->lastClus << endl;
+  }
+}
@@ -0,0 +1,72 @@
+#ifndef FILECARVER_HPP
+#define FILECARVER_HPP
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "Fat32Action.hpp"
+#include "SignatureMatcher.hpp"
+using namespace std;
+/*
+ * Lists files whose directory entries are gone by scanning the free
+ * clusters for known header and footer signatures.
+ * A header only counts at the start of a cluster, where file data
+ * starts; it is paired with the first footer of the same format that
+ * follows it within the same run of free clusters. A second header
+ * before that footer starts a new candidate instead.
+ * The runs are cut into chunks that are scanned on a thread pool. Each
+ * chunk reports the candidates it holds whole, plus what a candidate
+ * left open by the chunks before it would run into: the first footer of
+ * each format ahead of its first header. The chunks are then stitched
+ * together in order, so the output does not depend on the thread count.
+ */
+class FileCarver : public Fat32Action
+{
+private:
+  struct Format {
+    const char *ext;
+    const char *header;
+    size_t headerLen;
+    const char *footer;
+    size_t footerLen;
+    size_t footerExtra;  //Bytes that belong to the file after the footer
+    uintmax_t maxBytes;  //Larger candidates are dropped
+  };
+  struct Candidate {
+    uint32_t format;
+    uint32_t fstClus;
+    uint32_t lastClus;
+    uintmax_t bytes;
+  };
+  //Positions are byte offsets into the data area
+  struct Chunk {
+    uint32_t run;
+    uint32_t fstClus;
+    uint32_t len;
+    uintmax_t runEnd;
+    bool hasHeader;
+    vector<uintmax_t> headFooter; //Per format; NoPos if none
+    vector<Candidate> found;
+    bool tailOpen;                //A header with no footer yet
+    uint32_t tailFormat;
+    uintmax_t tailStart;
+  };
+
+  static const Format Formats[];
+  static const uint32_t FormatCnt;
+  static const size_t WindowBytes;
+  static const size_t ChunkBytes;
+  static const uintmax_t NoPos;
+
+  SignatureMatcher matcher;
+
+  bool close(uint32_t format, uintmax_t start, uintmax_t footerPos,
+             uintmax_t runEnd, Candidate &c) throw();
+  void scanChunk(Chunk &chunk) throw(FileIOError);
+
+public:
+  FileCarver(const string &devName, const DeviceOptions &opts)
+  throw (FileIOError);
+  ~FileCarver() throw();
+  void run() throw(FileIOError, Fat32ActionError);
+};
+#endif //FILECARVER_HPP
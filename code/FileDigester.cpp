@@ -0,0 +1,155 @@
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <stdexcept>
+#ifdef DEBUG
+#include <iostream>
+#endif
+#include "Fat32DataAccess.hpp"
+#include "Digest.hpp"
+#include "MultiMD5.hpp"
+#include "FileDigester.hpp"
+using namespace std;
+
+const size_t FileDigester::ChunkBytes = 1 << 20;
+const size_t FileDigester::BatchBytes = 16 << 20;
+
+FileDigester::FileDigester(Fat32DataAccess &da, const string &alg,
+                           size_t chunk)
+  : fat32DA(da), algorithm(alg), chunkBytes(chunk > 0 ? chunk : ChunkBytes)
+{
+  if (!Digest::isAlgorithm(alg)) {
+    throw logic_error("Unknown digest " + alg);
+  }
+}
+/*
+ * Hash the whole of fh, from offset 0 whatever its offset is; fh itself
+ * is left as it was.
+ */
+string FileDigester::digest(FileHandler &fh) throw(FileIOError,
+    ClusterOccupied, BrokenFATChain)
+{
+  if (!buf) {
+    buf.reset(new uint8_t[chunkBytes]);
+  }
+
+  FileHandler reader = fh;
+  reader.setOffset(0);
+  unique_ptr<Digest> d(Digest::create(algorithm));
+  ssize_t len;
+
+  while ((len = fat32DA.fs32read(reader, buf.get(), chunkBytes)) > 0) {
+    d->update(buf.get(), len);
+  }
+
+  return d->finalHex();
+}
+/*
+ * Read the files picked by batch with one device batch and hash them.
+ */
+void FileDigester::digestBatch(const vector<FileHandler *> &files,
+                               const vector<size_t> &batch,
+                               vector<string> &out)
+throw(FileIOError, ClusterOccupied, BrokenFATChain)
+{
+  vector<Fat32DataAccess::BatchRead> reads;
+  vector<FileHandler> readers;
+  vector<unique_ptr<uint8_t[]> > bufs;
+  readers.reserve(batch.size());
+
+  for (vector<size_t>::const_iterator it = batch.begin(); it != batch.end();
+       ++it) {
+    FileHandler &fh = *files[*it];
+    //Read from the start, without moving the callers' offsets
+    readers.push_back(fh);
+    readers.back().setOffset(0);
+    bufs.push_back(unique_ptr<uint8_t[]>(new uint8_t[fh.getSize() + 1]));
+    Fat32DataAccess::BatchRead r;
+    r.fh = &readers.back();
+    r.buf = bufs.back().get();
+    r.count = fh.getSize();
+    reads.push_back(r);
+  }
+
+  fat32DA.fs32readBatch(reads);
+
+  if (algorithm == "md5") {
+    vector<MultiMD5::Job> jobs(reads.size());
+
+    for (size_t i = 0; i < reads.size(); ++i) {
+      jobs[i].data = bufs[i].get();
+      jobs[i].len = reads[i].ret;
+    }
+
+    multi.hash(jobs);
+
+    for (size_t i = 0; i < jobs.size(); ++i) {
+      out[batch[i]] = Digest::toHex(jobs[i].digest, sizeof(jobs[i].digest));
+    }
+
+    return;
+  }
+
+  for (size_t i = 0; i < reads.size(); ++i) {
+    unique_ptr<Digest> d(Digest::create(algorithm));
+    d->update(bufs[i].get(), reads[i].ret);
+    out[batch[i]] = d->finalHex();
+  }
+}
+/*
+ * Digest every file in files into out, in the same order.
+ */
+void FileDigester::digestAll(const vector<FileHandler *> &files,
+                             vector<string> &out)
+throw(FileIOError, ClusterOccupied, BrokenFATChain)
+{
+  out.assign(files.size(), string());
+  vector<size_t> batch;
+  size_t batchBytes = 0;
+
+  for (size_t i = 0; i < files.size(); ++i) {
+    if (files[i]->getSize() > chunkBytes) {
+      out[i] = digest(*files[i]);
+      continue;
+    }
+
+    batch.push_back(i);
+    batchBytes += files[i]->getSize();
+
+    if (batchBytes >= BatchBytes) {
+      digestBatch(files, batch, out);
+      batch.clear();
+      batchBytes = 0;
+    }
+  }
+
+  if (!batch.empty()) {
+    digestBatch(files, batch, out);
+  }
+
+#ifdef DEBUG
+  cout << "\x1b[7m";
+  cout << files.size() << " files digested with " << getName();
+
+  if (algorithm == "md5") {
+    cout << ", " << multi.getLanes() << " at a time (" << multi.getImpl()
+         << ")";
+  }
+
+  cout << endl;
+  cout << "\x1b[0m";
+#endif //DEBUG
+}
+const string &FileDigester::getAlgorithm() throw()
+{
+  return algorithm;
+}
+/*
+ * The algorithm as people write it, MD5 or SHA-256, say.
+ */
+string FileDigester::getName()
+{
+  unique_ptr<Digest> d(Digest::create(algorithm));
+  return d->getName();
+}
@@ -0,0 +1,45 @@
+#ifndef FILEDIGESTER_HPP
+#define FILEDIGESTER_HPP
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include "Fat32DataAccess.hpp"
+#include "MultiMD5.hpp"
+using namespace std;
+/*
+ * Digests of files' content, as lowercase hex, with any algorithm
+ * Digest::create() knows.
+ * A file larger than ChunkBytes is read through fs32read() a chunk at a
+ * time into one buffer kept for every file, so memory use does not grow
+ * with the file size. digestAll() reads smaller files in batches of
+ * about BatchBytes with fs32readBatch(); with MD5 a batch is hashed in
+ * MultiMD5 lanes.
+ */
+class FileDigester
+{
+private:
+  Fat32DataAccess &fat32DA;
+  string algorithm;
+  size_t chunkBytes;
+  unique_ptr<uint8_t[]> buf;
+  MultiMD5 multi;
+
+  void digestBatch(const vector<FileHandler *> &files,
+                   const vector<size_t> &batch, vector<string> &out)
+  throw(FileIOError, ClusterOccupied, BrokenFATChain);
+
+public:
+  static const size_t ChunkBytes;
+  static const size_t BatchBytes;
+
+  explicit FileDigester(Fat32DataAccess &da, const string &alg = "md5",
+                        size_t chunk = ChunkBytes);
+  string digest(FileHandler &fh) throw(FileIOError, ClusterOccupied,
+                                       BrokenFATChain);
+  void digestAll(const vector<FileHandler *> &files, vector<string> &out)
+  throw(FileIOError, ClusterOccupied, BrokenFATChain);
+  const string &getAlgorithm() throw();
+  string getName();
+};
+#endif //FILEDIGESTER_HPP
@@ -8,7 +8,8 @@ class FileRecovery83 : public Fat32Action
 private:
   string targetName;
 public:
-  FileRecovery83(const string &devName, const string &tname)
+  FileRecovery83(const string &devName, const DeviceOptions &opts,
+                 const string &tname)
   throw(FileIOError);
   ~FileRecovery83()
   throw();
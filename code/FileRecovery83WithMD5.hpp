@@ -3,14 +3,21 @@
 #include <string>
 #include "Fat32Action.hpp"
 using namespace std;
+/*
+ * -r with -m: recover the deleted 8.3 file whose content has the digest
+ * given, MD5 unless another algorithm is picked with -H.
+ */
 class FileRecovery83WithMD5 : public Fat32Action
 {
 private:
   string targetName;
-  string md5String;
+  string digestString;
+  string algorithm; //For Digest::create()
 public:
-  FileRecovery83WithMD5(const string &devName, const string &tname,
-                        const string &md5)
+  FileRecovery83WithMD5(const string &devName, const DeviceOptions &opts,
+                        const string &tname,
+                        const string &digest,
+                        const string &alg = "md5")
   throw (FileIOError);
   ~FileRecovery83WithMD5()
   throw();
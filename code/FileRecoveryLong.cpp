@@ -7,8 +7,9 @@
 #include "FileRecoveryLong.hpp"
 using namespace std;
 FileRecoveryLong::FileRecoveryLong(const string &devName,
+                                   const DeviceOptions &opts,
                                    const string &tname) throw(FileIOError)
-    : Fat32Action(devName), targetName(tname) {}
+    : Fat32Action(devName, opts), targetName(tname) {}
 FileRecoveryLong::~FileRecoveryLong() throw() {}
 void FileRecoveryLong::run() throw(FileIOError, Fat32ActionError) {
   if (targetName.length() == 0) {
@@ -16,44 +17,36 @@ void FileRecoveryLong::run() throw(FileIOError, Fat32ActionError) {
   }
 
   list<FileHandler> matchedList;
-  FileHandler dirHandler = fat32DA.getRootHandler();
-
-  try {
-    while (true) {
-      FileHandler fh = fat32DA.getNextFileHandlerFromDir(dirHandler);
-
-      if (fh.isDeleted()) {
+  forEachEntry([&](FileHandler &fh) {
+    if (fh.isDeleted()) {
 #ifdef DEBUG
-        cout << "\x1b[7m";
-        cout << "Found Deleted: " << fh.toString() << endl;
-        cout << "\x1b[0m";
+      cout << "\x1b[7m";
+      cout << "Found Deleted: " << fh.toString() << endl;
+      cout << "\x1b[0m";
 #endif //DEBUG
 
-        if (0 == targetName.compare(fh.getLongName())) {
-          matchedList.push_back(fh);
+      if (0 == targetName.compare(fh.getLongName())) {
+        matchedList.push_back(fh);
 #ifdef DEBUG
-          cout << "\x1b[7m";
-          cout << "Match. Queued" << endl;
-          cout << "\x1b[0m";
-#endif //DEBUG
-        } else {
-#ifdef DEBUG
-          cout << "\x1b[7m";
-          cout << "Not match. Skipped" << endl;
-          cout << "\x1b[0m";
+        cout << "\x1b[7m";
+        cout << "Match. Queued" << endl;
+        cout << "\x1b[0m";
 #endif //DEBUG
-        }
       } else {
 #ifdef DEBUG
         cout << "\x1b[7m";
-        cout << "Not Deleted. Ignored: " << fh.toString() << endl;
+        cout << "Not match. Skipped" << endl;
         cout << "\x1b[0m";
 #endif //DEBUG
       }
+    } else {
+#ifdef DEBUG
+      cout << "\x1b[7m";
+      cout << "Not Deleted. Ignored: " << fh.toString() << endl;
+      cout << "\x1b[0m";
+#endif //DEBUG
     }
-  }
-  catch (NoMoreData & e) {
-  }
+  });
 
   int matchNum = matchedList.size();
 
@@ -84,6 +77,9 @@ void FileRecoveryLong::run() throw(FileIOError, Fat32ActionError) {
     catch (ClusterOccupied & e) {
       throw Fat32ActionError(targetName + ": error - fail to recover");
     }
+    catch (BrokenFATChain & e) {
+      throw Fat32ActionError(targetName + ": error - fail to recover");
+    }
   } else {
 #ifdef DEBUG
     cout << "\x1b[7m";
@@ -9,7 +9,8 @@ class FileRecoveryLong : public Fat32Action
 private:
   string targetName;
 public:
-  FileRecoveryLong(const string &devName, const string &tname)
+  FileRecoveryLong(const string &devName, const DeviceOptions &opts,
+                   const string &tname)
   throw (FileIOError);
   ~FileRecoveryLong()
   throw();
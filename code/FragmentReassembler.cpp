@@ -0,0 +1,420 @@
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+#ifdef DEBUG
+#include <iostream>
+#endif
+#include "Fat32DataAccess.hpp"
+#include "ThreadPool.hpp"
+#include "Digest.hpp"
+#include "FragmentReassembler.hpp"
+using namespace std;
+
+const FragmentReassembler::Validator FragmentReassembler::Validators[] = {
+  { "\xFF\xD8\xFF", 3, "\xFF\xD9", 2, 0, 0 },
+  { "\x89PNG\r\n\x1A\n", 8, "IEND\xAE\x42\x60\x82", 8, 0, 0 },
+  { "GIF89a", 6, "\x00\x3B", 2, 0, 0 },
+  { "GIF87a", 6, "\x00\x3B", 2, 0, 0 },
+  //Writers put a line end after the last %%EOF, or not
+  { "%PDF-", 5, "%%EOF", 5, 0, 2 },
+  //End of central directory, with no archive comment
+  { "PK\x03\x04", 4, "PK\x05\x06", 4, 18, 18 }
+};
+const uint32_t FragmentReassembler::ValidatorCnt = sizeof(Validators) /
+    sizeof(Validators[0]);
+const size_t FragmentReassembler::WindowBytes = 4 << 20;
+
+const int FragmentReassembler::Found = 0;
+const int FragmentReassembler::NotFound = 1;
+const int FragmentReassembler::Ambiguous = 2;
+const int FragmentReassembler::Unverifiable = 3;
+const int FragmentReassembler::LimitReached = 4;
+const uintmax_t FragmentReassembler::MaxHashBytes = (uintmax_t) 1 << 30;
+
+FragmentReassembler::FragmentReassembler(Fat32DataAccess &da,
+    uint32_t threads, const string &alg) throw()
+  : fat32DA(da), threadCnt(threads), bytsPerClus(da.getBytsPerClus()),
+    fstClus(0), clusCnt(0), lastLen(0), validator(NULL), algorithm(alg),
+    bestK(0), hashed(0), limitHit(false)
+{
+  windowClus = WindowBytes / bytsPerClus > 0 ? WindowBytes / bytsPerClus : 1;
+}
+const FragmentReassembler::Validator *FragmentReassembler::detect(
+  const uint8_t *first) throw()
+{
+  for (uint32_t i = 0; i < ValidatorCnt; ++i) {
+    const Validator &v = Validators[i];
+
+    if (v.headerLen <= bytsPerClus &&
+        0 == memcmp(first, v.header, v.headerLen)) {
+      return &v;
+    }
+  }
+
+  return NULL;
+}
+/*
+ * Whether last, the file's last cluster, ends the way the file must.
+ */
+bool FragmentReassembler::endsRight(const uint8_t *last) throw()
+{
+  for (size_t trail = validator->trailMin; trail <= validator->trailMax;
+       ++trail) {
+    if (0 == memcmp(last + lastLen - trail - validator->footerLen,
+                    validator->footer, validator->footerLen)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+const Fat32DataAccess::ClusterRun *FragmentReassembler::runOf(
+  uint32_t clusNo) throw()
+{
+  vector<Fat32DataAccess::ClusterRun>::iterator it =
+    upper_bound(freeRuns.begin(), freeRuns.end(), clusNo,
+  [](uint32_t c, const Fat32DataAccess::ClusterRun & r) {
+    return c < r.fstClus;
+  });
+
+  if (it == freeRuns.begin() || clusNo >= (it - 1)->fstClus + (it - 1)->len) {
+    return NULL;
+  }
+
+  return &*(it - 1);
+}
+/*
+ * Whether the second fragment of a split after k clusters can start at
+ * g: after a gap, and in one run of free clusters.
+ */
+bool FragmentReassembler::fits(uint32_t k, uint32_t g) throw()
+{
+  uint32_t m = clusCnt - k;
+
+  if (g < fstClus + k + 1) {
+    return false;
+  }
+
+  const Fat32DataAccess::ClusterRun *run = runOf(g);
+  return NULL != run && g + m <= run->fstClus + run->len;
+}
+/*
+ * Collect the free clusters from the first one on whose data ends the
+ * way the file must, one window of free clusters per task.
+ */
+void FragmentReassembler::findTails() throw(FileIOError)
+{
+  struct Window {
+    uint32_t fstClus;
+    uint32_t len;
+    vector<uint32_t> tails;
+  };
+  vector<Window> windows;
+
+  for (vector<Fat32DataAccess::ClusterRun>::iterator it = freeRuns.begin();
+       it != freeRuns.end(); ++it) {
+    uint32_t end = it->fstClus + it->len;
+    uint32_t clusNo = it->fstClus > fstClus ? it->fstClus : fstClus;
+
+    for (; clusNo < end; clusNo += windowClus) {
+      Window w;
+      w.fstClus = clusNo;
+      w.len = end - clusNo < windowClus ? end - clusNo : windowClus;
+      windows.push_back(w);
+    }
+  }
+
+  {
+    ThreadPool pool(threadCnt);
+
+    for (size_t i = 0; i < windows.size(); ++i) {
+      Window *w = &windows[i];
+      pool.submit([this, w]() {
+        unique_ptr<uint8_t[]> buf(new uint8_t[(size_t) w->len * bytsPerClus]);
+        fat32DA.readClusters(w->fstClus, w->len, buf.get());
+
+        for (uint32_t j = 0; j < w->len; ++j) {
+          if (endsRight(buf.get() + (size_t) j * bytsPerClus)) {
+            w->tails.push_back(w->fstClus + j);
+          }
+        }
+      });
+    }
+
+    pool.wait();
+  }
+
+  tails.clear();
+
+  for (vector<Window>::iterator it = windows.begin(); it != windows.end();
+       ++it) {
+    tails.insert(tails.end(), it->tails.begin(), it->tails.end());
+  }
+}
+/*
+ * Digest states after each of the first kMax clusters, hashed once.
+ */
+void FragmentReassembler::hashPrefixes(uint32_t kMax) throw(FileIOError)
+{
+  unique_ptr<uint8_t[]> buf(new uint8_t[(size_t) windowClus * bytsPerClus]);
+  prefixes.clear();
+  prefixes.resize(kMax + 1);
+  prefixes[0].reset(Digest::create(algorithm));
+
+  for (uint32_t done = 0; done < kMax;) {
+    uint32_t cnt = kMax - done < windowClus ? kMax - done : windowClus;
+    fat32DA.readClusters(fstClus + done, cnt, buf.get());
+
+    for (uint32_t j = 0; j < cnt; ++j, ++done) {
+      prefixes[done + 1].reset(prefixes[done]->clone());
+      prefixes[done + 1]->update(buf.get() + (size_t) j * bytsPerClus,
+                                 bytsPerClus);
+    }
+  }
+
+  hashed += (uintmax_t) kMax * bytsPerClus;
+}
+/*
+ * Whether the first k clusters followed by the rest of the file from g
+ * hash to the digest wanted. buf holds windowClus clusters.
+ */
+bool FragmentReassembler::hashMatches(uint32_t k, uint32_t g,
+                                      uint8_t *buf) throw(FileIOError)
+{
+  unique_ptr<Digest> d(prefixes[k]->clone());
+  uint32_t m = clusCnt - k;
+
+  for (uint32_t done = 0; done < m;) {
+    uint32_t cnt = m - done < windowClus ? m - done : windowClus;
+    fat32DA.readClusters(g + done, cnt, buf);
+    done += cnt;
+    size_t len = (size_t) cnt * bytsPerClus;
+
+    if (done == m) {
+      len -= bytsPerClus - lastLen;
+    }
+
+    d->update(buf, len);
+  }
+
+  return 0 == wanted.compare(d->finalHex());
+}
+/*
+ * Try the splits after k clusters, second fragment first in the volume
+ * first, until one matches. Gives up once a split with more clusters in
+ * the first fragment has matched, since that one is preferred.
+ */
+void FragmentReassembler::searchSplits(uint32_t k) throw(FileIOError)
+{
+  uint32_t m = clusCnt - k;
+  uint32_t bufClus = m < windowClus ? m : windowClus;
+  unique_ptr<uint8_t[]> buf(new uint8_t[(size_t) bufClus * bytsPerClus]);
+  vector<uint32_t> starts;
+
+  if (NULL != validator) {
+    for (vector<uint32_t>::iterator it = tails.begin(); it != tails.end();
+         ++it) {
+      if (*it + 1 >= m && fits(k, *it + 1 - m)) {
+        starts.push_back(*it + 1 - m);
+      }
+    }
+  }
+
+  vector<Fat32DataAccess::ClusterRun>::iterator run = freeRuns.begin();
+  uint32_t g = 0;
+  size_t s = 0;
+
+  while (bestK.load() <= k) {
+    //Next start: from the tails, or every place m clusters fit
+    if (NULL != validator) {
+      if (s == starts.size()) {
+        return;
+      }
+
+      g = starts[s++];
+    } else {
+      for (; run != freeRuns.end(); ++run, g = 0) {
+        uint32_t lo = run->fstClus > fstClus + k + 1 ? run->fstClus :
+                      fstClus + k + 1;
+
+        if (g < lo) {
+          g = lo;
+        } else {
+          ++g;
+        }
+
+        if (run->len >= m && g <= run->fstClus + run->len - m) {
+          break;
+        }
+      }
+
+      if (run == freeRuns.end()) {
+        return;
+      }
+    }
+
+    uintmax_t cost = (uintmax_t) m * bytsPerClus;
+
+    if (hashed.fetch_add(cost) + cost > MaxHashBytes) {
+      limitHit = true;
+      return;
+    }
+
+    if (hashMatches(k, g, buf.get())) {
+      secondAt[k] = g;
+      uint32_t best = bestK.load();
+
+      while (best < k && !bestK.compare_exchange_weak(best, k));
+
+      return;
+    }
+  }
+}
+/*
+ * Find where the data of the deleted file fh lies, as one or two runs of
+ * clusters, checking candidates against digest if not empty.
+ * Returns Found with the runs, or why not.
+ */
+int FragmentReassembler::find(FileHandler &fh, const string &digest,
+                              vector<Fat32DataAccess::ClusterRun> &runs)
+throw(FileIOError)
+{
+  runs.clear();
+  fstClus = fh.getFstClus();
+
+  if (0 == fh.getSize()) {
+    return NotFound;
+  }
+
+  clusCnt = (fh.getSize() + bytsPerClus - 1) / bytsPerClus;
+  lastLen = fh.getSize() - (clusCnt - 1) * bytsPerClus;
+  wanted = digest;
+  freeRuns.clear();
+  fat32DA.getFreeRuns(freeRuns);
+  const Fat32DataAccess::ClusterRun *first = runOf(fstClus);
+
+  if (NULL == first) {
+    return NotFound;
+  }
+
+  Fat32DataAccess::ClusterRun whole = { fstClus, clusCnt };
+
+  //One free cluster cannot be split; a digest still has to match below
+  if (1 == clusCnt && digest.empty()) {
+    runs.push_back(whole);
+    return Found;
+  }
+
+  uint32_t avail = first->fstClus + first->len - fstClus;
+  uint32_t kMax = avail < clusCnt - 1 ? avail : clusCnt - 1;
+  {
+    unique_ptr<uint8_t[]> buf(new uint8_t[bytsPerClus]);
+    fat32DA.readClusters(fstClus, 1, buf.get());
+    validator = detect(buf.get());
+  }
+
+  //A footer that may start in the cluster before the last cannot prune
+  if (NULL != validator &&
+      lastLen < validator->footerLen + validator->trailMax) {
+    validator = NULL;
+  }
+
+  if (wanted.empty() && NULL == validator) {
+    return Unverifiable;
+  }
+
+  if (NULL != validator) {
+    findTails();
+  }
+
+#ifdef DEBUG
+  cout << "\x1b[7m";
+  cout << "Reassembling " << clusCnt << " clusters from " << fstClus
+       << ", first fragment up to " << kMax << " clusters, "
+       << (NULL != validator ? tails.size() : 0) << " tails" << endl;
+  cout << "\x1b[0m";
+#endif //DEBUG
+  bool wholeFits = avail >= clusCnt;
+
+  if (wanted.empty()) {
+    //Exactly one split must end with the footer
+    size_t passing = 0;
+    uint32_t k = 0;
+    uint32_t g = 0;
+
+    if (wholeFits && binary_search(tails.begin(), tails.end(),
+                                   fstClus + clusCnt - 1)) {
+      passing++;
+    }
+
+    for (uint32_t i = kMax; i >= 1 && passing < 2; --i) {
+      for (vector<uint32_t>::iterator it = tails.begin();
+           it != tails.end() && passing < 2; ++it) {
+        uint32_t m = clusCnt - i;
+
+        if (*it + 1 >= m && fits(i, *it + 1 - m)) {
+          passing++;
+          k = i;
+          g = *it + 1 - m;
+        }
+      }
+    }
+
+    if (0 == passing) {
+      return NotFound;
+    } else if (passing > 1) {
+      return Ambiguous;
+    } else if (0 == k) {
+      runs.push_back(whole);
+    } else {
+      Fat32DataAccess::ClusterRun head = { fstClus, k };
+      Fat32DataAccess::ClusterRun tail = { g, clusCnt - k };
+      runs.push_back(head);
+      runs.push_back(tail);
+    }
+
+    return Found;
+  }
+
+  hashed = 0;
+  limitHit = false;
+  bestK = 0;
+  hashPrefixes(kMax);
+
+  if (wholeFits) {
+    unique_ptr<uint8_t[]> buf(new uint8_t[(size_t) windowClus * bytsPerClus]);
+
+    if (hashMatches(kMax, fstClus + kMax, buf.get())) {
+      runs.push_back(whole);
+      return Found;
+    }
+  }
+
+  secondAt.assign(kMax + 1, 0);
+  {
+    ThreadPool pool(threadCnt);
+
+    for (uint32_t k = kMax; k >= 1; --k) {
+      pool.submit([this, k]() {
+        searchSplits(k);
+      });
+    }
+
+    pool.wait();
+  }
+
+  if (0 == bestK) {
+    return limitHit ? LimitReached : NotFound;
+  }
+
+  uint32_t k = bestK;
+  Fat32DataAccess::ClusterRun head = { fstClus, k };
+  Fat32DataAccess::ClusterRun tail = { secondAt[k], clusCnt - k };
+  runs.push_back(head);
+  runs.push_back(tail);
+  return Found;
+}
@@ -0,0 +1,86 @@
+#ifndef FRAGMENTREASSEMBLER_HPP
+#define FRAGMENTREASSEMBLER_HPP
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <memory>
+#include "Digest.hpp"
+#include "Fat32DataAccess.hpp"
+using namespace std;
+/*
+ * Bifragment gap carving: finds where a deleted file lies when its data
+ * was written as two runs of free clusters, the first one starting at
+ * the file's first cluster and the second one somewhere after a gap.
+ * A split is k clusters from the first cluster, then the remaining
+ * clusters from some later free cluster g. The unsplit file is tried
+ * first.
+ * A split is accepted if the digest of the assembled data matches, or,
+ * with no digest given, if the file type recognised from its header ends
+ * with the type's footer exactly where the size says the file ends;
+ * without a digest more than one such split is ambiguous.
+ * Pruning: the first run is bounded by the free clusters from the first
+ * cluster; the second run must lie in one run of free clusters; when the
+ * type is known, only free clusters whose data ends the way the file
+ * must end are tried as the last cluster. Digest states after each prefix
+ * of the first run are computed once and shared by every split, and the
+ * splits are hashed on a thread pool until one matches or MaxHashBytes
+ * have been hashed.
+ */
+class FragmentReassembler
+{
+private:
+  struct Validator {
+    const char *header;
+    size_t headerLen;
+    const char *footer;
+    size_t footerLen;
+    size_t trailMin;  //Bytes the file may hold after the footer
+    size_t trailMax;
+  };
+
+  static const Validator Validators[];
+  static const uint32_t ValidatorCnt;
+  static const size_t WindowBytes;
+
+  Fat32DataAccess &fat32DA;
+  uint32_t threadCnt;
+  uint32_t bytsPerClus;
+  uint32_t windowClus;
+  uint32_t fstClus;
+  uint32_t clusCnt;
+  uint32_t lastLen;          //Bytes of the file in its last cluster
+  const Validator *validator; //NULL if the type is unknown
+  string algorithm;
+  string wanted;             //Digest to match, empty if none
+  vector<Fat32DataAccess::ClusterRun> freeRuns;
+  vector<uint32_t> tails;    //Free clusters that may end the file
+  vector<unique_ptr<Digest> > prefixes; //[k]: after the first k clusters
+  vector<uint32_t> secondAt; //secondAt[k]: first match with k clusters, or 0
+  atomic<uint32_t> bestK;    //Largest k matched so far, 0 for none
+  atomic<uintmax_t> hashed;
+  atomic<bool> limitHit;
+
+  const Validator *detect(const uint8_t *first) throw();
+  bool endsRight(const uint8_t *last) throw();
+  const Fat32DataAccess::ClusterRun *runOf(uint32_t clusNo) throw();
+  bool fits(uint32_t k, uint32_t g) throw();
+  void findTails() throw(FileIOError);
+  void hashPrefixes(uint32_t kMax) throw(FileIOError);
+  bool hashMatches(uint32_t k, uint32_t g, uint8_t *buf) throw(FileIOError);
+  void searchSplits(uint32_t k) throw(FileIOError);
+
+public:
+  static const int Found;
+  static const int NotFound;
+  static const int Ambiguous;
+  static const int Unverifiable;
+  static const int LimitReached;
+  static const uintmax_t MaxHashBytes;
+
+  FragmentReassembler(Fat32DataAccess &da, uint32_t threads,
+                      const string &alg = "md5") throw();
+  int find(FileHandler &fh, const string &digest,
+           vector<Fat32DataAccess::ClusterRun> &runs) throw(FileIOError);
+};
+#endif //FRAGMENTREASSEMBLER_HPP
@@ -0,0 +1,95 @@
+#include <string>
+#include <list>
+#include <vector>
+#include <memory>
+#include <iostream>
+#include "Fat32Action.hpp"
+#include "Fat32DataAccess.hpp"
+#include "Digest.hpp"
+#include "FragmentReassembler.hpp"
+#include "FragmentedRecovery.hpp"
+using namespace std;
+FragmentedRecovery::FragmentedRecovery(const string &devName,
+                                       const DeviceOptions &opts,
+                                       const string &tname,
+                                       const string &digest,
+                                       const string &alg) throw(FileIOError)
+  : Fat32Action(devName, opts), targetName(tname), digestString(digest),
+    algorithm(alg) {}
+FragmentedRecovery::~FragmentedRecovery() throw() {}
+void FragmentedRecovery::run() throw(FileIOError, Fat32ActionError)
+{
+  if (targetName.length() == 0) {
+    throw Fat32ActionError(targetName + ": error - file not found");
+  }
+
+  list<FileHandler> matchedList;
+  forEachEntry([&](FileHandler &fh) {
+    if (fh.isDeleted() && !fh.isDirectory() &&
+        0 == targetName.compare(1, string::npos, fh.getShortName(), 1,
+                                string::npos)) {
+      matchedList.push_back(fh);
+    }
+  });
+
+  if (matchedList.empty()) {
+    throw Fat32ActionError(targetName + ": error - file not found");
+  } else if (digestString.empty() && matchedList.size() > 1) {
+    throw Fat32ActionError(targetName + ": error - ambiguous");
+  }
+
+  FragmentReassembler reassembler(fat32DA, threadCnt, algorithm);
+  int status = FragmentReassembler::NotFound;
+
+  for (list<FileHandler>::iterator it = matchedList.begin();
+       it != matchedList.end(); ++it) {
+    vector<Fat32DataAccess::ClusterRun> runs;
+#ifdef DEBUG
+    cout << "\x1b[7m";
+    cout << "Reassembling: " << it->toString() << endl;
+    cout << "\x1b[0m";
+#endif //DEBUG
+    status = reassembler.find(*it, digestString, runs);
+
+    if (FragmentReassembler::Found != status) {
+      continue;
+    }
+
+#ifdef DEBUG
+    cout << "\x1b[7m";
+
+    for (vector<Fat32DataAccess::ClusterRun>::iterator r = runs.begin();
+         r != runs.end(); ++r) {
+      cout << "Fragment: " << r->fstClus << "-" << r->fstClus + r->len - 1
+           << endl;
+    }
+
+    cout << "\x1b[0m";
+#endif //DEBUG
+
+    try {
+      fat32DA.recoverFragments(*it, targetName[0], false, runs);
+    } catch (ClusterOccupied &e) {
+      throw Fat32ActionError(targetName + ": error - fail to recover");
+    } catch (BrokenFATChain &e) {
+      throw Fat32ActionError(targetName + ": error - fail to recover");
+    }
+
+    if (digestString.empty()) {
+      cout << targetName << ": recovered" << endl;
+    } else {
+      unique_ptr<Digest> d(Digest::create(algorithm));
+      cout << targetName << ": recovered with " << d->getName() << endl;
+    }
+
+    return;
+  }
+
+  if (FragmentReassembler::Ambiguous == status) {
+    throw Fat32ActionError(targetName + ": error - ambiguous");
+  } else if (FragmentReassembler::NotFound == status && !digestString.empty()) {
+    throw Fat32ActionError(targetName + ": error - file not found");
+  }
+
+  throw Fat32ActionError(targetName + ": error - fail to recover");
+}
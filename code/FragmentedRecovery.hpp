@@ -0,0 +1,27 @@
+#ifndef FRAGMENTEDRECOVERY_HPP
+#define FRAGMENTEDRECOVERY_HPP
+#include <string>
+#include "Fat32Action.hpp"
+using namespace std;
+/*
+ * -r with -F: recover a deleted 8.3 file whose clusters may be split in
+ * two fragments, found by FragmentReassembler. Without a digest the file
+ * type must be recognisable for the split to be checked.
+ */
+class FragmentedRecovery : public Fat32Action
+{
+private:
+  string targetName;
+  string digestString;
+  string algorithm;
+public:
+  FragmentedRecovery(const string &devName, const DeviceOptions &opts,
+                     const string &tname, const string &digest,
+                     const string &alg = "md5")
+  throw(FileIOError);
+  ~FragmentedRecovery()
+  throw();
+  void run()
+  throw(FileIOError, Fat32ActionError);
+};
+#endif //FRAGMENTEDRECOVERY_HPP
@@ -0,0 +1,25 @@
+#include <string>
+#include <iostream>
+#include "Fat32Action.hpp"
+#include "Fat32DataAccess.hpp"
+#include "JournalRollback.hpp"
+using namespace std;
+JournalRollback::
+JournalRollback(const string &devName, const DeviceOptions &opts)
+throw (FileIOError)
+  : Fat32Action(devName, opts)
+{
+}
+JournalRollback::
+~JournalRollback() throw()
+{
+}
+void JournalRollback::
+run()  throw(FileIOError, Fat32ActionError)
+{
+  if (0 == fat32DA.getRolledBack()) {
+    cout << "Nothing to roll back" << endl;
+  } else {
+    cout << "Rolled back " << fat32DA.getRolledBack() << " writes" << endl;
+  }
+}
@@ -0,0 +1,18 @@
+#ifndef JOURNALROLLBACK_HPP
+#define JOURNALROLLBACK_HPP
+#include <string>
+#include "Fat32Action.hpp"
+using namespace std;
+/*
+ * Reports the undo of the last journaled commit. The undo itself happens
+ * while the volume is opened, with DeviceOptions::rollback set.
+ */
+class JournalRollback : public Fat32Action
+{
+public:
+  JournalRollback(const string &devName, const DeviceOptions &opts)
+  throw (FileIOError);
+  ~JournalRollback() throw();
+  void run()  throw(FileIOError, Fat32ActionError);
+};
+#endif
@@ -0,0 +1,398 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <endian.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#ifdef DEBUG
+#include <iostream>
+#endif
+#include "LowLevelIO.hpp"
+#include "BlockDevice.hpp"
+#include "JournaledBlockDevice.hpp"
+using namespace std;
+
+/*
+ * Journal layout, all integers little-endian:
+ *   Magic
+ *   per write:  tag 1 (u32), offset (u64), length (u32), old, new bytes
+ *   commit:     tag 2 (u32), record count (u32), checksum (u64) of
+ *               everything between Magic and the commit tag
+ *   applied:    tag 3 (u32), once the device holds the new bytes
+ */
+const char JournaledBlockDevice::Magic[8] = { 'F', '3', '2', 'W', 'A', 'L',
+                                              '0', '1'
+                                            };
+static const uint32_t TagWrite = 1;
+static const uint32_t TagCommit = 2;
+static const uint32_t TagApplied = 3;
+
+static void putU32(vector<uint8_t> &out, uint32_t v)
+{
+  v = htole32(v);
+  out.insert(out.end(), (uint8_t *) &v, (uint8_t *) &v + sizeof(v));
+}
+static void putU64(vector<uint8_t> &out, uint64_t v)
+{
+  v = htole64(v);
+  out.insert(out.end(), (uint8_t *) &v, (uint8_t *) &v + sizeof(v));
+}
+static bool getU32(const vector<uint8_t> &in, size_t &pos, uint32_t &v)
+{
+  if (pos + sizeof(v) > in.size()) {
+    return false;
+  }
+
+  memcpy(&v, &in[pos], sizeof(v));
+  v = le32toh(v);
+  pos += sizeof(v);
+  return true;
+}
+static bool getU64(const vector<uint8_t> &in, size_t &pos, uint64_t &v)
+{
+  if (pos + sizeof(v) > in.size()) {
+    return false;
+  }
+
+  memcpy(&v, &in[pos], sizeof(v));
+  v = le64toh(v);
+  pos += sizeof(v);
+  return true;
+}
+
+JournaledBlockDevice::JournaledBlockDevice(BlockDevice *dev,
+    const string &journal) throw(LLIOError)
+  : BlockDevice(dev->getFd()), inner(dev), journalFd(-1)
+{
+  try {
+    journalFd = ::open(journal.c_str(), O_RDWR | O_CREAT, 0644);
+
+    if (-1 == journalFd) {
+      throw LLIOError(errno);
+    }
+
+    vector<Record> records;
+    bool applied;
+
+    if (!load(records, applied)) {
+      //Empty, or torn before the commit mark: the device was never touched
+      if (-1 == ftruncate(journalFd, 0)) {
+        throw LLIOError(errno);
+      }
+    } else if (!applied) {
+#ifdef DEBUG
+      cout << "\x1b[7m";
+      cout << "Replaying " << records.size() << " journaled writes" << endl;
+      cout << "\x1b[0m";
+#endif //DEBUG
+      apply(records, false);
+      markApplied();
+    }
+  } catch (...) {
+    if (-1 != journalFd) {
+      close(journalFd);
+    }
+
+    //The descriptor belongs to the wrapped device
+    fd = -1;
+    throw;
+  }
+}
+JournaledBlockDevice::~JournaledBlockDevice() throw()
+{
+  close(journalFd);
+  fd = -1;
+}
+uint64_t JournaledBlockDevice::checksum(const uint8_t *data,
+                                        size_t len) throw()
+{
+  //FNV-1a
+  uint64_t hash = 0xcbf29ce484222325ULL;
+
+  for (size_t i = 0; i < len; ++i) {
+    hash ^= data[i];
+    hash *= 0x100000001b3ULL;
+  }
+
+  return hash;
+}
+/*
+ * Read the last transaction from the journal. Returns false if there is
+ * none with a valid commit mark.
+ */
+bool JournaledBlockDevice::load(vector<Record> &records,
+                                bool &applied) throw(LLIOError)
+{
+  off_t size = lseek(journalFd, 0, SEEK_END);
+
+  if (-1 == size) {
+    throw LLIOError(errno);
+  }
+
+  vector<uint8_t> in(size);
+
+  try {
+    LowLevelIO::xpread(journalFd, in.data(), size, 0);
+  } catch (LLIOEOF &e) {
+    return false;
+  }
+
+  if (in.size() < sizeof(Magic) || 0 != memcmp(&in[0], Magic, sizeof(Magic))) {
+    return false;
+  }
+
+  size_t pos = sizeof(Magic);
+  uint32_t tag;
+
+  while (getU32(in, pos, tag)) {
+    if (TagWrite == tag) {
+      Record r;
+      uint32_t len;
+
+      if (!getU64(in, pos, r.offset) || !getU32(in, pos, len) ||
+          pos + 2 * (size_t) len > in.size()) {
+        return false;
+      }
+
+      r.oldBytes.assign(in.begin() + pos, in.begin() + pos + len);
+      pos += len;
+      r.newBytes.assign(in.begin() + pos, in.begin() + pos + len);
+      pos += len;
+      records.push_back(r);
+    } else if (TagCommit == tag) {
+      size_t end = pos - sizeof(tag);
+      uint32_t cnt;
+      uint64_t sum;
+
+      if (!getU32(in, pos, cnt) || !getU64(in, pos, sum) ||
+          cnt != records.size() ||
+          sum != checksum(&in[sizeof(Magic)], end - sizeof(Magic))) {
+        return false;
+      }
+
+      applied = getU32(in, pos, tag) && TagApplied == tag;
+      return true;
+    } else {
+      return false;
+    }
+  }
+
+  return false;
+}
+/*
+ * Replace the journal with the staged writes and a commit mark.
+ */
+void JournaledBlockDevice::writeJournal() throw(LLIOError)
+{
+  vector<uint8_t> out(Magic, Magic + sizeof(Magic));
+
+  for (vector<Record>::iterator it = staged.begin(); it != staged.end(); ++it) {
+    putU32(out, TagWrite);
+    putU64(out, it->offset);
+    putU32(out, it->newBytes.size());
+    out.insert(out.end(), it->oldBytes.begin(), it->oldBytes.end());
+    out.insert(out.end(), it->newBytes.begin(), it->newBytes.end());
+  }
+
+  uint64_t sum = checksum(&out[sizeof(Magic)], out.size() - sizeof(Magic));
+  putU32(out, TagCommit);
+  putU32(out, staged.size());
+  putU64(out, sum);
+
+  if (-1 == ftruncate(journalFd, 0)) {
+    throw LLIOError(errno);
+  }
+
+  LowLevelIO::xpwrite(journalFd, out.data(), out.size(), 0);
+
+  if (-1 == fdatasync(journalFd)) {
+    throw LLIOError(errno);
+  }
+}
+void JournaledBlockDevice::markApplied() throw(LLIOError)
+{
+  vector<uint8_t> out;
+  putU32(out, TagApplied);
+  off_t end = lseek(journalFd, 0, SEEK_END);
+
+  if (-1 == end) {
+    throw LLIOError(errno);
+  }
+
+  LowLevelIO::xpwrite(journalFd, out.data(), out.size(), end);
+
+  if (-1 == fdatasync(journalFd)) {
+    throw LLIOError(errno);
+  }
+}
+/*
+ * Write the new bytes of records (or with undo, the old bytes, newest
+ * record first) to the device. Overlapping records are merged into runs
+ * first, so each run is written once and in offset order.
+ */
+void JournaledBlockDevice::apply(const vector<Record> &records,
+                                 bool undo) throw(LLIOError)
+{
+  std::map<uint64_t, vector<uint8_t> > runs;
+
+  for (vector<Record>::const_iterator it = records.begin();
+       it != records.end(); ++it) {
+    uint64_t start = it->offset;
+    uint64_t end = it->offset + it->newBytes.size();
+    std::map<uint64_t, vector<uint8_t> >::iterator r = runs.upper_bound(start);
+
+    if (r != runs.begin()) {
+      --r;
+
+      if (r->first + r->second.size() < start) {
+        ++r;
+      }
+    }
+
+    //Swallow every run that touches [start, end)
+    while (r != runs.end() && r->first <= end) {
+      uint64_t rEnd = r->first + r->second.size();
+
+      if (r->first < start) {
+        start = r->first;
+      }
+
+      if (rEnd > end) {
+        end = rEnd;
+      }
+
+      runs.erase(r++);
+    }
+
+    runs[start].resize(end - start);
+  }
+
+  for (size_t i = 0; i < records.size(); ++i) {
+    const Record &rec = undo ? records[records.size() - 1 - i] : records[i];
+    const vector<uint8_t> &bytes = undo ? rec.oldBytes : rec.newBytes;
+    std::map<uint64_t, vector<uint8_t> >::iterator r = runs.upper_bound(rec.offset);
+    --r;
+    memcpy(&r->second[rec.offset - r->first], bytes.data(), bytes.size());
+  }
+
+  for (std::map<uint64_t, vector<uint8_t> >::iterator r = runs.begin();
+       r != runs.end(); ++r) {
+    inner->xpwrite(r->second.data(), r->second.size(), r->first);
+  }
+
+  inner->sync();
+}
+void JournaledBlockDevice::overlay(void *buf, size_t count,
+                                   off_t offset) throw()
+{
+  for (vector<Record>::iterator it = staged.begin(); it != staged.end(); ++it) {
+    uint64_t start = it->offset > (uint64_t) offset ? it->offset : offset;
+    uint64_t end = it->offset + it->newBytes.size();
+
+    if (end > (uint64_t) offset + count) {
+      end = offset + count;
+    }
+
+    if (start < end) {
+      memcpy((uint8_t *) buf + (start - offset),
+             &it->newBytes[start - it->offset], end - start);
+    }
+  }
+}
+void JournaledBlockDevice::xpread(void *buf, size_t count,
+                                  off_t offset) throw(LLIOError, LLIOEOF)
+{
+  inner->xpread(buf, count, offset);
+  lock_guard<mutex> guard(lock);
+  overlay(buf, count, offset);
+}
+void JournaledBlockDevice::xpreadBatch(vector<IORequest> &reqs)
+throw(LLIOError, LLIOEOF)
+{
+  inner->xpreadBatch(reqs);
+  lock_guard<mutex> guard(lock);
+
+  for (vector<IORequest>::iterator it = reqs.begin(); it != reqs.end(); ++it) {
+    overlay(it->buf, it->count, it->offset);
+  }
+}
+/*
+ * Stage a write. The bytes it replaces are kept for rollback.
+ */
+void JournaledBlockDevice::xpwrite(void *buf, size_t count,
+                                   off_t offset) throw(LLIOError)
+{
+  lock_guard<mutex> guard(lock);
+  Record r;
+  r.offset = offset;
+  r.oldBytes.resize(count);
+
+  try {
+    inner->xpread(r.oldBytes.data(), count, offset);
+  } catch (LLIOEOF &e) {
+    throw LLIOError(ENOSPC);
+  }
+
+  overlay(r.oldBytes.data(), count, offset);
+  r.newBytes.assign((uint8_t *) buf, (uint8_t *) buf + count);
+  staged.push_back(r);
+}
+const void *JournaledBlockDevice::map(off_t offset, size_t len) throw()
+{
+  return NULL;
+}
+void JournaledBlockDevice::unmap(const void *addr, size_t len) throw()
+{
+}
+/*
+ * Commit the staged writes.
+ */
+void JournaledBlockDevice::sync() throw(LLIOError)
+{
+  lock_guard<mutex> guard(lock);
+
+  if (staged.empty()) {
+    inner->sync();
+    return;
+  }
+
+#ifdef DEBUG
+  cout << "\x1b[7m";
+  cout << "Committing " << staged.size() << " journaled writes" << endl;
+  cout << "\x1b[0m";
+#endif //DEBUG
+  writeJournal();
+  apply(staged, false);
+  markApplied();
+  staged.clear();
+}
+/*
+ * Undo the last committed transaction and empty the journal.
+ * Staged writes are dropped. Returns the number of writes undone.
+ */
+size_t JournaledBlockDevice::rollback() throw(LLIOError)
+{
+  lock_guard<mutex> guard(lock);
+  vector<Record> records;
+  bool applied = false;
+  staged.clear();
+
+  if (!load(records, applied)) {
+    return 0;
+  }
+
+  apply(records, true);
+
+  if (-1 == ftruncate(journalFd, 0) || -1 == fdatasync(journalFd)) {
+    throw LLIOError(errno);
+  }
+
+  return records.size();
+}
@@ -0,0 +1,59 @@
+#ifndef JOURNALEDBLOCKDEVICE_HPP
+#define JOURNALEDBLOCKDEVICE_HPP
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include "BlockDevice.hpp"
+using namespace std;
+/*
+ * Stages writes to another device and applies them through a
+ * write-ahead log kept in a sidecar file.
+ * xpwrite() only records the old and new bytes; reads see the staged
+ * bytes. sync() commits: the records and a commit mark are written to
+ * the journal and synced, then the new bytes are written to the device
+ * in offset order, the device is synced and the journal marked applied.
+ * Writes not committed when the object is destroyed are dropped.
+ * Opening a journal whose last commit was not marked applied replays it;
+ * a torn journal without a commit mark is discarded. rollback() puts
+ * back the old bytes of the last commit.
+ * map() fails, since a mapping would not see staged writes.
+ * The wrapped device and its descriptor are owned by this one.
+ */
+class JournaledBlockDevice : public BlockDevice
+{
+private:
+  struct Record {
+    uint64_t offset;
+    vector<uint8_t> oldBytes;
+    vector<uint8_t> newBytes;
+  };
+
+  unique_ptr<BlockDevice> inner;
+  int journalFd;
+  vector<Record> staged;
+  mutex lock;
+
+  void overlay(void *buf, size_t count, off_t offset) throw();
+  bool load(vector<Record> &records, bool &applied) throw(LLIOError);
+  void writeJournal() throw(LLIOError);
+  void markApplied() throw(LLIOError);
+  void apply(const vector<Record> &records, bool undo) throw(LLIOError);
+  static uint64_t checksum(const uint8_t *data, size_t len) throw();
+
+public:
+  static const char Magic[8];
+
+  JournaledBlockDevice(BlockDevice *dev, const string &journal)
+  throw(LLIOError);
+  ~JournaledBlockDevice() throw();
+  void xpread(void *buf, size_t count, off_t offset) throw(LLIOError, LLIOEOF);
+  void xpwrite(void *buf, size_t count, off_t offset) throw(LLIOError);
+  void xpreadBatch(vector<IORequest> &reqs) throw(LLIOError, LLIOEOF);
+  const void *map(off_t offset, size_t len) throw();
+  void unmap(const void *addr, size_t len) throw();
+  void sync() throw(LLIOError);
+  size_t rollback() throw(LLIOError);
+};
+#endif //JOURNALEDBLOCKDEVICE_HPP
@@ -0,0 +1,93 @@
+#include <string>
+#include <vector>
+#include <list>
+#include <memory>
+#include <iostream>
+#include "Fat32Action.hpp"
+#include "Fat32DataAccess.hpp"
+#include "Digest.hpp"
+#include "DigestSet.hpp"
+#include "FileDigester.hpp"
+#include "KnownFileScan.hpp"
+using namespace std;
+KnownFileScan::KnownFileScan(const string &devName, const DeviceOptions &opts,
+                             const string &hashSet,
+                             const string &alg) throw(FileIOError)
+  : Fat32Action(devName, opts), setName(hashSet), algorithm(alg) {}
+KnownFileScan::~KnownFileScan() throw() {}
+static bool entryBefore(FileHandler &a, FileHandler &b)
+{
+  if (a.getDirClus() != b.getDirClus()) {
+    return a.getDirClus() < b.getDirClus();
+  }
+
+  return a.getDirOffset() < b.getDirOffset();
+}
+void KnownFileScan::run() throw(FileIOError, Fat32ActionError)
+{
+  unique_ptr<Digest> d(Digest::create(algorithm));
+  DigestSet known(d->getSize());
+  size_t skipped = known.load(setName);
+#ifdef DEBUG
+  cout << "\x1b[7m";
+  cout << known.size() << " known " << d->getName() << " digests, "
+       << skipped << " lines skipped" << endl;
+  cout << "\x1b[0m";
+#endif //DEBUG
+
+  if (0 == known.size() && skipped > 0) {
+    throw Fat32ActionError(setName + ": error - no " + d->getName() +
+                           " digests");
+  }
+
+  //Visits come in any order with -a; sort them so the output does not
+  //depend on the thread count
+  list<FileHandler> deleted;
+  forEachEntry([&](FileHandler &fh) {
+    if (fh.isDeleted() && !fh.isDirectory()) {
+      deleted.push_back(fh);
+    }
+  });
+  deleted.sort(entryBefore);
+  vector<FileHandler *> readable;
+
+  for (list<FileHandler>::iterator it = deleted.begin(); it != deleted.end();
+       ++it) {
+    if (Fat32DataAccess::ReadOK == fat32DA.getReadStatus(*it)) {
+      readable.push_back(&*it);
+    }
+  }
+
+  FileDigester digester(fat32DA, algorithm);
+  vector<string> digests;
+
+  try {
+    digester.digestAll(readable, digests);
+  } catch (ClusterOccupied &e) {
+    throw Fat32ActionError(setName + ": error - fail to read");
+  } catch (BrokenFATChain &e) {
+    throw Fat32ActionError(setName + ": error - fail to read");
+  }
+
+  unsigned int i = 0;
+
+  for (size_t j = 0; j < readable.size(); ++j) {
+    if (!known.contains(digests[j])) {
+      continue;
+    }
+
+    FileHandler &fh = *readable[j];
+    string path = recursive ? fh.getDirPath() : "";
+    string name = fh.hasLongName() ? fh.getLongName() : fh.getShortName();
+
+    //In place of the 0xE5 deletion mark, which is not text
+    if (!fh.hasLongName() && !name.empty()) {
+      name[0] = '?';
+    }
+
+    i++;
+    cout << i << ", " << path << name << ", " << digests[j] << endl;
+  }
+
+  cout << i << " of " << deleted.size() << " deleted files known" << endl;
+}
@@ -0,0 +1,27 @@
+#ifndef KNOWNFILESCAN_HPP
+#define KNOWNFILESCAN_HPP
+#include <string>
+#include "Fat32Action.hpp"
+using namespace std;
+/*
+ * -K: digest every readable deleted file and look it up in a reference
+ * set of known digests loaded from a file, md5sum style, MD5 unless
+ * another algorithm is picked with -H. Lists the deleted files whose
+ * content is known, in directory order, and how many of them were.
+ * Nothing is written to the volume.
+ */
+class KnownFileScan : public Fat32Action
+{
+private:
+  string setName;
+  string algorithm;
+public:
+  KnownFileScan(const string &devName, const DeviceOptions &opts,
+                const string &hashSet, const string &alg = "md5")
+  throw(FileIOError);
+  ~KnownFileScan()
+  throw();
+  void run()
+  throw(FileIOError, Fat32ActionError);
+};
+#endif //KNOWNFILESCAN_HPP
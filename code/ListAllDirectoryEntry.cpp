@@ -5,9 +5,9 @@
 #include "ListAllDirectoryEntry.hpp"
 using namespace std;
 ListAllDirectoryEntry::
-ListAllDirectoryEntry(const string &devName)
+ListAllDirectoryEntry(const string &devName, const DeviceOptions &opts)
 throw(FileIOError)
-  : Fat32Action(devName)
+  : Fat32Action(devName, opts)
 {
 }
 ListAllDirectoryEntry::
@@ -19,24 +19,21 @@ void ListAllDirectoryEntry::
 run()
 throw(FileIOError, Fat32ActionError)
 {
-  FileHandler dirHandler = fat32DA.getRootHandler();
   unsigned int i = 0;
 
-  try {
-    while (true) {
-      FileHandler fh = fat32DA.getNextFileHandlerFromDir(dirHandler);
+  forEachEntry([&](FileHandler &fh) {
+    //Entries below the root are shown with their path
+    string path = recursive ? fh.getDirPath() : "";
 
-      if (fh.isDeleted()) {
+    if (fh.isDeleted()) {
 #ifdef DEBUG
-        cout << "\x1b[7m";
-        cout << i << ", " << fh.toString() << endl;
-        cout << "\x1b[0m";
+      cout << "\x1b[7m";
+      cout << i << ", " << path << fh.toString() << endl;
+      cout << "\x1b[0m";
 #endif //DEBUG
-      } else {
-        i++;
-        cout << i << ", " << fh.toString() << endl;
-      }
+    } else {
+      i++;
+      cout << i << ", " << path << fh.toString() << endl;
     }
-  } catch (NoMoreData &e) {
-  }
+  });
 }
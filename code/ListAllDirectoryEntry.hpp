@@ -6,7 +6,7 @@ using namespace std;
 class ListAllDirectoryEntry : public Fat32Action
 {
 public:
-  ListAllDirectoryEntry(const string &devName)
+  ListAllDirectoryEntry(const string &devName, const DeviceOptions &opts)
   throw(FileIOError);
   ~ListAllDirectoryEntry()
   throw();
@@ -1,6 +1,13 @@
 #include <system_error>
 #include <stdexcept>
 #include <unistd.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
 #include "LowLevelIO.hpp"
 using namespace std;
 LLIOError::LLIOError(int ev) : system_error(ev, system_category()) {}
@@ -37,3 +44,79 @@ void LowLevelIO::xpwrite(int fd, void *buf, size_t count,
     }
   }
 }
+/*
+ * Fill iovcnt buffers from consecutive bytes starting at offset.
+ * Short reads resume in the middle of the buffer they stopped in.
+ */
+void LowLevelIO::xpreadv(int fd, const struct iovec *iov, int iovcnt,
+                         off_t offset) throw(LLIOError, LLIOEOF)
+{
+  vector<struct iovec> rest(iov, iov + iovcnt);
+  size_t first = 0;
+
+  while (first < rest.size()) {
+    int cnt = rest.size() - first < IOV_MAX ? rest.size() - first : IOV_MAX;
+    ssize_t readCount = preadv(fd, &rest[first], cnt, offset);
+
+    if (-1 == readCount) {
+      throw LLIOError(errno);
+    } else if (0 == readCount) {
+      throw LLIOEOF();
+    }
+
+    offset += readCount;
+
+    while (first < rest.size() && (size_t) readCount >= rest[first].iov_len) {
+      readCount -= rest[first].iov_len;
+      ++first;
+    }
+
+    if (first < rest.size()) {
+      rest[first].iov_base = (unsigned char *) rest[first].iov_base + readCount;
+      rest[first].iov_len -= readCount;
+    }
+  }
+}
+/*
+ * Write iovcnt buffers as the whole content of name. They go to a file
+ * next to it first, synced and renamed over name once complete, so a
+ * reader never sees half of it.
+ */
+void LowLevelIO::replaceFile(const string &name, const struct iovec *iov,
+                             int iovcnt) throw(LLIOError)
+{
+  string tmpName = name + ".tmp";
+  int fd = ::open(tmpName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+  if (-1 == fd) {
+    throw LLIOError(errno);
+  }
+
+  try {
+    off_t offset = 0;
+
+    for (int i = 0; i < iovcnt; ++i) {
+      xpwrite(fd, iov[i].iov_base, iov[i].iov_len, offset);
+      offset += iov[i].iov_len;
+    }
+  } catch (LLIOError &e) {
+    ::close(fd);
+    unlink(tmpName.c_str());
+    throw;
+  }
+
+  int err = -1 == fsync(fd) ? errno : 0;
+
+  if (-1 == ::close(fd) && 0 == err) {
+    err = errno;
+  }
+
+  if (0 == err && -1 == rename(tmpName.c_str(), name.c_str())) {
+    err = errno;
+  }
+
+  if (0 != err) {
+    unlink(tmpName.c_str());
+    throw LLIOError(err);
+  }
+}
@@ -1,7 +1,9 @@
 #ifndef LOWLEVELIO_HPP
 #define LOWLEVELIO_HPP
 #include <system_error>
+#include <string>
 #include <unistd.h>
+#include <sys/uio.h>
 using namespace std;
 
 class LLIOError : public system_error
@@ -21,5 +23,9 @@ public:
                      off_t offset) throw(LLIOError, LLIOEOF);
   static void xpwrite(int fd, void *buf, size_t count,
                       off_t offset) throw(LLIOError);
+  static void xpreadv(int fd, const struct iovec *iov, int iovcnt,
+                      off_t offset) throw(LLIOError, LLIOEOF);
+  static void replaceFile(const string &name, const struct iovec *iov,
+                          int iovcnt) throw(LLIOError);
 };
 #endif// LowLevelIO_HPP
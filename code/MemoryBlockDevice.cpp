@@ -0,0 +1,63 @@
+#include <sys/types.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <memory>
+#include "LowLevelIO.hpp"
+#include "BlockDevice.hpp"
+#include "MemoryBlockDevice.hpp"
+using namespace std;
+MemoryBlockDevice::MemoryBlockDevice(int _fd) throw(LLIOError)
+  : BlockDevice(_fd), size(0)
+{
+  off_t end = lseek(fd, 0, SEEK_END);
+
+  if (-1 == end) {
+    fd = -1;
+    throw LLIOError(errno);
+  }
+
+  size = end;
+  image.reset(new unsigned char[size]);
+
+  try {
+    LowLevelIO::xpread(fd, image.get(), size, 0);
+  } catch (LLIOEOF &e) {
+    fd = -1;
+    throw LLIOError(EIO);
+  } catch (LLIOError &e) {
+    fd = -1;
+    throw;
+  }
+}
+MemoryBlockDevice::~MemoryBlockDevice() throw() {}
+void MemoryBlockDevice::xpread(void *buf, size_t count,
+                               off_t offset) throw(LLIOError, LLIOEOF)
+{
+  if (offset < 0 || (size_t) offset + count > size) {
+    throw LLIOEOF();
+  }
+
+  memcpy(buf, image.get() + offset, count);
+}
+void MemoryBlockDevice::xpwrite(void *buf, size_t count,
+                                off_t offset) throw(LLIOError)
+{
+  if (offset < 0 || (size_t) offset + count > size) {
+    throw LLIOError(ENOSPC);
+  }
+
+  LowLevelIO::xpwrite(fd, buf, count, offset);
+  memcpy(image.get() + offset, buf, count);
+}
+const void *MemoryBlockDevice::map(off_t offset, size_t len) throw()
+{
+  if (offset < 0 || (size_t) offset + len > size) {
+    return NULL;
+  }
+
+  return image.get() + offset;
+}
+void MemoryBlockDevice::unmap(const void *addr, size_t len) throw()
+{
+}
@@ -0,0 +1,25 @@
+#ifndef MEMORYBLOCKDEVICE_HPP
+#define MEMORYBLOCKDEVICE_HPP
+#include <stdint.h>
+#include <memory>
+#include "BlockDevice.hpp"
+using namespace std;
+/*
+ * The whole image read into memory at open. Reads never touch the
+ * device; writes update the copy and go through to the device.
+ */
+class MemoryBlockDevice : public BlockDevice
+{
+private:
+  unique_ptr<unsigned char[]> image;
+  size_t size;
+
+public:
+  explicit MemoryBlockDevice(int _fd) throw(LLIOError);
+  ~MemoryBlockDevice() throw();
+  void xpread(void *buf, size_t count, off_t offset) throw(LLIOError, LLIOEOF);
+  void xpwrite(void *buf, size_t count, off_t offset) throw(LLIOError);
+  const void *map(off_t offset, size_t len) throw();
+  void unmap(const void *addr, size_t len) throw();
+};
+#endif //MEMORYBLOCKDEVICE_HPP
@@ -0,0 +1,390 @@
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <endian.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <memory>
+#include <algorithm>
+#include <functional>
+#ifdef DEBUG
+#include <iostream>
+#endif
+#include "LowLevelIO.hpp"
+#include "Fat32DataAccess.hpp"
+#include "DirectoryTraversal.hpp"
+#include "XXH3Digest.hpp"
+#include "MetadataIndex.hpp"
+using namespace std;
+
+const char MetadataIndex::Magic[8] = { 'F', '3', '2', 'M', 'E', 'T', 'A', '2' };
+const uint32_t MetadataIndex::FlagDir = 1;
+const uint32_t MetadataIndex::FlagDeleted = 2;
+const uint32_t MetadataIndex::FlagInDeletedDir = 4;
+
+MetadataIndex::MetadataIndex(const string &name) throw()
+  : fileName(name), base(NULL), size(0)
+{
+  memset(&header, 0, sizeof(header));
+}
+MetadataIndex::~MetadataIndex() throw()
+{
+  if (NULL != base) {
+    munmap((void *) base, size);
+  }
+}
+uint64_t MetadataIndex::fatHash(Fat32DataAccess &da) throw(FileIOError)
+{
+  XXH3Digest d;
+  uint64_t h;
+  da.digestFAT(d);
+  d.final((uint8_t *) &h);
+  return be64toh(h);
+}
+/*
+ * Whether the sections fit the file and every record points inside
+ * them, so decode() can trust what it reads.
+ */
+bool MetadataIndex::check() throw()
+{
+  uint64_t need = sizeof(Header) + (uint64_t) header.recordCnt *
+                  sizeof(Record) + (uint64_t) header.lfnCnt * sizeof(uint32_t) +
+                  (uint64_t) header.extentCnt * sizeof(FileHandler::Extent) +
+                  header.stringBytes;
+
+  if (0 != memcmp(header.magic, Magic, sizeof(Magic)) || need != size ||
+      header.rootCnt > header.recordCnt || 0 == header.stringBytes ||
+      '\0' != base[size - 1]) {
+    return false;
+  }
+
+  for (uint32_t i = 0; i < header.recordCnt; ++i) {
+    Record r;
+    memcpy(&r, base + sizeof(Header) + (size_t) i * sizeof(Record),
+           sizeof(r));
+
+    if (le32toh(r.shortName) >= header.stringBytes ||
+        le32toh(r.longName) >= header.stringBytes ||
+        le32toh(r.dirPath) >= header.stringBytes ||
+        le32toh(r.lfnCnt) > header.lfnCnt ||
+        le32toh(r.lfnFirst) > header.lfnCnt - le32toh(r.lfnCnt) ||
+        le32toh(r.extCnt) > header.extentCnt ||
+        le32toh(r.extFirst) > header.extentCnt - le32toh(r.extCnt)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+/*
+ * Map the index and check it describes the volume as it is now.
+ * Returns false if there is none or it is stale.
+ */
+bool MetadataIndex::open(Fat32DataAccess &da) throw(FileIOError)
+{
+  int fd = ::open(fileName.c_str(), O_RDONLY);
+  struct stat st;
+
+  if (-1 == fd) {
+    if (ENOENT == errno) {
+      return false;
+    }
+
+    throw FileIOError(errno, fileName);
+  }
+
+  if (-1 == fstat(fd, &st)) {
+    int err = errno;
+    ::close(fd);
+    throw FileIOError(err, fileName);
+  }
+
+  if ((size_t) st.st_size < sizeof(Header)) {
+    ::close(fd);
+    return false;
+  }
+
+  size = st.st_size;
+  void *mapping = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  int err = errno;
+  ::close(fd);
+
+  if (MAP_FAILED == mapping) {
+    throw FileIOError(err, fileName);
+  }
+
+  base = (const uint8_t *) mapping;
+  memcpy(&header, base, sizeof(header));
+  header.volID = le32toh(header.volID);
+  header.bytsPerClus = le32toh(header.bytsPerClus);
+  header.totClusCnt = le32toh(header.totClusCnt);
+  header.recordCnt = le32toh(header.recordCnt);
+  header.rootCnt = le32toh(header.rootCnt);
+  header.lfnCnt = le32toh(header.lfnCnt);
+  header.extentCnt = le32toh(header.extentCnt);
+  header.stringBytes = le32toh(header.stringBytes);
+  header.fatHash = le64toh(header.fatHash);
+
+  if (!check() || header.volID != da.getVolID() ||
+      header.bytsPerClus != da.getBytsPerClus() ||
+      header.totClusCnt != da.getTotClusCnt() ||
+      header.fatHash != fatHash(da)) {
+    munmap(mapping, size);
+    base = NULL;
+#ifdef DEBUG
+    cout << "\x1b[7m";
+    cout << "Metadata index " << fileName << " is stale" << endl;
+    cout << "\x1b[0m";
+#endif //DEBUG
+    return false;
+  }
+
+  return true;
+}
+static bool byPath(FileHandler &a, FileHandler &b)
+{
+  int c = a.getDirPath().compare(b.getDirPath());
+
+  if (0 != c) {
+    return c < 0;
+  } else if (a.getDirClus() != b.getDirClus()) {
+    return a.getDirClus() < b.getDirClus();
+  }
+
+  return a.getDirOffset() < b.getDirOffset();
+}
+/*
+ * Scan the whole volume and write the index, unless its name is empty.
+ * The entries found are kept and served by forEach() in this run.
+ */
+void MetadataIndex::build(Fat32DataAccess &da, uint32_t threadCnt)
+throw(FileIOError)
+{
+  uint64_t hash = fatHash(da);
+  built.clear();
+  DirIterator it(da, da.getRootHandler());
+  FileHandler fh;
+
+  while (it.next(fh)) {
+    built.push_back(fh);
+  }
+
+  if (Fat32DataAccess::DirScanEnd != it.getStatus()) {
+    throw FileIOError(-it.getStatus(), "Reading root directory");
+  }
+
+  uint32_t rootCnt = built.size();
+  vector<FileHandler> below;
+  {
+    DirectoryTraversal traversal(da, threadCnt);
+    traversal.run([&](FileHandler &fh) {
+      if (0 != fh.getDirPath().compare("/")) {
+        below.push_back(fh);
+      }
+    });
+  }
+  sort(below.begin(), below.end(), byPath);
+  built.insert(built.end(), below.begin(), below.end());
+
+  for (vector<FileHandler>::iterator it = built.begin(); it != built.end();
+       ++it) {
+    if (!it->isDeleted()) {
+      da.getExtents(*it);
+    }
+  }
+
+  header.recordCnt = built.size();
+  header.rootCnt = rootCnt;
+
+  if (!fileName.empty()) {
+    write(da, hash, rootCnt);
+  }
+
+#ifdef DEBUG
+  cout << "\x1b[7m";
+  cout << "Metadata index " << fileName << " built: " << built.size()
+       << " entries" << endl;
+  cout << "\x1b[0m";
+#endif //DEBUG
+}
+static void put32(vector<uint8_t> &out, uint32_t v)
+{
+  v = htole32(v);
+  out.insert(out.end(), (uint8_t *) &v, (uint8_t *) &v + sizeof(v));
+}
+/*
+ * Write built out in place of fileName.
+ */
+void MetadataIndex::write(Fat32DataAccess &da, uint64_t hash,
+                          uint32_t rootCnt) throw(FileIOError)
+{
+  vector<uint8_t> records, lfns, extents;
+  string strings(1, '\0');  //Offset 0 is the empty string
+  map<string, uint32_t> paths;
+
+  for (vector<FileHandler>::iterator it = built.begin(); it != built.end();
+       ++it) {
+    map<string, uint32_t>::iterator p = paths.find(it->getDirPath());
+
+    if (p == paths.end()) {
+      p = paths.insert(make_pair(it->getDirPath(), strings.size())).first;
+      strings.append(it->getDirPath()).push_back('\0');
+    }
+
+    put32(records, strings.size());
+    strings.append(it->getShortName()).push_back('\0');
+
+    if (it->hasLongName()) {
+      put32(records, strings.size());
+      strings.append(it->getLongName()).push_back('\0');
+    } else {
+      put32(records, 0);
+    }
+
+    put32(records, p->second);
+    put32(records, it->getFstClus());
+    put32(records, it->getSize());
+    put32(records, it->getDirClus());
+    put32(records, it->getDirOffset());
+    put32(records, (it->isDirectory() ? FlagDir : 0) |
+          (it->isDeleted() ? FlagDeleted : 0) |
+          (it->isInDeletedDir() ? FlagInDeletedDir : 0));
+    const list<uint32_t> &lfn = it->getDirLFNOffsets();
+    put32(records, lfns.size() / sizeof(uint32_t));
+    put32(records, lfn.size());
+
+    for (list<uint32_t>::const_iterator o = lfn.begin(); o != lfn.end(); ++o) {
+      put32(lfns, *o);
+    }
+
+    put32(records, extents.size() / sizeof(FileHandler::Extent));
+
+    if (it->isDeleted()) {
+      put32(records, 0);
+      continue;
+    }
+
+    //Cached in the handler by build()
+    const vector<FileHandler::Extent> &ext = da.getExtents(*it);
+    put32(records, ext.size());
+
+    for (vector<FileHandler::Extent>::const_iterator e = ext.begin();
+         e != ext.end(); ++e) {
+      put32(extents, e->fileClus);
+      put32(extents, e->fstClus);
+      put32(extents, e->len);
+    }
+  }
+
+  memcpy(header.magic, Magic, sizeof(Magic));
+  header.volID = da.getVolID();
+  header.bytsPerClus = da.getBytsPerClus();
+  header.totClusCnt = da.getTotClusCnt();
+  header.recordCnt = built.size();
+  header.rootCnt = rootCnt;
+  header.lfnCnt = lfns.size() / sizeof(uint32_t);
+  header.extentCnt = extents.size() / sizeof(FileHandler::Extent);
+  header.stringBytes = strings.size();
+  header.fatHash = hash;
+  Header h = header;
+  h.volID = htole32(h.volID);
+  h.bytsPerClus = htole32(h.bytsPerClus);
+  h.totClusCnt = htole32(h.totClusCnt);
+  h.recordCnt = htole32(h.recordCnt);
+  h.rootCnt = htole32(h.rootCnt);
+  h.lfnCnt = htole32(h.lfnCnt);
+  h.extentCnt = htole32(h.extentCnt);
+  h.stringBytes = htole32(h.stringBytes);
+  h.fatHash = htole64(h.fatHash);
+  struct iovec iov[5] = {
+    { &h, sizeof(h) },
+    { records.data(), records.size() },
+    { lfns.data(), lfns.size() },
+    { extents.data(), extents.size() },
+    { (void *) strings.data(), strings.size() }
+  };
+
+  try {
+    LowLevelIO::replaceFile(fileName, iov, 5);
+  } catch (LLIOError &e) {
+    throw FileIOError(e.code(), fileName);
+  }
+}
+FileHandler MetadataIndex::decode(Fat32DataAccess &da, uint32_t i) throw()
+{
+  const uint8_t *lfns = base + sizeof(Header) +
+                        (size_t) header.recordCnt * sizeof(Record);
+  const uint8_t *extents = lfns + (size_t) header.lfnCnt * sizeof(uint32_t);
+  const char *strings = (const char *)(extents + (size_t) header.extentCnt *
+                                       sizeof(FileHandler::Extent));
+  Record r;
+  memcpy(&r, base + sizeof(Header) + (size_t) i * sizeof(Record), sizeof(r));
+  uint32_t flags = le32toh(r.flags);
+  list<uint32_t> lfn;
+
+  for (uint32_t j = 0; j < le32toh(r.lfnCnt); ++j) {
+    uint32_t o;
+    memcpy(&o, lfns + (size_t)(le32toh(r.lfnFirst) + j) * sizeof(o),
+           sizeof(o));
+    lfn.push_back(le32toh(o));
+  }
+
+  FileHandler fh(strings + le32toh(r.shortName), strings + le32toh(r.longName),
+                 0 != (flags & FlagDeleted), 0 != (flags & FlagDir),
+                 le32toh(r.fstClus), le32toh(r.size), le32toh(r.dirClus),
+                 le32toh(r.dirOffset), lfn);
+  fh.setDirPath(strings + le32toh(r.dirPath));
+  fh.setInDeletedDir(0 != (flags & FlagInDeletedDir));
+
+  //Deleted entries' extents depend on -C, so they are never stored
+  if (0 == (flags & FlagDeleted)) {
+    shared_ptr<vector<FileHandler::Extent> > ext(
+      new vector<FileHandler::Extent>(le32toh(r.extCnt)));
+    memcpy(ext->data(), extents + (size_t) le32toh(r.extFirst) *
+           sizeof(FileHandler::Extent),
+           ext->size() * sizeof(FileHandler::Extent));
+
+    for (vector<FileHandler::Extent>::iterator e = ext->begin();
+         e != ext->end(); ++e) {
+      e->fileClus = le32toh(e->fileClus);
+      e->fstClus = le32toh(e->fstClus);
+      e->len = le32toh(e->len);
+    }
+
+    da.seedExtents(fh, ext);
+  }
+
+  return fh;
+}
+/*
+ * Visit the root directory's entries, or with recursive every entry, in
+ * the order of the index.
+ */
+void MetadataIndex::forEach(Fat32DataAccess &da, bool recursive,
+                            const function<void(FileHandler &)> &visit)
+{
+  uint32_t cnt = recursive ? header.recordCnt : header.rootCnt;
+
+  for (uint32_t i = 0; i < cnt; ++i) {
+    if (NULL == base) {
+      visit(built[i]);
+    } else {
+      FileHandler fh = decode(da, i);
+      visit(fh);
+    }
+  }
+}
+size_t MetadataIndex::getCount() throw()
+{
+  return header.recordCnt;
+}
+void MetadataIndex::remove(const string &name) throw()
+{
+  unlink(name.c_str());
+}
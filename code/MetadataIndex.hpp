@@ -0,0 +1,83 @@
+#ifndef METADATAINDEX_HPP
+#define METADATAINDEX_HPP
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <functional>
+#include "Fat32DataAccess.hpp"
+using namespace std;
+/*
+ * Sidecar file holding every directory entry on a volume, live and
+ * deleted, with the extents of the live ones decoded from the FAT, so a
+ * later run can visit them without walking the directories:
+ *   Header, Record[recordCnt], uint32_t LFN offsets[lfnCnt],
+ *   Extent[extentCnt], then the NUL-terminated strings
+ * all little-endian, mapped read-only and decoded in place. The first
+ * rootCnt records are the root directory in on-disk order; the rest are
+ * sorted by path.
+ * An index belongs to the volume with its BS_VolID and the same first
+ * FAT, compared by XXH3 digest. A change that leaves the FAT as it was,
+ * a renamed file say, goes unnoticed, so a run that writes to the
+ * volume removes the index. With no file name, build() keeps the
+ * entries in memory only.
+ */
+class MetadataIndex
+{
+private:
+  struct Header {
+    char magic[8];
+    uint32_t volID;
+    uint32_t bytsPerClus;
+    uint32_t totClusCnt;
+    uint32_t recordCnt;
+    uint32_t rootCnt;
+    uint32_t lfnCnt;
+    uint32_t extentCnt;
+    uint32_t stringBytes;
+    uint64_t fatHash;
+  } __attribute__((__packed__));
+  struct Record {
+    uint32_t shortName;  //Offsets into the strings
+    uint32_t longName;
+    uint32_t dirPath;
+    uint32_t fstClus;
+    uint32_t size;
+    uint32_t dirClus;
+    uint32_t dirOffset;
+    uint32_t flags;
+    uint32_t lfnFirst;
+    uint32_t lfnCnt;
+    uint32_t extFirst;
+    uint32_t extCnt;
+  } __attribute__((__packed__));
+
+  static const char Magic[8];
+  static const uint32_t FlagDir;
+  static const uint32_t FlagDeleted;
+  static const uint32_t FlagInDeletedDir;
+
+  string fileName;
+  const uint8_t *base;     //Mapping of the file, NULL if built this run
+  size_t size;
+  Header header;
+  vector<FileHandler> built;
+
+  static uint64_t fatHash(Fat32DataAccess &da) throw(FileIOError);
+  bool check() throw();
+  FileHandler decode(Fat32DataAccess &da, uint32_t i) throw();
+  void write(Fat32DataAccess &da, uint64_t hash, uint32_t rootCnt)
+  throw(FileIOError);
+
+public:
+  explicit MetadataIndex(const string &name) throw();
+  ~MetadataIndex() throw();
+  bool open(Fat32DataAccess &da) throw(FileIOError);
+  void build(Fat32DataAccess &da, uint32_t threadCnt) throw(FileIOError);
+  void forEach(Fat32DataAccess &da, bool recursive,
+               const function<void(FileHandler &)> &visit);
+  size_t getCount() throw();
+
+  static void remove(const string &name) throw();
+};
+#endif //METADATAINDEX_HPP
@@ -0,0 +1,75 @@
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include "LowLevelIO.hpp"
+#include "BlockDevice.hpp"
+#include "MmapBlockDevice.hpp"
+using namespace std;
+MmapBlockDevice::MmapBlockDevice(int _fd, bool _readOnly) throw(LLIOError)
+  : BlockDevice(_fd), base(NULL), size(0), readOnly(_readOnly)
+{
+  off_t end = lseek(fd, 0, SEEK_END);
+
+  if (-1 == end) {
+    fd = -1;
+    throw LLIOError(errno);
+  }
+
+  size = end;
+  void *mapping = mmap(NULL, size, readOnly ? PROT_READ :
+                       PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+  if (MAP_FAILED == mapping) {
+    fd = -1;
+    throw LLIOError(errno);
+  }
+
+  base = (unsigned char *) mapping;
+}
+MmapBlockDevice::~MmapBlockDevice() throw()
+{
+  if (NULL != base) {
+    munmap(base, size);
+  }
+}
+void MmapBlockDevice::xpread(void *buf, size_t count,
+                             off_t offset) throw(LLIOError, LLIOEOF)
+{
+  if (offset < 0 || (size_t) offset + count > size) {
+    throw LLIOEOF();
+  }
+
+  memcpy(buf, base + offset, count);
+}
+void MmapBlockDevice::xpwrite(void *buf, size_t count,
+                              off_t offset) throw(LLIOError)
+{
+  if (readOnly) {
+    throw LLIOError(EBADF);
+  }
+
+  if (offset < 0 || (size_t) offset + count > size) {
+    throw LLIOError(ENOSPC);
+  }
+
+  memcpy(base + offset, buf, count);
+}
+const void *MmapBlockDevice::map(off_t offset, size_t len) throw()
+{
+  if (offset < 0 || (size_t) offset + len > size) {
+    return NULL;
+  }
+
+  return base + offset;
+}
+void MmapBlockDevice::unmap(const void *addr, size_t len) throw()
+{
+}
+void MmapBlockDevice::sync() throw(LLIOError)
+{
+  if (-1 == msync(base, size, MS_SYNC)) {
+    throw LLIOError(errno);
+  }
+}
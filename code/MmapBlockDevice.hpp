@@ -0,0 +1,27 @@
+#ifndef MMAPBLOCKDEVICE_HPP
+#define MMAPBLOCKDEVICE_HPP
+#include <stdint.h>
+#include "BlockDevice.hpp"
+using namespace std;
+/*
+ * The whole device mapped shared at open. Reads and writes are plain
+ * copies; map() returns pointers into the mapping. A read-only device
+ * is mapped PROT_READ.
+ */
+class MmapBlockDevice : public BlockDevice
+{
+private:
+  unsigned char *base;
+  size_t size;
+  bool readOnly;
+
+public:
+  MmapBlockDevice(int _fd, bool _readOnly) throw(LLIOError);
+  ~MmapBlockDevice() throw();
+  void xpread(void *buf, size_t count, off_t offset) throw(LLIOError, LLIOEOF);
+  void xpwrite(void *buf, size_t count, off_t offset) throw(LLIOError);
+  const void *map(off_t offset, size_t len) throw();
+  void unmap(const void *addr, size_t len) throw();
+  void sync() throw(LLIOError);
+};
+#endif //MMAPBLOCKDEVICE_HPP
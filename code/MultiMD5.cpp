@@ -0,0 +1,231 @@
+#include <stdint.h>
+#include <string.h>
+#include <endian.h>
+#include <vector>
+#include "MultiMD5.hpp"
+using namespace std;
+
+const uint32_t MultiMD5::MaxLanes = 16;
+
+static const uint32_t K[64] = {
+  0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a,
+  0xa8304613, 0xfd469501, 0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+  0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821, 0xf61e2562, 0xc040b340,
+  0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+  0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8,
+  0x676f02d9, 0x8d2a4c8a, 0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+  0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70, 0x289b7ec6, 0xeaa127fa,
+  0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+  0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92,
+  0xffeff47d, 0x85845dd1, 0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+  0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+static const int S[64] = {
+  7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+  5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+  4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+  6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+};
+static const uint32_t IV[4] = {
+  0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476
+};
+
+/*
+ * One MD5 block in every lane. V is a GCC vector of 32-bit lanes, or a
+ * plain uint32_t for one lane; it is inlined into the functions below,
+ * each built for its instruction set. state and words hold lane i of
+ * row r at [r][i].
+ */
+template<typename V>
+static inline __attribute__((always_inline))
+void compressLanes(uint32_t (*state)[16], const uint32_t (*words)[16])
+{
+  V w[16];
+  V s[4];
+
+  for (int i = 0; i < 16; ++i) {
+    memcpy(&w[i], words[i], sizeof(V));
+  }
+
+  for (int i = 0; i < 4; ++i) {
+    memcpy(&s[i], state[i], sizeof(V));
+  }
+
+  V a = s[0], b = s[1], c = s[2], d = s[3];
+#pragma GCC unroll 64
+
+  for (int i = 0; i < 64; ++i) {
+    V f;
+    int g;
+
+    if (i < 16) {
+      f = d ^ (b & (c ^ d));
+      g = i;
+    } else if (i < 32) {
+      f = c ^ (d & (b ^ c));
+      g = (5 * i + 1) & 15;
+    } else if (i < 48) {
+      f = b ^ c ^ d;
+      g = (3 * i + 5) & 15;
+    } else {
+      f = c ^ (b | ~d);
+      g = (7 * i) & 15;
+    }
+
+    V t = a + f + K[i] + w[g];
+    a = d;
+    d = c;
+    c = b;
+    b = b + ((t << S[i]) | (t >> (32 - S[i])));
+  }
+
+  s[0] += a;
+  s[1] += b;
+  s[2] += c;
+  s[3] += d;
+
+  for (int i = 0; i < 4; ++i) {
+    memcpy(state[i], &s[i], sizeof(V));
+  }
+}
+
+static void compress1(uint32_t (*state)[16], const uint32_t (*words)[16])
+{
+  compressLanes<uint32_t>(state, words);
+}
+#if defined(__x86_64__) || defined(__i386__)
+typedef uint32_t Lanes4 __attribute__((vector_size(16)));
+typedef uint32_t Lanes8 __attribute__((vector_size(32)));
+typedef uint32_t Lanes16 __attribute__((vector_size(64)));
+
+__attribute__((target("sse2")))
+static void compress4(uint32_t (*state)[16], const uint32_t (*words)[16])
+{
+  compressLanes<Lanes4>(state, words);
+}
+__attribute__((target("avx2")))
+static void compress8(uint32_t (*state)[16], const uint32_t (*words)[16])
+{
+  compressLanes<Lanes8>(state, words);
+}
+__attribute__((target("avx512f")))
+static void compress16(uint32_t (*state)[16], const uint32_t (*words)[16])
+{
+  compressLanes<Lanes16>(state, words);
+}
+#endif
+
+MultiMD5::MultiMD5() throw()
+  : lanes(1), compress(&compress1), impl("scalar")
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("avx512f")) {
+    lanes = 16;
+    compress = &compress16;
+    impl = "avx512";
+  } else if (__builtin_cpu_supports("avx2")) {
+    lanes = 8;
+    compress = &compress8;
+    impl = "avx2";
+  } else if (__builtin_cpu_supports("sse2")) {
+    lanes = 4;
+    compress = &compress4;
+    impl = "sse2";
+  }
+
+#endif
+}
+/*
+ * Fill in the digest of every job.
+ */
+void MultiMD5::hash(vector<Job> &jobs) const throw()
+{
+  struct Lane {
+    Job *job;
+    size_t block;      //Next block to hash
+    size_t blockCnt;   //Blocks with padding
+    size_t fullBytes;  //Bytes hashed straight from job->data
+    uint8_t tail[128]; //The rest of the data, padded
+  };
+  Lane lane[MaxLanes];
+  uint32_t state[4][16] __attribute__((aligned(64)));
+  uint32_t words[16][16] __attribute__((aligned(64)));
+  size_t next = 0;
+  uint32_t busy = 0;
+
+  for (uint32_t l = 0; l < lanes; ++l) {
+    lane[l].job = NULL;
+  }
+
+  memset(state, 0, sizeof(state));
+  memset(words, 0, sizeof(words));
+
+  while (true) {
+    for (uint32_t l = 0; l < lanes; ++l) {
+      Lane &ln = lane[l];
+
+      if (NULL == ln.job && next < jobs.size()) {
+        ln.job = &jobs[next++];
+        ln.block = 0;
+        ln.blockCnt = (ln.job->len + 8) / 64 + 1;
+        ln.fullBytes = ln.job->len / 64 * 64;
+        size_t rest = ln.job->len - ln.fullBytes;
+        memset(ln.tail, 0, sizeof(ln.tail));
+        memcpy(ln.tail, ln.job->data + ln.fullBytes, rest);
+        ln.tail[rest] = 0x80;
+        uint64_t bits = htole64((uint64_t) ln.job->len * 8);
+        memcpy(ln.tail + (ln.blockCnt * 64 - ln.fullBytes) - 8, &bits, 8);
+
+        for (int r = 0; r < 4; ++r) {
+          state[r][l] = IV[r];
+        }
+
+        busy++;
+      }
+
+      if (NULL == ln.job) {
+        continue;
+      }
+
+      const uint8_t *p = ln.block * 64 < ln.fullBytes ?
+                         ln.job->data + ln.block * 64 :
+                         ln.tail + (ln.block * 64 - ln.fullBytes);
+
+      for (int i = 0; i < 16; ++i) {
+        uint32_t v;
+        memcpy(&v, p + 4 * i, 4);
+        words[i][l] = le32toh(v);
+      }
+    }
+
+    if (0 == busy) {
+      break;
+    }
+
+    compress(state, words);
+
+    for (uint32_t l = 0; l < lanes; ++l) {
+      Lane &ln = lane[l];
+
+      if (NULL != ln.job && ++ln.block == ln.blockCnt) {
+        for (int r = 0; r < 4; ++r) {
+          uint32_t v = htole32(state[r][l]);
+          memcpy(ln.job->digest + 4 * r, &v, 4);
+        }
+
+        ln.job = NULL;
+        busy--;
+      }
+    }
+  }
+}
+uint32_t MultiMD5::getLanes() const throw()
+{
+  return lanes;
+}
+const char *MultiMD5::getImpl() const throw()
+{
+  return impl;
+}
@@ -0,0 +1,38 @@
+#ifndef MULTIMD5_HPP
+#define MULTIMD5_HPP
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+using namespace std;
+/*
+ * Computes the MD5 of many buffers at once, one buffer per 32-bit lane
+ * of a vector register: 16 lanes with AVX-512, 8 with AVX2, 4 with SSE2,
+ * and a single lane elsewhere. A lane that finishes its buffer takes the
+ * next one, so buffers of different lengths keep every lane busy. The
+ * widest instruction set the CPU has is picked once, at construction.
+ */
+class MultiMD5
+{
+public:
+  struct Job {
+    const uint8_t *data;
+    size_t len;
+    uint8_t digest[16];
+  };
+
+private:
+  typedef void (*Compress)(uint32_t (*state)[16], const uint32_t (*words)[16]);
+
+  uint32_t lanes;
+  Compress compress;
+  const char *impl;
+
+public:
+  static const uint32_t MaxLanes;
+
+  MultiMD5() throw();
+  void hash(vector<Job> &jobs) const throw();
+  uint32_t getLanes() const throw();
+  const char *getImpl() const throw();
+};
+#endif //MULTIMD5_HPP
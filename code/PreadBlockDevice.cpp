@@ -0,0 +1,23 @@
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "LowLevelIO.hpp"
+#include "BlockDevice.hpp"
+#include "PreadBlockDevice.hpp"
+using namespace std;
+PreadBlockDevice::PreadBlockDevice(int _fd) throw() : BlockDevice(_fd) {}
+PreadBlockDevice::~PreadBlockDevice() throw() {}
+void PreadBlockDevice::xpread(void *buf, size_t count,
+                              off_t offset) throw(LLIOError, LLIOEOF)
+{
+  LowLevelIO::xpread(fd, buf, count, offset);
+}
+void PreadBlockDevice::xpwrite(void *buf, size_t count,
+                               off_t offset) throw(LLIOError)
+{
+  LowLevelIO::xpwrite(fd, buf, count, offset);
+}
+void PreadBlockDevice::xpreadv(const struct iovec *iov, int iovcnt,
+                               off_t offset) throw(LLIOError, LLIOEOF)
+{
+  LowLevelIO::xpreadv(fd, iov, iovcnt, offset);
+}
@@ -0,0 +1,16 @@
+#ifndef PREADBLOCKDEVICE_HPP
+#define PREADBLOCKDEVICE_HPP
+#include <sys/uio.h>
+#include "BlockDevice.hpp"
+using namespace std;
+class PreadBlockDevice : public BlockDevice
+{
+public:
+  explicit PreadBlockDevice(int _fd) throw();
+  ~PreadBlockDevice() throw();
+  void xpread(void *buf, size_t count, off_t offset) throw(LLIOError, LLIOEOF);
+  void xpwrite(void *buf, size_t count, off_t offset) throw(LLIOError);
+  void xpreadv(const struct iovec *iov, int iovcnt,
+               off_t offset) throw(LLIOError, LLIOEOF);
+};
+#endif //PREADBLOCKDEVICE_HPP
@@ -5,8 +5,9 @@
 #include "PrintBootSectorInfo.hpp"
 using namespace std;
 PrintBootSectorInfo::
-PrintBootSectorInfo(const string &devName)  throw (FileIOError)
-  : Fat32Action(devName)
+PrintBootSectorInfo(const string &devName, const DeviceOptions &opts)
+throw (FileIOError)
+  : Fat32Action(devName, opts)
 {
 }
 PrintBootSectorInfo::
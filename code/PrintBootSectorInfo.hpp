@@ -6,7 +6,8 @@ using namespace std;
 class PrintBootSectorInfo : public Fat32Action
 {
 public:
-  PrintBootSectorInfo(const string &devName) throw (FileIOError);
+  PrintBootSectorInfo(const string &devName, const DeviceOptions &opts)
+  throw (FileIOError);
   ~PrintBootSectorInfo() throw();
   void run()  throw(FileIOError, Fat32ActionError);
 };
@@ -0,0 +1,610 @@
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <endian.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <utility>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <iostream>
+#include <cctype>
+#include "Fat32Action.hpp"
+#include "Fat32DataAccess.hpp"
+#include "MetadataIndex.hpp"
+#include "BatchRecovery.hpp"
+#include "FileDigester.hpp"
+#include "Digest.hpp"
+#include "RecoveryServer.hpp"
+using namespace std;
+
+const uint8_t RecoveryServer::OpList = 1;
+const uint8_t RecoveryServer::OpLookup = 2;
+const uint8_t RecoveryServer::OpRead = 3;
+const uint8_t RecoveryServer::OpRecover = 4;
+const uint8_t RecoveryServer::StatusOK = 0;
+const uint8_t RecoveryServer::StatusError = 1;
+const uint32_t RecoveryServer::MaxRequest = 64 << 10;
+const uint32_t RecoveryServer::MaxRead = 16 << 20;
+
+/*
+ * Arguments of one request, taken in order; running past the end makes
+ * the request malformed.
+ */
+class RecoveryServer::Request
+{
+private:
+  const string &body;
+  size_t pos;
+
+  const char *take(size_t len) throw(Fat32ActionError)
+  {
+    if (body.length() - pos < len) {
+      throw Fat32ActionError("malformed request");
+    }
+
+    pos += len;
+    return body.data() + pos - len;
+  }
+
+public:
+  explicit Request(const string &b) throw() : body(b), pos(0) {}
+  uint8_t u8() throw(Fat32ActionError)
+  {
+    return *(const uint8_t *) take(1);
+  }
+  uint32_t u32() throw(Fat32ActionError)
+  {
+    uint32_t v;
+    memcpy(&v, take(sizeof(v)), sizeof(v));
+    return le32toh(v);
+  }
+  string str() throw(Fat32ActionError)
+  {
+    uint16_t len;
+    memcpy(&len, take(sizeof(len)), sizeof(len));
+    len = le16toh(len);
+    return string(take(len), len);
+  }
+  void end() throw(Fat32ActionError)
+  {
+    if (pos != body.length()) {
+      throw Fat32ActionError("malformed request");
+    }
+  }
+};
+
+static void putU8(string &out, uint8_t v)
+{
+  out.push_back((char) v);
+}
+static void putU32(string &out, uint32_t v)
+{
+  v = htole32(v);
+  out.append((const char *) &v, sizeof(v));
+}
+static void putStr(string &out, const string &s)
+{
+  uint16_t len = s.length() > 0xFFFF ? 0xFFFF : s.length();
+  uint16_t v = htole16(len);
+  out.append((const char *) &v, sizeof(v));
+  out.append(s, 0, len);
+}
+static void putEntry(string &out, FileHandler &fh)
+{
+  putU32(out, fh.getDirClus());
+  putU32(out, fh.getDirOffset());
+  putU32(out, fh.getFstClus());
+  putU32(out, fh.getSize());
+  putU8(out, (fh.isDirectory() ? 1 : 0) | (fh.isDeleted() ? 2 : 0));
+  putStr(out, fh.getShortName());
+  putStr(out, fh.getLongName());
+  putStr(out, fh.getDirPath());
+}
+static bool readAll(int fd, void *buf, size_t len)
+{
+  uint8_t *p = (uint8_t *) buf;
+
+  while (len > 0) {
+    ssize_t r = ::read(fd, p, len);
+
+    if (r < 0 && EINTR == errno) {
+      continue;
+    } else if (r <= 0) {
+      return false;
+    }
+
+    p += r;
+    len -= r;
+  }
+
+  return true;
+}
+//MSG_NOSIGNAL: a client gone away must not kill the server with SIGPIPE
+static bool writeAll(int fd, const void *buf, size_t len)
+{
+  const uint8_t *p = (const uint8_t *) buf;
+
+  while (len > 0) {
+    ssize_t r = send(fd, p, len, MSG_NOSIGNAL);
+
+    if (r < 0 && EINTR == errno) {
+      continue;
+    } else if (r <= 0) {
+      return false;
+    }
+
+    p += r;
+    len -= r;
+  }
+
+  return true;
+}
+
+RecoveryServer::Volume::Volume() throw()
+  : da(NULL), rootCnt(0), loaded(false)
+{
+  pthread_rwlock_init(&lock, NULL);
+}
+RecoveryServer::Volume::~Volume() throw()
+{
+  pthread_rwlock_destroy(&lock);
+}
+RecoveryServer::RecoveryServer(const string &devName,
+                               const DeviceOptions &opts,
+                               const string &sock) throw(FileIOError)
+  : Fat32Action(devName, opts), sockName(sock), devOpts(opts)
+{
+}
+RecoveryServer::~RecoveryServer() throw() {}
+/*
+ * Read every directory entry of vol and index them. The -d volume goes
+ * through the -I index, if any, while nothing was written to it.
+ */
+void RecoveryServer::load(Volume &vol, bool isDefault) throw(FileIOError,
+    Fat32ActionError)
+{
+  string name = isDefault && !vol.da->isModified() ? indexName : "";
+  MetadataIndex index(name);
+
+  if (name.empty() || !index.open(*vol.da)) {
+    index.build(*vol.da, threadCnt);
+  }
+
+  vol.entries.clear();
+  vol.byEntry.clear();
+  vol.byName.clear();
+  vol.byShortTail.clear();
+  vol.rootCnt = 0;
+  index.forEach(*vol.da, false, [&](FileHandler &fh) {
+    vol.rootCnt++;
+  });
+  index.forEach(*vol.da, true, [&](FileHandler &fh) {
+    vol.entries.push_back(fh);
+  });
+
+  for (size_t i = 0; i < vol.entries.size(); ++i) {
+    FileHandler &fh = vol.entries[i];
+    string shortName = fh.getShortName();
+    vol.byEntry[make_pair(fh.getDirClus(), fh.getDirOffset())] = i;
+    vol.byName[shortName].push_back(i);
+
+    if (fh.hasLongName() && fh.getLongName() != shortName) {
+      vol.byName[fh.getLongName()].push_back(i);
+    }
+
+    if (fh.isDeleted() && !shortName.empty()) {
+      vol.byShortTail[shortName.substr(1)].push_back(i);
+    }
+  }
+
+#ifdef DEBUG
+  cout << "\x1b[7m";
+  cout << vol.entries.size() << " entries loaded, " << vol.rootCnt
+       << " in the root directory" << endl;
+  cout << "\x1b[0m";
+#endif //DEBUG
+}
+/*
+ * The volume called name, opened and loaded the first time it is asked
+ * for. Only the slot is made under volumesLock; the scan runs under the
+ * volume's own loadLock, so it holds up only requests on that volume.
+ * A volume that fails to open is tried again by the next request.
+ * Volumes are never closed, so the reference stays valid.
+ */
+RecoveryServer::Volume &RecoveryServer::getVolume(const string &name)
+throw(FileIOError, Fat32ActionError)
+{
+  Volume *vol;
+  {
+    lock_guard<mutex> guard(volumesLock);
+    unique_ptr<Volume> &slot = volumes[name];
+
+    if (!slot) {
+      slot.reset(new Volume());
+    }
+
+    vol = slot.get();
+  }
+
+  if (vol->loaded.load(memory_order_acquire)) {
+    return *vol;
+  }
+
+  lock_guard<mutex> guard(vol->loadLock);
+
+  if (!vol->loaded.load(memory_order_relaxed)) {
+    if (name.empty()) {
+      vol->da = &fat32DA;
+    } else if (!vol->owned) {
+      vol->owned.reset(new Fat32DataAccess(name, devOpts));
+      vol->da = vol->owned.get();
+    }
+
+    load(*vol, name.empty());
+    vol->loaded.store(true, memory_order_release);
+  }
+
+  return *vol;
+}
+void RecoveryServer::list(Volume &vol, bool all, string &out) throw()
+{
+  size_t cnt = all ? vol.entries.size() : vol.rootCnt;
+  putU32(out, cnt);
+
+  for (size_t i = 0; i < cnt; ++i) {
+    putEntry(out, vol.entries[i]);
+  }
+}
+void RecoveryServer::lookup(Volume &vol, const string &name,
+                            string &out) throw()
+{
+  set<size_t> found;
+  unordered_map<string, vector<size_t> >::iterator it = vol.byName.find(name);
+
+  if (it != vol.byName.end()) {
+    found.insert(it->second.begin(), it->second.end());
+  }
+
+  if (BatchRecovery::isShortName(name)) {
+    it = vol.byShortTail.find(name.substr(1));
+
+    if (it != vol.byShortTail.end()) {
+      found.insert(it->second.begin(), it->second.end());
+    }
+  }
+
+  putU32(out, found.size());
+
+  for (set<size_t>::iterator i = found.begin(); i != found.end(); ++i) {
+    putEntry(out, vol.entries[*i]);
+  }
+}
+void RecoveryServer::read(Volume &vol, uint32_t dirClus, uint32_t dirOffset,
+                          uint32_t offset, uint32_t count, string &out)
+throw(FileIOError, Fat32ActionError)
+{
+  map<pair<uint32_t, uint32_t>, size_t>::iterator it =
+    vol.byEntry.find(make_pair(dirClus, dirOffset));
+
+  if (it == vol.byEntry.end()) {
+    throw Fat32ActionError("no such directory entry");
+  }
+
+  //A copy, so the offset and extents are this request's own
+  FileHandler fh = vol.entries[it->second];
+
+  if (fh.isDirectory()) {
+    throw Fat32ActionError("is a directory");
+  }
+
+  uint32_t left = offset < fh.getSize() ? fh.getSize() - offset : 0;
+  count = count < left ? count : left;
+  count = count < MaxRead ? count : MaxRead;
+  string data(count, '\0');
+  size_t got = 0;
+  fh.setOffset(offset);
+
+  try {
+    while (got < count) {
+      ssize_t r = vol.da->fs32read(fh, &data[got], count - got);
+
+      if (r <= 0) {
+        break;
+      }
+
+      got += r;
+    }
+  } catch (ClusterOccupied &e) {
+    throw Fat32ActionError("clusters of the file are in use");
+  } catch (BrokenFATChain &e) {
+    throw Fat32ActionError("broken FAT chain");
+  }
+
+  putU32(out, got);
+  out.append(data, 0, got);
+}
+/*
+ * Recover one file as a one-line -M manifest would, then rescan the
+ * volume so later requests see the entry restored.
+ */
+string RecoveryServer::recover(Volume &vol, bool isDefault,
+                               const string &name, const string &digest,
+                               const string &alg)
+throw(FileIOError, Fat32ActionError)
+{
+  string algorithm = alg.empty() ? "md5" : alg;
+
+  if (!Digest::isAlgorithm(algorithm)) {
+    throw Fat32ActionError("unknown digest algorithm " + algorithm);
+  }
+
+  string wanted;
+
+  if (!digest.empty()) {
+    unique_ptr<Digest> d(Digest::create(algorithm));
+    vector<uint8_t> bytes;
+
+    if (!Digest::fromHex(digest, bytes) || bytes.size() != d->getSize()) {
+      throw Fat32ActionError("not a " + string(d->getName()) +
+                             " digest in hex");
+    }
+
+    wanted = Digest::toHex(&bytes[0], bytes.size());
+  }
+
+  //Deleted entries by long name, then by the rest of an 8.3 name
+  vector<size_t> matches;
+  vector<bool> byLongName;
+  set<size_t> seen;
+  unordered_map<string, vector<size_t> >::iterator it = vol.byName.find(name);
+
+  if (it != vol.byName.end()) {
+    for (vector<size_t>::iterator i = it->second.begin();
+         i != it->second.end(); ++i) {
+      FileHandler &fh = vol.entries[*i];
+
+      if (fh.isDeleted() && fh.hasLongName() && name == fh.getLongName()) {
+        matches.push_back(*i);
+        byLongName.push_back(true);
+        seen.insert(*i);
+      }
+    }
+  }
+
+  if (BatchRecovery::isShortName(name)) {
+    it = vol.byShortTail.find(name.substr(1));
+
+    if (it != vol.byShortTail.end()) {
+      for (vector<size_t>::iterator i = it->second.begin();
+           i != it->second.end(); ++i) {
+        if (0 == seen.count(*i)) {
+          matches.push_back(*i);
+          byLongName.push_back(false);
+        }
+      }
+    }
+  }
+
+  if (matches.empty()) {
+    return name + ": error - file not found";
+  }
+
+  FileDigester digester(*vol.da, algorithm);
+  size_t chosen = matches.size();
+
+  if (wanted.empty()) {
+    if (matches.size() > 1) {
+      return name + ": error - ambiguous";
+    }
+
+    chosen = 0;
+  } else {
+    for (size_t i = 0; i < matches.size() && chosen == matches.size(); ++i) {
+      FileHandler fh = vol.entries[matches[i]];
+
+      try {
+        if (Fat32DataAccess::ReadOK == vol.da->getReadStatus(fh) &&
+            wanted == digester.digest(fh)) {
+          chosen = i;
+        }
+      } catch (ClusterOccupied &e) {
+      } catch (BrokenFATChain &e) {
+      }
+    }
+
+    if (chosen == matches.size()) {
+      return name + ": error - file not found";
+    }
+  }
+
+  if (!isalnum((unsigned char) name[0])) {
+    return name + ": error - fail to recover";
+  }
+
+  FileHandler fh = vol.entries[matches[chosen]];
+
+  try {
+    vol.da->recover(fh, name[0], byLongName[chosen]);
+  } catch (ClusterOccupied &e) {
+    return name + ": error - fail to recover";
+  } catch (BrokenFATChain &e) {
+    return name + ": error - fail to recover";
+  }
+
+  if (isDefault && !indexName.empty()) {
+    MetadataIndex::remove(indexName);
+  }
+
+  load(vol, isDefault);
+  return name + (wanted.empty() ? ": recovered" :
+                 ": recovered with " + digester.getName());
+}
+void RecoveryServer::handle(Request &req, string &out) throw(FileIOError,
+    Fat32ActionError)
+{
+  uint8_t op = req.u8();
+
+  if (op < OpList || op > OpRecover) {
+    throw Fat32ActionError("unknown request");
+  }
+
+  string volName = req.str();
+  Volume &vol = getVolume(volName);
+  bool exclusive = OpRecover == op;
+
+  if (exclusive) {
+    pthread_rwlock_wrlock(&vol.lock);
+  } else {
+    pthread_rwlock_rdlock(&vol.lock);
+  }
+
+  try {
+    if (OpList == op) {
+      uint8_t flags = req.u8();
+      req.end();
+      list(vol, 0 != (flags & 1), out);
+    } else if (OpLookup == op) {
+      string name = req.str();
+      req.end();
+      lookup(vol, name, out);
+    } else if (OpRead == op) {
+      uint32_t dirClus = req.u32();
+      uint32_t dirOffset = req.u32();
+      uint32_t offset = req.u32();
+      uint32_t count = req.u32();
+      req.end();
+      read(vol, dirClus, dirOffset, offset, count, out);
+    } else {
+      string name = req.str();
+      string digest = req.str();
+      string alg = req.str();
+      req.end();
+      putStr(out, recover(vol, volName.empty(), name, digest, alg));
+    }
+  } catch (...) {
+    pthread_rwlock_unlock(&vol.lock);
+    throw;
+  }
+
+  pthread_rwlock_unlock(&vol.lock);
+}
+/*
+ * Answer requests on fd until the client closes it or sends something
+ * that is not a request.
+ */
+void RecoveryServer::serve(int fd) throw()
+{
+  while (true) {
+    uint32_t len;
+
+    if (!readAll(fd, &len, sizeof(len))) {
+      break;
+    }
+
+    len = le32toh(len);
+
+    if (0 == len || len > MaxRequest) {
+      break;
+    }
+
+    string body(len, '\0');
+
+    if (!readAll(fd, &body[0], len)) {
+      break;
+    }
+
+    string out(sizeof(uint32_t), '\0');
+    putU8(out, StatusOK);
+
+    try {
+      Request req(body);
+      handle(req, out);
+    } catch (Fat32ActionError &e) {
+      out.resize(sizeof(uint32_t));
+      putU8(out, StatusError);
+      putStr(out, e.what());
+    } catch (FileIOError &e) {
+      out.resize(sizeof(uint32_t));
+      putU8(out, StatusError);
+      putStr(out, e.what());
+    } catch (exception &e) {
+      out.resize(sizeof(uint32_t));
+      putU8(out, StatusError);
+      putStr(out, e.what());
+    }
+
+    uint32_t outLen = htole32(out.length() - sizeof(uint32_t));
+    memcpy(&out[0], &outLen, sizeof(outLen));
+
+    if (!writeAll(fd, out.data(), out.length())) {
+      break;
+    }
+  }
+
+  close(fd);
+}
+void RecoveryServer::run() throw(FileIOError, Fat32ActionError)
+{
+  sockaddr_un addr;
+
+  if (sockName.length() >= sizeof(addr.sun_path)) {
+    throw Fat32ActionError(sockName + ": socket path too long");
+  }
+
+  //Load the -d volume before taking requests
+  getVolume("");
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  if (fd < 0) {
+    throw FileIOError(errno, sockName);
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, sockName.c_str());
+  //A socket left by an earlier server; only the owner may connect
+  unlink(sockName.c_str());
+  mode_t oldMask = umask(077);
+  int ret = bind(fd, (sockaddr *) &addr, sizeof(addr));
+  umask(oldMask);
+
+  if (ret < 0 || listen(fd, SOMAXCONN) < 0) {
+    int err = errno;
+    close(fd);
+    throw FileIOError(err, sockName);
+  }
+
+  cout << "Listening on " << sockName << endl;
+
+  while (true) {
+    int client = accept(fd, NULL, NULL);
+
+    if (client < 0) {
+      if (EINTR == errno || ECONNABORTED == errno) {
+        continue;
+      }
+
+      int err = errno;
+      close(fd);
+      throw FileIOError(err, sockName);
+    }
+
+    try {
+      thread(&RecoveryServer::serve, this, client).detach();
+    } catch (system_error &e) {
+      close(client);
+    }
+  }
+}
@@ -0,0 +1,98 @@
+#ifndef RECOVERYSERVER_HPP
+#define RECOVERYSERVER_HPP
+#include <stdint.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <utility>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include "Fat32Action.hpp"
+using namespace std;
+/*
+ * -S: stay resident and answer requests on a Unix domain socket, so the
+ * volume is opened and its directories walked once instead of on every
+ * run. Each client gets a thread; a connection carries any number of
+ * requests, one at a time.
+ * Every integer is little-endian, a string is a uint16_t length and its
+ * bytes. A request is a uint32_t length of what follows, the opcode
+ * byte and its arguments; a response is a uint32_t length, a status
+ * byte, then the result, or for StatusError a message string.
+ *   OpList     volume, uint8_t flags (1: every directory, not just root)
+ *   OpLookup   volume, name
+ *              entries whose short or long name is name; deleted 8.3
+ *              entries match on all but the first character, as -r
+ *   OpRead     volume, uint32_t dirClus, dirOffset, offset, count
+ *              up to count (at most MaxRead) bytes of the file of that
+ *              directory entry, as a uint32_t length and the bytes
+ *   OpRecover  volume, name, digest, algorithm (both may be empty)
+ *              a result line as -M prints it
+ * OpList and OpLookup answer a uint32_t count of entries, each
+ *   uint32_t dirClus, dirOffset, fstClus, size, uint8_t flags
+ *   (1: directory, 2: deleted), shortName, longName, dirPath.
+ * An empty volume is the one given with -d; any other is a device path,
+ * opened with the same options the first time it is named and kept.
+ * A volume is loaded by the first request naming it; requests on other
+ * volumes go on meanwhile. Requests on a volume share its lock, except
+ * OpRecover which holds it alone and rescans the volume afterwards.
+ */
+class RecoveryServer : public Fat32Action
+{
+private:
+  struct Volume {
+    Fat32DataAccess *da;
+    unique_ptr<Fat32DataAccess> owned;  //NULL for the -d volume
+    vector<FileHandler> entries;        //Root directory first
+    uint32_t rootCnt;
+    map<pair<uint32_t, uint32_t>, size_t> byEntry; //By directory entry
+    unordered_map<string, vector<size_t> > byName;  //Short and long names
+    unordered_map<string, vector<size_t> > byShortTail; //Deleted 8.3 only
+    pthread_rwlock_t lock;
+    mutex loadLock;                     //Held while opening and loading
+    atomic<bool> loaded;
+
+    Volume() throw();
+    ~Volume() throw();
+  };
+  class Request;
+
+  static const uint8_t OpList;
+  static const uint8_t OpLookup;
+  static const uint8_t OpRead;
+  static const uint8_t OpRecover;
+  static const uint8_t StatusOK;
+  static const uint8_t StatusError;
+  static const uint32_t MaxRequest;
+  static const uint32_t MaxRead;
+
+  string sockName;
+  DeviceOptions devOpts;
+  map<string, unique_ptr<Volume> > volumes;
+  mutex volumesLock;
+
+  Volume &getVolume(const string &name) throw(FileIOError,
+      Fat32ActionError);
+  void load(Volume &vol, bool isDefault) throw(FileIOError,
+      Fat32ActionError);
+  void serve(int fd) throw();
+  void handle(Request &req, string &out) throw(FileIOError,
+      Fat32ActionError);
+  void list(Volume &vol, bool all, string &out) throw();
+  void lookup(Volume &vol, const string &name, string &out) throw();
+  void read(Volume &vol, uint32_t dirClus, uint32_t dirOffset,
+            uint32_t offset, uint32_t count, string &out)
+  throw(FileIOError, Fat32ActionError);
+  string recover(Volume &vol, bool isDefault, const string &name,
+                 const string &digest, const string &alg)
+  throw(FileIOError, Fat32ActionError);
+
+public:
+  RecoveryServer(const string &devName, const DeviceOptions &opts,
+                 const string &sock) throw(FileIOError);
+  ~RecoveryServer() throw();
+  void run() throw(FileIOError, Fat32ActionError);
+};
+#endif //RECOVERYSERVER_HPP
@@ -0,0 +1,197 @@
+#include <stdint.h>
+#include <string.h>
+#include <stdexcept>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include "SignatureMatcher.hpp"
+using namespace std;
+
+SignatureMatcher::SignatureMatcher() throw()
+  : maxLen(0), scanImpl(&SignatureMatcher::scanGeneric)
+{
+  memset(firstByte, 0, sizeof(firstByte));
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("avx2")) {
+    scanImpl = &SignatureMatcher::scanAVX2;
+  } else if (__builtin_cpu_supports("sse2")) {
+    scanImpl = &SignatureMatcher::scanSSE2;
+  }
+
+#endif
+}
+void SignatureMatcher::add(const uint8_t *bytes, size_t len, uint32_t id)
+{
+  if (len < 2) {
+    throw logic_error("SignatureMatcher: Pattern shorter than two bytes");
+  }
+
+  Pattern p;
+  p.bytes.assign(bytes, bytes + len);
+  p.id = id;
+  patterns.push_back(p);
+  firstByte[bytes[0]] = true;
+
+  if (len > maxLen) {
+    maxLen = len;
+  }
+
+  for (vector<Prefix>::iterator it = prefixes.begin(); it != prefixes.end();
+       ++it) {
+    if (it->b0 == bytes[0] && it->b1 == bytes[1]) {
+      it->patterns.push_back(patterns.size() - 1);
+      return;
+    }
+  }
+
+  Prefix prefix;
+  prefix.b0 = bytes[0];
+  prefix.b1 = bytes[1];
+  prefix.patterns.push_back(patterns.size() - 1);
+  prefixes.push_back(prefix);
+}
+/*
+ * Append to out every match that lies wholly inside data, in order of
+ * position.
+ */
+void SignatureMatcher::scan(const uint8_t *data, size_t len,
+                            vector<Match> &out) const
+{
+  if (len >= 2 && !prefixes.empty()) {
+    (this->*scanImpl)(data, len, out);
+  }
+}
+size_t SignatureMatcher::getMaxLen() const throw()
+{
+  return maxLen;
+}
+const char *SignatureMatcher::getImpl() const throw()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  if (&SignatureMatcher::scanAVX2 == scanImpl) {
+    return "avx2";
+  } else if (&SignatureMatcher::scanSSE2 == scanImpl) {
+    return "sse2";
+  }
+
+#endif
+  return "scalar";
+}
+void SignatureMatcher::verify(const uint8_t *data, size_t len, size_t pos,
+                              uint32_t prefix, vector<Match> &out) const
+throw()
+{
+  const vector<uint32_t> &cands = prefixes[prefix].patterns;
+
+  for (vector<uint32_t>::const_iterator it = cands.begin(); it != cands.end();
+       ++it) {
+    const vector<uint8_t> &bytes = patterns[*it].bytes;
+
+    if (pos + bytes.size() <= len &&
+        0 == memcmp(data + pos + 2, bytes.data() + 2, bytes.size() - 2)) {
+      Match m = { pos, patterns[*it].id };
+      out.push_back(m);
+    }
+  }
+}
+/*
+ * Positions from on, one at a time; also finishes the vector loops.
+ */
+void SignatureMatcher::scanScalar(const uint8_t *data, size_t len,
+                                  size_t from, vector<Match> &out) const
+{
+  for (size_t i = from; i + 1 < len; ++i) {
+    if (!firstByte[data[i]]) {
+      continue;
+    }
+
+    for (uint32_t p = 0; p < prefixes.size(); ++p) {
+      if (prefixes[p].b0 == data[i] && prefixes[p].b1 == data[i + 1]) {
+        verify(data, len, i, p, out);
+      }
+    }
+  }
+}
+void SignatureMatcher::scanGeneric(const uint8_t *data, size_t len,
+                                   vector<Match> &out) const
+{
+  scanScalar(data, len, 0, out);
+}
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2")))
+void SignatureMatcher::scanSSE2(const uint8_t *data, size_t len,
+                                vector<Match> &out) const
+{
+  size_t i = 0;
+
+  //The second byte of the last position in a block is one past it
+  for (; i + 17 <= len; i += 16) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(data + i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(data + i + 1));
+    __m128i eq = _mm_setzero_si128();
+
+    for (uint32_t p = 0; p < prefixes.size(); ++p) {
+      __m128i b0 = _mm_set1_epi8((char) prefixes[p].b0);
+      __m128i b1 = _mm_set1_epi8((char) prefixes[p].b1);
+      eq = _mm_or_si128(eq, _mm_and_si128(_mm_cmpeq_epi8(a, b0),
+                                          _mm_cmpeq_epi8(b, b1)));
+    }
+
+    uint32_t mask = _mm_movemask_epi8(eq);
+
+    //Rare; sort out which prefix it was one position at a time
+    while (0 != mask) {
+      uint32_t j = __builtin_ctz(mask);
+      mask &= mask - 1;
+
+      for (uint32_t p = 0; p < prefixes.size(); ++p) {
+        if (prefixes[p].b0 == data[i + j] &&
+            prefixes[p].b1 == data[i + j + 1]) {
+          verify(data, len, i + j, p, out);
+        }
+      }
+    }
+  }
+
+  scanScalar(data, len, i, out);
+}
+__attribute__((target("avx2")))
+void SignatureMatcher::scanAVX2(const uint8_t *data, size_t len,
+                                vector<Match> &out) const
+{
+  size_t i = 0;
+
+  for (; i + 33 <= len; i += 32) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(data + i));
+    __m256i b = _mm256_loadu_si256((const __m256i *)(data + i + 1));
+    __m256i eq = _mm256_setzero_si256();
+
+    for (uint32_t p = 0; p < prefixes.size(); ++p) {
+      __m256i b0 = _mm256_set1_epi8((char) prefixes[p].b0);
+      __m256i b1 = _mm256_set1_epi8((char) prefixes[p].b1);
+      eq = _mm256_or_si256(eq, _mm256_and_si256(_mm256_cmpeq_epi8(a, b0),
+                                                _mm256_cmpeq_epi8(b, b1)));
+    }
+
+    uint32_t mask = _mm256_movemask_epi8(eq);
+
+    //Rare; sort out which prefix it was one position at a time
+    while (0 != mask) {
+      uint32_t j = __builtin_ctz(mask);
+      mask &= mask - 1;
+
+      for (uint32_t p = 0; p < prefixes.size(); ++p) {
+        if (prefixes[p].b0 == data[i + j] &&
+            prefixes[p].b1 == data[i + j + 1]) {
+          verify(data, len, i + j, p, out);
+        }
+      }
+    }
+  }
+
+  scanScalar(data, len, i, out);
+}
+#endif
@@ -0,0 +1,61 @@
+#ifndef SIGNATUREMATCHER_HPP
+#define SIGNATUREMATCHER_HPP
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+using namespace std;
+/*
+ * Finds every occurrence of a set of byte patterns in a buffer.
+ * Candidate positions are those where the first two bytes of some
+ * pattern occur; they are found 32 (AVX2) or 16 (SSE2) positions at a
+ * time, and only those positions are compared in full. The widest
+ * instruction set the CPU has is picked once, at construction; other
+ * architectures use a scalar loop over a first-byte table.
+ * Patterns must be at least two bytes long. scan() may be called from
+ * several threads at once once all patterns are added.
+ */
+class SignatureMatcher
+{
+public:
+  struct Match {
+    size_t pos;
+    uint32_t id;
+  };
+
+private:
+  struct Pattern {
+    vector<uint8_t> bytes;
+    uint32_t id;
+  };
+  struct Prefix {
+    uint8_t b0;
+    uint8_t b1;
+    vector<uint32_t> patterns; //Indices into patterns
+  };
+
+  vector<Pattern> patterns;
+  vector<Prefix> prefixes;
+  bool firstByte[256];
+  size_t maxLen;
+  void (SignatureMatcher::*scanImpl)(const uint8_t *data, size_t len,
+                                     vector<Match> &out) const;
+
+  void verify(const uint8_t *data, size_t len, size_t pos,
+              uint32_t prefix, vector<Match> &out) const throw();
+  void scanScalar(const uint8_t *data, size_t len, size_t from,
+                  vector<Match> &out) const;
+  void scanGeneric(const uint8_t *data, size_t len,
+                   vector<Match> &out) const;
+#if defined(__x86_64__) || defined(__i386__)
+  void scanSSE2(const uint8_t *data, size_t len, vector<Match> &out) const;
+  void scanAVX2(const uint8_t *data, size_t len, vector<Match> &out) const;
+#endif
+
+public:
+  SignatureMatcher() throw();
+  void add(const uint8_t *bytes, size_t len, uint32_t id);
+  void scan(const uint8_t *data, size_t len, vector<Match> &out) const;
+  size_t getMaxLen() const throw();
+  const char *getImpl() const throw();
+};
+#endif //SIGNATUREMATCHER_HPP
@@ -0,0 +1,172 @@
+#include <stdint.h>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include "ThreadPool.hpp"
+using namespace std;
+
+//Index of the pool worker running on this thread, -1 elsewhere
+static thread_local int currentWorker = -1;
+static thread_local ThreadPool *currentPool = NULL;
+
+ThreadPool::ThreadPool(uint32_t threadCnt) throw(system_error)
+  : queued(0),
+    pending(0),
+    nextWorker(0),
+    stopping(false)
+{
+  if (0 == threadCnt) {
+    threadCnt = 1;
+  }
+
+  for (uint32_t i = 0; i < threadCnt; ++i) {
+    workers.push_back(unique_ptr<Worker>(new Worker));
+  }
+
+  for (uint32_t i = 0; i < threadCnt; ++i) {
+    threads.push_back(thread(&ThreadPool::workerLoop, this, i));
+  }
+}
+ThreadPool::~ThreadPool() throw()
+{
+  {
+    unique_lock<mutex> guard(stateLock);
+    stopping = true;
+  }
+  workCond.notify_all();
+
+  for (vector<thread>::iterator it = threads.begin(); it != threads.end();
+       ++it) {
+    it->join();
+  }
+}
+void ThreadPool::submit(const function<void()> &task) throw()
+{
+  uint32_t idx;
+
+  if (this == currentPool) {
+    idx = currentWorker;
+  } else {
+    unique_lock<mutex> guard(stateLock);
+    idx = nextWorker++ % workers.size();
+  }
+
+  {
+    unique_lock<mutex> guard(workers[idx]->lock);
+    workers[idx]->tasks.push_back(task);
+  }
+  {
+    unique_lock<mutex> guard(stateLock);
+    ++queued;
+    ++pending;
+  }
+  workCond.notify_one();
+}
+/*
+ * Own deque first, newest task first; otherwise steal the oldest task
+ * of the next worker that has one.
+ */
+bool ThreadPool::takeTask(uint32_t idx, function<void()> &task) throw()
+{
+  {
+    Worker &own = *workers[idx];
+    unique_lock<mutex> guard(own.lock);
+
+    if (!own.tasks.empty()) {
+      task = own.tasks.back();
+      own.tasks.pop_back();
+      return true;
+    }
+  }
+
+  for (uint32_t i = 1; i < workers.size(); ++i) {
+    Worker &victim = *workers[(idx + i) % workers.size()];
+    unique_lock<mutex> guard(victim.lock);
+
+    if (!victim.tasks.empty()) {
+      task = victim.tasks.front();
+      victim.tasks.pop_front();
+      return true;
+    }
+  }
+
+  return false;
+}
+void ThreadPool::workerLoop(uint32_t idx) throw()
+{
+  currentWorker = idx;
+  currentPool = this;
+
+  while (true) {
+    bool skip;
+    {
+      unique_lock<mutex> guard(stateLock);
+
+      while (0 == queued && !stopping) {
+        workCond.wait(guard);
+      }
+
+      if (stopping) {
+        return;
+      }
+
+      //Claim one task; it is counted only once it sits in a deque
+      --queued;
+      skip = (bool) failure;
+    }
+
+    function<void()> task;
+
+    while (!takeTask(idx, task)) {
+      this_thread::yield();
+    }
+
+    if (!skip) {
+      try {
+        task();
+      } catch (...) {
+        unique_lock<mutex> guard(stateLock);
+
+        if (!failure) {
+          failure = current_exception();
+        }
+      }
+    }
+
+    {
+      unique_lock<mutex> guard(stateLock);
+
+      if (0 == --pending) {
+        doneCond.notify_all();
+      }
+    }
+  }
+}
+void ThreadPool::wait()
+{
+  unique_lock<mutex> guard(stateLock);
+
+  while (0 != pending) {
+    doneCond.wait(guard);
+  }
+
+  if (failure) {
+    exception_ptr e = failure;
+    failure = exception_ptr();
+    rethrow_exception(e);
+  }
+}
+uint32_t ThreadPool::getThreadCnt() throw()
+{
+  return workers.size();
+}
+uint32_t ThreadPool::defaultThreadCnt() throw()
+{
+  uint32_t cnt = thread::hardware_concurrency();
+  return 0 == cnt ? 1 : cnt;
+}
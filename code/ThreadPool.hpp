@@ -0,0 +1,50 @@
+#ifndef THREADPOOL_HPP
+#define THREADPOOL_HPP
+#include <stdint.h>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+using namespace std;
+/*
+ * Fixed set of worker threads with one task deque each.
+ * A task submitted from a worker goes to the back of that worker's own
+ * deque and is picked up LIFO; an idle worker steals from the front of
+ * another worker's deque. wait() returns once every task, including the
+ * ones submitted by tasks, has finished, and rethrows the first
+ * exception a task threw. Tasks still queued after a failure are dropped.
+ */
+class ThreadPool
+{
+private:
+  struct Worker {
+    mutex lock;
+    deque<function<void()> > tasks;
+  };
+  vector<unique_ptr<Worker> > workers;
+  vector<thread> threads;
+  mutex stateLock;
+  condition_variable workCond;
+  condition_variable doneCond;
+  size_t queued;  //Tasks sitting in a deque
+  size_t pending; //Tasks queued or running
+  uint32_t nextWorker;
+  bool stopping;
+  exception_ptr failure;
+
+  void workerLoop(uint32_t idx) throw();
+  bool takeTask(uint32_t idx, function<void()> &task) throw();
+
+public:
+  explicit ThreadPool(uint32_t threadCnt) throw(system_error);
+  ~ThreadPool() throw();
+  void submit(const function<void()> &task) throw();
+  void wait();
+  uint32_t getThreadCnt() throw();
+  static uint32_t defaultThreadCnt() throw();
+};
+#endif //THREADPOOL_HPP
@@ -0,0 +1,366 @@
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <linux/io_uring.h>
+#include "LowLevelIO.hpp"
+#include "BlockDevice.hpp"
+#include "UringBlockDevice.hpp"
+using namespace std;
+
+const unsigned UringBlockDevice::QueueDepth = 128;
+
+static int uringSetup(unsigned entries, struct io_uring_params *p)
+{
+  return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+static int uringEnter(int ringFd, unsigned toSubmit, unsigned minComplete,
+                      unsigned flags)
+{
+  return (int) syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete,
+                       flags, NULL, 0);
+}
+
+UringBlockDevice::UringBlockDevice(int _fd) throw(LLIOError)
+  : BlockDevice(_fd),
+    ringFd(-1),
+    sqRing(MAP_FAILED),
+    sqRingLen(0),
+    cqRing(MAP_FAILED),
+    cqRingLen(0),
+    sqes((struct io_uring_sqe *) MAP_FAILED),
+    sqesLen(0)
+{
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  ringFd = uringSetup(QueueDepth, &p);
+
+  if (-1 == ringFd) {
+    int err = errno;
+    fd = -1;
+    throw LLIOError(err);
+  }
+
+  sqRingLen = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  cqRingLen = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (cqRingLen > sqRingLen) {
+      sqRingLen = cqRingLen;
+    }
+
+    cqRingLen = sqRingLen;
+  }
+
+  sqRing = mmap(NULL, sqRingLen, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+
+  if (MAP_FAILED != sqRing) {
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+      cqRing = sqRing;
+    } else {
+      cqRing = mmap(NULL, cqRingLen, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+    }
+  }
+
+  if (MAP_FAILED != cqRing) {
+    sqesLen = p.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = (struct io_uring_sqe *) mmap(NULL, sqesLen, PROT_READ | PROT_WRITE,
+                                        MAP_SHARED | MAP_POPULATE, ringFd,
+                                        IORING_OFF_SQES);
+  }
+
+  if (MAP_FAILED == (void *) sqes) {
+    int err = errno;
+    release();
+    fd = -1;
+    throw LLIOError(err);
+  }
+
+  unsigned char *sq = (unsigned char *) sqRing;
+  unsigned char *cq = (unsigned char *) cqRing;
+  sqHead = (unsigned *)(sq + p.sq_off.head);
+  sqTail = (unsigned *)(sq + p.sq_off.tail);
+  sqMask = (unsigned *)(sq + p.sq_off.ring_mask);
+  sqArray = (unsigned *)(sq + p.sq_off.array);
+  cqHead = (unsigned *)(cq + p.cq_off.head);
+  cqTail = (unsigned *)(cq + p.cq_off.tail);
+  cqMask = (unsigned *)(cq + p.cq_off.ring_mask);
+  cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+}
+UringBlockDevice::~UringBlockDevice() throw()
+{
+  release();
+}
+void UringBlockDevice::release() throw()
+{
+  if (MAP_FAILED != (void *) sqes) {
+    munmap(sqes, sqesLen);
+  }
+
+  if (MAP_FAILED != cqRing && cqRing != sqRing) {
+    munmap(cqRing, cqRingLen);
+  }
+
+  if (MAP_FAILED != sqRing) {
+    munmap(sqRing, sqRingLen);
+  }
+
+  if (-1 != ringFd) {
+    close(ringFd);
+  }
+
+  sqes = (struct io_uring_sqe *) MAP_FAILED;
+  cqRing = MAP_FAILED;
+  sqRing = MAP_FAILED;
+  ringFd = -1;
+}
+/*
+ * Fill the next submission queue entry; the caller publishes the tail.
+ */
+void UringBlockDevice::queueSqe(uint8_t op, void *buf, size_t count,
+                                off_t offset, uint64_t userData) throw()
+{
+  if (count > (1U << 30)) {
+    count = 1U << 30;
+  }
+
+  unsigned tail = *sqTail;
+  unsigned idx = tail & *sqMask;
+  struct io_uring_sqe *sqe = &sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = op;
+  sqe->fd = fd;
+  sqe->addr = (uintptr_t) buf;
+  sqe->len = count;
+  sqe->off = offset;
+  sqe->user_data = userData;
+  sqArray[idx] = idx;
+  __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+}
+/*
+ * Take back the entries published but not yet consumed by the kernel,
+ * which only reads the queue inside io_uring_enter.
+ * Returns how many were taken back.
+ */
+unsigned UringBlockDevice::withdrawSqes() throw()
+{
+  unsigned tail = *sqTail;
+  unsigned pending = tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+  __atomic_store_n(sqTail, tail - pending, __ATOMIC_RELEASE);
+  return pending;
+}
+/*
+ * Wait for a completion once io_uring_enter has failed. The reads in
+ * flight still own their buffers, so if the ring cannot be waited on
+ * the completion queue is polled.
+ */
+void UringBlockDevice::waitCqe() throw()
+{
+  while (*cqHead == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+    if (-1 == uringEnter(ringFd, 0, 1, IORING_ENTER_GETEVENTS) &&
+        EINTR != errno) {
+      struct timespec pause = { 0, 1000000 };
+      nanosleep(&pause, NULL);
+    }
+  }
+}
+/*
+ * Whether a completion error means the kernel has no such opcode;
+ * IORING_OP_READ and IORING_OP_WRITE arrived in Linux 5.6.
+ */
+static bool isUnsupported(int32_t res)
+{
+  return -EINVAL == res || -EOPNOTSUPP == res;
+}
+/*
+ * Submit one read or write and wait for it, with pread or pwrite if the
+ * kernel does not know the opcode.
+ * Returns the byte count transferred, 0 at end of file.
+ */
+int32_t UringBlockDevice::transfer(uint8_t op, void *buf, size_t count,
+                                   off_t offset) throw(LLIOError)
+{
+  lock_guard<mutex> guard(lock);
+  queueSqe(op, buf, count, offset, 0);
+  unsigned toSubmit = 1;
+
+  while (true) {
+    int ret = uringEnter(ringFd, toSubmit, 1, IORING_ENTER_GETEVENTS);
+
+    if (-1 == ret && EINTR != errno) {
+      int err = errno;
+
+      if (0 != withdrawSqes()) {
+        throw LLIOError(err);
+      }
+
+      //Submitted by an earlier call; buf is the kernel's until it is done
+      toSubmit = 0;
+      waitCqe();
+    } else if (ret > 0) {
+      toSubmit = 0;
+    }
+
+    unsigned head = *cqHead;
+
+    if (head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+      int32_t res = cqes[head & *cqMask].res;
+      __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+
+      if (isUnsupported(res)) {
+        count = count < (1U << 30) ? count : 1U << 30;
+
+        do {
+          res = IORING_OP_READ == op ? pread(fd, buf, count, offset) :
+                pwrite(fd, buf, count, offset);
+        } while (-1 == res && EINTR == errno);
+
+        if (-1 == res) {
+          throw LLIOError(errno);
+        }
+      } else if (res < 0) {
+        throw LLIOError(-res);
+      }
+
+      return res;
+    }
+  }
+}
+void UringBlockDevice::xpread(void *buf, size_t count,
+                              off_t offset) throw(LLIOError, LLIOEOF)
+{
+  while (count != 0) {
+    int32_t readCount = transfer(IORING_OP_READ, buf, count, offset);
+
+    if (0 == readCount) {
+      throw LLIOEOF();
+    }
+
+    buf = (unsigned char *)buf + readCount;
+    count -= readCount;
+    offset += readCount;
+  }
+}
+void UringBlockDevice::xpwrite(void *buf, size_t count,
+                               off_t offset) throw(LLIOError)
+{
+  while (count != 0) {
+    int32_t writeCount = transfer(IORING_OP_WRITE, buf, count, offset);
+    buf = (unsigned char *)buf + writeCount;
+    count -= writeCount;
+    offset += writeCount;
+  }
+}
+/*
+ * Keep up to QueueDepth reads in flight until all of reqs are done.
+ * Short reads are resubmitted for the remainder, and a read the kernel
+ * has no opcode for is done with pread. After an error, io_uring_enter
+ * failing included, nothing more is queued and the reads already in
+ * flight are drained before throwing, since the kernel would otherwise
+ * still write into the caller's buffers.
+ */
+void UringBlockDevice::xpreadBatch(vector<IORequest> &reqs) throw(LLIOError,
+    LLIOEOF)
+{
+  lock_guard<mutex> guard(lock);
+  vector<IORequest> todo(reqs);
+  deque<size_t> ready;
+  unsigned inFlight = 0;
+  unsigned toSubmit = 0;
+  int err = 0;
+  bool eof = false;
+
+  for (size_t i = 0; i < todo.size(); ++i) {
+    if (0 != todo[i].count) {
+      ready.push_back(i);
+    }
+  }
+
+  while (!ready.empty() || 0 != inFlight) {
+    while (0 == err && !eof && !ready.empty() && inFlight < QueueDepth) {
+      size_t i = ready.front();
+      ready.pop_front();
+      queueSqe(IORING_OP_READ, todo[i].buf, todo[i].count, todo[i].offset, i);
+      ++toSubmit;
+      ++inFlight;
+    }
+
+    if (0 == inFlight) {
+      break;
+    }
+
+    int ret = uringEnter(ringFd, toSubmit, 1, IORING_ENTER_GETEVENTS);
+
+    if (-1 == ret && EINTR != errno) {
+      if (0 == err) {
+        err = errno;
+      }
+
+      //Only what the kernel consumed is in flight
+      inFlight -= withdrawSqes();
+      toSubmit = 0;
+
+      if (0 == inFlight) {
+        break;
+      }
+
+      waitCqe();
+    } else if (ret > 0) {
+      toSubmit -= ((unsigned) ret < toSubmit) ? ret : toSubmit;
+    }
+
+    unsigned head = *cqHead;
+
+    while (head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+      struct io_uring_cqe &cqe = cqes[head & *cqMask];
+      size_t i = cqe.user_data;
+      int32_t res = cqe.res;
+      ++head;
+      --inFlight;
+
+      if (isUnsupported(res)) {
+        if (0 != err || eof) {
+          continue; //Failing anyway; only the draining matters
+        }
+
+        try {
+          LowLevelIO::xpread(fd, todo[i].buf, todo[i].count, todo[i].offset);
+        } catch (LLIOError &e) {
+          err = e.code().value();
+        } catch (LLIOEOF &e) {
+          eof = true;
+        }
+      } else if (res < 0) {
+        if (0 == err) {
+          err = -res;
+        }
+      } else if (0 == res) {
+        eof = true;
+      } else if ((size_t) res < todo[i].count) {
+        todo[i].buf = (unsigned char *) todo[i].buf + res;
+        todo[i].count -= res;
+        todo[i].offset += res;
+        ready.push_back(i);
+      }
+    }
+
+    __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+  }
+
+  if (0 != err) {
+    throw LLIOError(err);
+  }
+
+  if (eof) {
+    throw LLIOEOF();
+  }
+}
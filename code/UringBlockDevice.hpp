@@ -0,0 +1,56 @@
+#ifndef URINGBLOCKDEVICE_HPP
+#define URINGBLOCKDEVICE_HPP
+#include <stdint.h>
+#include <vector>
+#include <mutex>
+#include <linux/io_uring.h>
+#include "BlockDevice.hpp"
+using namespace std;
+/*
+ * Reads and writes submitted through an io_uring instance.
+ * The ring is driven with the raw system calls, so no liburing is
+ * needed. The constructor throws LLIOError if the kernel does not
+ * support io_uring.
+ * xpreadBatch() keeps up to QueueDepth reads in flight, refilling the
+ * submission queue as completions are reaped. On kernels without
+ * IORING_OP_READ or IORING_OP_WRITE each transfer falls back to pread
+ * or pwrite.
+ */
+class UringBlockDevice : public BlockDevice
+{
+private:
+  int ringFd;
+  void *sqRing;
+  size_t sqRingLen;
+  void *cqRing;
+  size_t cqRingLen;
+  struct io_uring_sqe *sqes;
+  size_t sqesLen;
+  unsigned *sqHead;
+  unsigned *sqTail;
+  unsigned *sqMask;
+  unsigned *sqArray;
+  unsigned *cqHead;
+  unsigned *cqTail;
+  unsigned *cqMask;
+  struct io_uring_cqe *cqes;
+  mutex lock;
+
+  void release() throw();
+  void queueSqe(uint8_t op, void *buf, size_t count, off_t offset,
+                uint64_t userData) throw();
+  unsigned withdrawSqes() throw();
+  void waitCqe() throw();
+  int32_t transfer(uint8_t op, void *buf, size_t count,
+                   off_t offset) throw(LLIOError);
+
+public:
+  static const unsigned QueueDepth;
+
+  explicit UringBlockDevice(int _fd) throw(LLIOError);
+  ~UringBlockDevice() throw();
+  void xpread(void *buf, size_t count, off_t offset) throw(LLIOError, LLIOEOF);
+  void xpwrite(void *buf, size_t count, off_t offset) throw(LLIOError);
+  void xpreadBatch(vector<IORequest> &reqs) throw(LLIOError, LLIOEOF);
+};
+#endif //URINGBLOCKDEVICE_HPP
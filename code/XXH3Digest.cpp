@@ -0,0 +1,258 @@
+#include <stdint.h>
+#include <string.h>
+#include <endian.h>
+#include "Digest.hpp"
+#include "XXH3Digest.hpp"
+using namespace std;
+
+const size_t XXH3Digest::StripeLen = 64;
+const size_t XXH3Digest::MidSizeMax = 240;
+
+static const uint8_t Secret[192] = {
+  0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c,
+  0xf7, 0x21, 0xad, 0x1c, 0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb,
+  0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f, 0xcb, 0x79, 0xe6, 0x4e,
+  0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+  0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6,
+  0x81, 0x3a, 0x26, 0x4c, 0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb,
+  0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3, 0x71, 0x64, 0x48, 0x97,
+  0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+  0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7,
+  0xc7, 0x0b, 0x4f, 0x1d, 0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31,
+  0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64, 0xea, 0xc5, 0xac, 0x83,
+  0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+  0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26,
+  0x29, 0xd4, 0x68, 0x9e, 0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc,
+  0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce, 0x45, 0xcb, 0x3a, 0x8f,
+  0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e
+};
+static const uint32_t Prime32_1 = 0x9E3779B1U;
+static const uint32_t Prime32_2 = 0x85EBCA77U;
+static const uint32_t Prime32_3 = 0xC2B2AE3DU;
+static const uint64_t Prime64_1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t Prime64_2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t Prime64_3 = 0x165667B19E3779F9ULL;
+static const uint64_t Prime64_4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t Prime64_5 = 0x27D4EB2F165667C5ULL;
+static const uint64_t PrimeMx1 = 0x165667919E3779F9ULL;
+static const uint64_t PrimeMx2 = 0x9FB21C651E98DF25ULL;
+static const size_t StripesPerBlock = (sizeof(Secret) - 64) / 8;
+
+static uint32_t read32(const uint8_t *p)
+{
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return le32toh(v);
+}
+static uint64_t read64(const uint8_t *p)
+{
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return le64toh(v);
+}
+static uint64_t rotl64(uint64_t v, int r)
+{
+  return (v << r) | (v >> (64 - r));
+}
+static uint64_t mulFold64(uint64_t a, uint64_t b)
+{
+  unsigned __int128 p = (unsigned __int128) a * b;
+  return (uint64_t) p ^ (uint64_t)(p >> 64);
+}
+static uint64_t xxh64Avalanche(uint64_t h)
+{
+  h ^= h >> 33;
+  h *= Prime64_2;
+  h ^= h >> 29;
+  h *= Prime64_3;
+  return h ^ (h >> 32);
+}
+static uint64_t avalanche(uint64_t h)
+{
+  h ^= h >> 37;
+  h *= PrimeMx1;
+  return h ^ (h >> 32);
+}
+static uint64_t rrmxmx(uint64_t h, uint64_t len)
+{
+  h ^= rotl64(h, 49) ^ rotl64(h, 24);
+  h *= PrimeMx2;
+  h ^= (h >> 35) + len;
+  h *= PrimeMx2;
+  return h ^ (h >> 28);
+}
+static uint64_t mix16(const uint8_t *in, const uint8_t *secret)
+{
+  return mulFold64(read64(in) ^ read64(secret),
+                   read64(in + 8) ^ read64(secret + 8));
+}
+static void accumulate(uint64_t *acc, const uint8_t *in,
+                       const uint8_t *secret)
+{
+  for (int i = 0; i < 8; ++i) {
+    uint64_t v = read64(in + 8 * i);
+    uint64_t k = v ^ read64(secret + 8 * i);
+    acc[i ^ 1] += v;
+    acc[i] += (uint64_t)(uint32_t) k * (k >> 32);
+  }
+}
+static void scramble(uint64_t *acc, const uint8_t *secret)
+{
+  for (int i = 0; i < 8; ++i) {
+    uint64_t a = acc[i];
+    a ^= a >> 47;
+    a ^= read64(secret + 8 * i);
+    acc[i] = a * Prime32_1;
+  }
+}
+
+XXH3Digest::XXH3Digest() throw()
+  : total(0), bufLen(0), stripes(0)
+{
+  acc[0] = Prime32_3;
+  acc[1] = Prime64_1;
+  acc[2] = Prime64_2;
+  acc[3] = Prime64_3;
+  acc[4] = Prime64_4;
+  acc[5] = Prime32_2;
+  acc[6] = Prime64_5;
+  acc[7] = Prime32_1;
+}
+void XXH3Digest::consumeStripe(const uint8_t *stripe) throw()
+{
+  accumulate(acc, stripe, Secret + 8 * stripes);
+  memcpy(lastStripe, stripe, StripeLen);
+
+  if (++stripes == StripesPerBlock) {
+    scramble(acc, Secret + sizeof(Secret) - StripeLen);
+    stripes = 0;
+  }
+}
+/*
+ * Fold in every buffered stripe that is followed by more input; stripes
+ * can only be folded once the input is known to be longer than
+ * MidSizeMax.
+ */
+void XXH3Digest::update(const void *data, size_t len) throw()
+{
+  const uint8_t *in = (const uint8_t *) data;
+
+  while (len > 0) {
+    size_t take = BufSize - bufLen < len ? BufSize - bufLen : len;
+    memcpy(buf + bufLen, in, take);
+    bufLen += take;
+    total += take;
+    in += take;
+    len -= take;
+
+    if (total <= MidSizeMax) {
+      continue;
+    }
+
+    size_t pos = 0;
+
+    for (; bufLen - pos > StripeLen; pos += StripeLen) {
+      consumeStripe(buf + pos);
+    }
+
+    memmove(buf, buf + pos, bufLen - pos);
+    bufLen -= pos;
+  }
+}
+uint64_t XXH3Digest::hashShort() throw()
+{
+  const uint8_t *in = buf;
+  uint64_t len = total;
+
+  if (0 == len) {
+    return xxh64Avalanche(read64(Secret + 56) ^ read64(Secret + 64));
+  } else if (len <= 3) {
+    uint32_t combined = ((uint32_t) in[0] << 16) |
+                        ((uint32_t) in[len >> 1] << 24) |
+                        (uint32_t) in[len - 1] | ((uint32_t) len << 8);
+    uint64_t bitflip = read32(Secret) ^ read32(Secret + 4);
+    return xxh64Avalanche((uint64_t) combined ^ bitflip);
+  } else if (len <= 8) {
+    uint64_t bitflip = read64(Secret + 8) ^ read64(Secret + 16);
+    uint64_t v = read32(in + len - 4) + ((uint64_t) read32(in) << 32);
+    return rrmxmx(v ^ bitflip, len);
+  } else if (len <= 16) {
+    uint64_t lo = read64(in) ^ (read64(Secret + 24) ^ read64(Secret + 32));
+    uint64_t hi = read64(in + len - 8) ^
+                  (read64(Secret + 40) ^ read64(Secret + 48));
+    return avalanche(len + __builtin_bswap64(lo) + hi + mulFold64(lo, hi));
+  } else if (len <= 128) {
+    uint64_t h = len * Prime64_1;
+
+    if (len > 32) {
+      if (len > 64) {
+        if (len > 96) {
+          h += mix16(in + 48, Secret + 96);
+          h += mix16(in + len - 64, Secret + 112);
+        }
+
+        h += mix16(in + 32, Secret + 64);
+        h += mix16(in + len - 48, Secret + 80);
+      }
+
+      h += mix16(in + 16, Secret + 32);
+      h += mix16(in + len - 32, Secret + 48);
+    }
+
+    h += mix16(in, Secret);
+    h += mix16(in + len - 16, Secret + 16);
+    return avalanche(h);
+  }
+
+  uint64_t h = len * Prime64_1;
+
+  for (int i = 0; i < 8; ++i) {
+    h += mix16(in + 16 * i, Secret + 16 * i);
+  }
+
+  h = avalanche(h);
+
+  for (uint64_t i = 8; i < len / 16; ++i) {
+    h += mix16(in + 16 * i, Secret + 16 * (i - 8) + 3);
+  }
+
+  h += mix16(in + len - 16, Secret + 136 - 17);
+  return avalanche(h);
+}
+void XXH3Digest::final(uint8_t *out) throw()
+{
+  uint64_t h;
+
+  if (total <= MidSizeMax) {
+    h = hashShort();
+  } else {
+    //The last 64 bytes: the tail of the last stripe folded, then buf
+    uint8_t last[64];
+    memcpy(last, lastStripe + bufLen, StripeLen - bufLen);
+    memcpy(last + StripeLen - bufLen, buf, bufLen);
+    accumulate(acc, last, Secret + sizeof(Secret) - StripeLen - 7);
+    h = total * Prime64_1;
+
+    for (int i = 0; i < 4; ++i) {
+      h += mulFold64(acc[2 * i] ^ read64(Secret + 11 + 16 * i),
+                     acc[2 * i + 1] ^ read64(Secret + 11 + 16 * i + 8));
+    }
+
+    h = avalanche(h);
+  }
+
+  h = htobe64(h);
+  memcpy(out, &h, sizeof(h));
+}
+Digest *XXH3Digest::clone() const
+{
+  return new XXH3Digest(*this);
+}
+size_t XXH3Digest::getSize() const throw()
+{
+  return 8;
+}
+const char *XXH3Digest::getName() const throw()
+{
+  return "XXH3";
+}
@@ -0,0 +1,38 @@
+#ifndef XXH3DIGEST_HPP
+#define XXH3DIGEST_HPP
+#include <stdint.h>
+#include "Digest.hpp"
+using namespace std;
+/*
+ * XXH3, 64-bit, seed 0 and the default secret. The output is the hash
+ * value big-endian, as xxhsum prints it.
+ * Inputs of up to 240 bytes are hashed whole by final(); past that,
+ * stripes are folded into the accumulators as they arrive, keeping back
+ * the last one since the end of the input is hashed differently.
+ */
+class XXH3Digest : public Digest
+{
+private:
+  static const size_t StripeLen;
+  static const size_t MidSizeMax;
+  static const size_t BufSize = 256;
+
+  uint64_t acc[8];
+  uint64_t total;
+  uint8_t buf[BufSize];
+  size_t bufLen;
+  uint32_t stripes;    //Stripes folded into the current block
+  uint8_t lastStripe[64]; //The last 64 bytes folded
+
+  void consumeStripe(const uint8_t *stripe) throw();
+  uint64_t hashShort() throw();
+
+public:
+  XXH3Digest() throw();
+  void update(const void *data, size_t len) throw();
+  void final(uint8_t *out) throw();
+  Digest *clone() const;
+  size_t getSize() const throw();
+  const char *getName() const throw();
+};
+#endif //XXH3DIGEST_HPP